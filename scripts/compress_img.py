@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+# @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+"""Pack a signed MCUboot image into the compressed update file container.
+
+The container consists of a 12-byte header followed by the image compressed
+with heatshrink (LZSS with a bit-oriented format), which is decompressed by
+the bootloader as a stream while the image is validated and installed:
+
+    uint32_t magic;         "RHS1"
+    uint32_t img_size;      size of the decompressed image
+    uint8_t  window_sz2;    heatshrink window size, log2
+    uint8_t  lookahead_sz2; heatshrink lookahead size, log2
+    uint8_t  reserved[2];
+
+The output of the reference heatshrink encoder is accepted as well;
+this script only avoids a dependency on it.
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0x31534852
+
+
+class BitWriter:
+    def __init__(self):
+        self.out = bytearray()
+        self.cur = 0
+        self.nbits = 0
+
+    def put(self, value, count):
+        for i in range(count - 1, -1, -1):
+            self.cur = (self.cur << 1) | ((value >> i) & 1)
+            self.nbits += 1
+            if self.nbits == 8:
+                self.out.append(self.cur)
+                self.cur = 0
+                self.nbits = 0
+
+    def finish(self):
+        if self.nbits:
+            self.out.append(self.cur << (8 - self.nbits))
+        return bytes(self.out)
+
+
+def compress(data, window_sz2, lookahead_sz2):
+    window = 1 << window_sz2
+    max_len = 1 << lookahead_sz2
+    # A back-reference is used only if it is shorter than the literals it replaces
+    min_len = (1 + window_sz2 + lookahead_sz2) // 9 + 1
+    min_len = max(min_len, 3)
+    chains = {}
+    bw = BitWriter()
+    pos = 0
+    size = len(data)
+    while pos < size:
+        best_len = 0
+        best_dist = 0
+        key = data[pos:pos + 3]
+        if len(key) == 3:
+            for cand in reversed(chains.get(key, ())):
+                dist = pos - cand
+                if dist > window:
+                    break
+                length = 0
+                limit = min(max_len, size - pos)
+                while length < limit and data[cand + length] == data[pos + length]:
+                    length += 1
+                if length > best_len:
+                    best_len = length
+                    best_dist = dist
+                    if length == limit:
+                        break
+        step = best_len if best_len >= min_len else 1
+        if step > 1:
+            bw.put(0, 1)
+            bw.put(best_dist - 1, window_sz2)
+            bw.put(best_len - 1, lookahead_sz2)
+        else:
+            bw.put(1, 1)
+            bw.put(data[pos], 8)
+        for p in range(pos, pos + step):
+            chain = chains.setdefault(data[p:p + 3], [])
+            chain.append(p)
+            if len(chain) > 64:
+                del chain[0]
+        pos += step
+    return bw.finish()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('input', help='signed MCUboot image (.bin)')
+    parser.add_argument('output', help='compressed update file')
+    parser.add_argument('-w', '--window-sz2', type=int, default=10,
+                        help='window size, log2 (must not exceed RUUVI_MCUBOOT_FILE_IMG_DECOMP_WINDOW_SZ2_MAX)')
+    parser.add_argument('-l', '--lookahead-sz2', type=int, default=4, help='lookahead size, log2')
+    args = parser.parse_args()
+
+    if not (4 <= args.window_sz2 <= 15) or not (3 <= args.lookahead_sz2 < args.window_sz2):
+        sys.exit('Unsupported window/lookahead size')
+
+    with open(args.input, 'rb') as f:
+        data = f.read()
+    body = compress(data, args.window_sz2, args.lookahead_sz2)
+    hdr = struct.pack('<IIBBxx', MAGIC, len(data), args.window_sz2, args.lookahead_sz2)
+    with open(args.output, 'wb') as f:
+        f.write(hdr)
+        f.write(body)
+    print('%s: %d -> %d bytes (%.1f%%)' % (args.output, len(data), len(hdr) + len(body),
+                                           100.0 * (len(hdr) + len(body)) / max(len(data), 1)))
+
+
+if __name__ == '__main__':
+    main()
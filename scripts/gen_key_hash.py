@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+# @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+"""Generate the table of the image key hashes for the bootloader.
+
+The key hash TLV of a signed image is the hash of the public key as it is
+embedded in the bootloader (imgtool getpub). The table lists these hashes in
+the order of bootutil_keys[], so the bootloader finds the key of an image
+without hashing every public key for every key TLV:
+
+    const uint8_t  g_file_img_key_hash[key_cnt][hash_size];
+    const uint32_t g_file_img_key_hash_cnt;
+"""
+
+import argparse
+import hashlib
+import os
+
+from imgtool import keys
+
+HASH_ALGS = {
+    'sha256': hashlib.sha256,
+    'sha384': hashlib.sha384,
+    'sha512': hashlib.sha512,
+}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('keys', nargs='+', help='image signing keys in the order of bootutil_keys[]')
+    parser.add_argument('-o', '--output', required=True, help='generated C file')
+    parser.add_argument('-a', '--alg', choices=sorted(HASH_ALGS), default='sha256',
+                        help='image hash algorithm of the bootloader')
+    args = parser.parse_args()
+
+    hashes = [HASH_ALGS[args.alg](keys.load(path).get_public_bytes()).digest() for path in args.keys]
+    hash_size = len(hashes[0])
+
+    lines = [
+        '/* Generated by scripts/gen_key_hash.py, do not edit. */',
+        '',
+        '#include "file_img_key_hash.h"',
+        '',
+        'const uint8_t g_file_img_key_hash[%d][%d] = {' % (len(hashes), hash_size),
+    ]
+    for path, digest in zip(args.keys, hashes):
+        lines.append('    /* %s */' % os.path.basename(path))
+        lines.append('    {')
+        for i in range(0, hash_size, 8):
+            lines.append('        %s,' % ', '.join('0x%02x' % b for b in digest[i:i + 8]))
+        lines.append('    },')
+    lines.append('};')
+    lines.append('')
+    lines.append('const uint32_t g_file_img_key_hash_cnt = %d;' % len(hashes))
+
+    with open(args.output, 'w') as f:
+        f.write('\n'.join(lines) + '\n')
+
+
+if __name__ == '__main__':
+    main()
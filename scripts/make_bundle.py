@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+# @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+"""Pack several signed MCUboot images into a single bundle update file.
+
+The bundle starts with the manifest, an MCUboot image signed with imgtool,
+whose payload is the index table:
+
+    uint32_t magic;          "RBD1"
+    uint32_t image_cnt;
+    followed by image_cnt entries:
+    uint32_t image_id;       0 - MCUboot (s0), 1 - MCUboot (s1), 2 - firmware loader, 3 - application
+    uint32_t offset;         offset of the image in the bundle
+    uint32_t size;           size of the image in the bundle
+    uint8_t  img_hash[32];   image hash of the image (the value of its SHA-256 TLV)
+
+The manifest is padded to --manifest-size, the images follow it. Each image
+may be a plain signed image, a compressed file (compress_img.py) or a delta
+update (make_patch.py); the bootloader binds every image to the manifest by
+its image hash, so only the manifest signature has to be trusted.
+"""
+
+import argparse
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import compress_img  # noqa: E402
+import make_patch  # noqa: E402
+
+MAGIC = 0x31444252
+IMAGE_IDS = (('mcuboot0', 0), ('mcuboot1', 1), ('loader', 2), ('app', 3))
+
+
+def decompress(data):
+    """Heatshrink decoder for the compressed container, see compress_img.py."""
+    _, img_size, window_sz2, lookahead_sz2 = struct.unpack_from('<IIBBxx', data, 0)
+    bits = ''.join('{:08b}'.format(b) for b in data[12:])
+    out = bytearray()
+    pos = 0
+    while len(out) < img_size:
+        flag = bits[pos]
+        pos += 1
+        if flag == '1':
+            out.append(int(bits[pos:pos + 8], 2))
+            pos += 8
+        else:
+            dist = int(bits[pos:pos + window_sz2], 2) + 1
+            pos += window_sz2
+            count = int(bits[pos:pos + lookahead_sz2], 2) + 1
+            pos += lookahead_sz2
+            for _ in range(count):
+                out.append(out[-dist])
+    return bytes(out[:img_size])
+
+
+def get_image_hash(data):
+    magic = struct.unpack_from('<I', data, 0)[0]
+    if magic == compress_img.MAGIC:
+        return get_image_hash(decompress(data))
+    if magic == make_patch.MAGIC:
+        return struct.unpack_from(make_patch.HDR_FMT, data, 0)[6]
+    return make_patch.get_image_hash(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    for name, _ in IMAGE_IDS:
+        parser.add_argument('--' + name, help='update file for the %s slot' % name)
+    parser.add_argument('-k', '--key', required=True, help='image signing key')
+    parser.add_argument('--version', default='0.0.0', help='version of the manifest')
+    parser.add_argument('--manifest-size', type=lambda x: int(x, 0), default=0x1000,
+                        help='space reserved for the signed manifest')
+    parser.add_argument('--imgtool', default='imgtool', help='imgtool command')
+    parser.add_argument('output', help='bundle file')
+    args = parser.parse_args()
+
+    images = []
+    for name, image_id in IMAGE_IDS:
+        path = getattr(args, name)
+        if path:
+            with open(path, 'rb') as f:
+                images.append((image_id, f.read()))
+    if not images:
+        sys.exit('No images given')
+
+    index = struct.pack('<II', MAGIC, len(images))
+    offset = args.manifest_size
+    for image_id, data in images:
+        index += struct.pack('<III32s', image_id, offset, len(data), get_image_hash(data))
+        offset += (len(data) + 3) & ~3
+
+    with tempfile.TemporaryDirectory() as tmp:
+        payload = os.path.join(tmp, 'index.bin')
+        signed = os.path.join(tmp, 'manifest.bin')
+        with open(payload, 'wb') as f:
+            f.write(index)
+        subprocess.run(args.imgtool.split() + [
+            'sign', '--key', args.key, '--version', args.version, '--header-size', '0x200', '--pad-header',
+            '--align', '4', '--slot-size', hex(args.manifest_size), payload, signed], check=True)
+        with open(signed, 'rb') as f:
+            manifest = f.read()
+    if len(manifest) > args.manifest_size:
+        sys.exit('Signed manifest (%d bytes) does not fit into --manifest-size' % len(manifest))
+
+    out = bytearray(manifest) + bytearray(b'\xff' * (args.manifest_size - len(manifest)))
+    for _, data in images:
+        out += data
+        out += b'\xff' * (((len(data) + 3) & ~3) - len(data))
+    with open(args.output, 'wb') as f:
+        f.write(out)
+    print('%s: %d images, %d bytes' % (args.output, len(images), len(out)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+# @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+"""Wrap a signed MCUboot image into a chunk-verified update file.
+
+The file consists of a header, a signature, a table of chunk hashes and the image:
+
+    uint32_t magic;          "RCV1"
+    uint32_t img_size;       size of the image
+    uint32_t chunk_size;     size of each chunk except the last one
+    uint32_t chunk_cnt;
+    uint8_t  key_hash[32];   SHA-256 of the public key which verifies the signature
+    uint16_t sig_len;
+    uint8_t  reserved[2];
+    uint8_t  sig[sig_len];   padded with 0xFF to a multiple of 4 bytes
+    uint8_t  hashes[chunk_cnt][32];
+    uint8_t  image[img_size];
+
+The signature is made over the root hash: SHA-256 of the fields from magic to
+chunk_cnt followed by the table of chunk hashes. The key must be one of the
+image keys of the bootloader (the same key that was used to sign the image).
+The bootloader checks the signature once and then checks every chunk as it is
+read, so the image is verified and installed in a single pass over the file.
+"""
+
+import argparse
+import hashlib
+import struct
+
+from imgtool import keys
+
+MAGIC = 0x31564352
+HDR_FMT = '<IIII32sH2x'
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('image', help='signed MCUboot image (.bin)')
+    parser.add_argument('output', help='chunk-verified update file')
+    parser.add_argument('-k', '--key', required=True, help='image signing key')
+    parser.add_argument('-c', '--chunk-size', type=int, default=4096,
+                        help='chunk size (must not exceed RUUVI_MCUBOOT_FILE_IMG_CHUNKED_CHUNK_SIZE_MAX)')
+    args = parser.parse_args()
+    if args.chunk_size <= 0 or args.chunk_size % 4:
+        parser.error('chunk size must be a positive multiple of 4')
+
+    with open(args.image, 'rb') as f:
+        img = f.read()
+
+    hashes = b''.join(hashlib.sha256(img[i:i + args.chunk_size]).digest()
+                      for i in range(0, len(img), args.chunk_size))
+    chunk_cnt = len(hashes) // 32
+    root_data = struct.pack('<IIII', MAGIC, len(img), args.chunk_size, chunk_cnt) + hashes
+
+    key = keys.load(args.key)
+    if hasattr(key, 'sign_digest'):
+        sig = key.sign_digest(hashlib.sha256(root_data).digest())
+    else:
+        sig = key.sign(root_data)
+    key_hash = hashlib.sha256(key.get_public_bytes()).digest()
+
+    out = bytearray(struct.pack(HDR_FMT, MAGIC, len(img), args.chunk_size, chunk_cnt, key_hash, len(sig)))
+    out += sig
+    out += b'\xff' * (-len(sig) % 4)
+    out += hashes
+    out += img
+    with open(args.output, 'wb') as f:
+        f.write(out)
+    print('%s: %d chunks of %d bytes, %d bytes of overhead' % (
+        args.output, chunk_cnt, args.chunk_size, len(out) - len(img)))
+
+
+if __name__ == '__main__':
+    main()
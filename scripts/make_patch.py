@@ -0,0 +1,254 @@
+#!/usr/bin/env python3
+# @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+"""Generate a delta update file from the installed and the new signed MCUboot images.
+
+The delta update file consists of a header followed by a sequence of commands,
+each of them producing the next bytes of the new image:
+
+    uint32_t magic;          "RDP1"
+    uint32_t src_size;       size of the old image in the slot
+    uint32_t dst_size;       size of the new image
+    uint32_t sector_size;    flash sector size of the slot
+    uint32_t backlog;        number of overwritten sectors the commands may refer to
+    uint8_t  src_hash[32];   SHA-256 of the old image
+    uint8_t  dst_hash[32];   SHA-256 image hash of the new image (its hash TLV)
+
+    uint8_t  op;             0 - COPY, 1 - ADD, 2 - INSERT
+    uint8_t  reserved[3];
+    uint32_t len;
+    uint32_t src_off;        offset in the old image (COPY and ADD)
+    uint8_t  data[len];      ADD and INSERT only
+
+The bootloader applies the patch in place, sector by sector, so the new image
+in sector N may refer only to the old image in sectors N - backlog and above.
+By default the patch is compressed (see compress_img.py), which makes the
+mostly-zero data of the ADD commands cheap.
+"""
+
+import argparse
+import hashlib
+import os
+import struct
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import compress_img  # noqa: E402
+
+MAGIC = 0x31504452
+OP_COPY = 0
+OP_ADD = 1
+OP_INSERT = 2
+
+HDR_FMT = '<IIIII32s32s'
+CMD_FMT = '<B3xII'
+
+IMAGE_MAGIC = 0x96f3b83d
+IMAGE_TLV_INFO_MAGIC = 0x6907
+IMAGE_TLV_PROT_INFO_MAGIC = 0x6908
+IMAGE_TLV_SHA256 = 0x10
+
+KEY_LEN = 8
+MIN_COPY = 24
+MAX_CANDIDATES = 16
+ADD_WINDOW = 32
+
+
+def get_image_hash(img):
+    magic, _, hdr_size, prot_tlv_size, img_size = struct.unpack_from('<IIHHI', img, 0)
+    if magic != IMAGE_MAGIC:
+        sys.exit('New image is not a signed MCUboot image')
+    off = hdr_size + img_size
+    magic, tlv_tot = struct.unpack_from('<HH', img, off)
+    if magic == IMAGE_TLV_PROT_INFO_MAGIC:
+        off += prot_tlv_size
+        magic, tlv_tot = struct.unpack_from('<HH', img, off)
+    if magic != IMAGE_TLV_INFO_MAGIC:
+        sys.exit('New image has no TLV area')
+    end = off + tlv_tot
+    off += 4
+    while off < end:
+        tlv_type, tlv_len = struct.unpack_from('<HH', img, off)
+        if tlv_type == IMAGE_TLV_SHA256 and tlv_len == 32:
+            return img[off + 4:off + 4 + tlv_len]
+        off += 4 + tlv_len
+    sys.exit('New image has no SHA-256 hash TLV')
+
+
+class Differ:
+    def __init__(self, src, dst, sector_size, backlog):
+        self.src = src
+        self.dst = dst
+        self.sector_size = sector_size
+        self.backlog = backlog
+        self.index = {}
+        for i in range(len(src) - KEY_LEN + 1):
+            lst = self.index.setdefault(src[i:i + KEY_LEN], [])
+            if len(lst) < MAX_CANDIDATES:
+                lst.append(i)
+
+    def allowed_len(self, s, p, limit):
+        """Max length of a reference from the new image at p to the old image at s."""
+        # Within a sector of the new image the referred sector of the old image only grows,
+        # so the constraint has to be checked only where the new image enters the next sector
+        i = 0
+        while i < limit:
+            if (s + i) // self.sector_size + self.backlog < (p + i) // self.sector_size:
+                return i
+            i = ((p + i) // self.sector_size + 1) * self.sector_size - p
+        return limit
+
+    def match_len(self, s, p):
+        limit = self.allowed_len(s, p, min(len(self.src) - s, len(self.dst) - p))
+        n = 0
+        while n + 64 <= limit and self.src[s + n:s + n + 64] == self.dst[p + n:p + n + 64]:
+            n += 64
+        while n < limit and self.src[s + n] == self.dst[p + n]:
+            n += 1
+        return n
+
+    def similar_len(self, s, p):
+        """Length of the region where at least half of the bytes are equal, in whole windows."""
+        limit = self.allowed_len(s, p, min(len(self.src) - s, len(self.dst) - p))
+        n = 0
+        while n + ADD_WINDOW <= limit:
+            a = self.src[s + n:s + n + ADD_WINDOW]
+            b = self.dst[p + n:p + n + ADD_WINDOW]
+            if sum(1 for x, y in zip(a, b) if x == y) * 2 < ADD_WINDOW:
+                break
+            if a == b and n > 0:
+                # The unchanged data which follows is copied
+                break
+            n += ADD_WINDOW
+        return n
+
+    def diff(self):
+        cmds = []
+        literal = bytearray()
+        diag = 0
+        p = 0
+        n = len(self.dst)
+
+        def flush():
+            if literal:
+                cmds.append((OP_INSERT, len(literal), 0, bytes(literal)))
+                literal.clear()
+
+        while p < n:
+            best_len = 0
+            best_s = 0
+            candidates = list(self.index.get(self.dst[p:p + KEY_LEN], ()))
+            if 0 <= p + diag < len(self.src):
+                # The data which follows the previous match is the most likely continuation
+                candidates.append(p + diag)
+            for s in candidates:
+                length = self.match_len(s, p)
+                if length > best_len:
+                    best_len = length
+                    best_s = s
+            if best_len >= MIN_COPY:
+                flush()
+                cmds.append((OP_COPY, best_len, best_s, b''))
+                diag = best_s - p
+                p += best_len
+                continue
+            s = p + diag
+            if 0 <= s < len(self.src):
+                length = self.similar_len(s, p)
+                if length > 0:
+                    flush()
+                    data = bytes((self.dst[p + i] - self.src[s + i]) & 0xFF for i in range(length))
+                    cmds.append((OP_ADD, length, s, data))
+                    p += length
+                    continue
+            literal.append(self.dst[p])
+            p += 1
+        flush()
+        return cmds
+
+
+def apply_in_place(src, cmds, dst_size, sector_size, backlog):
+    """Simulate the bootloader: the slot is overwritten sector by sector, old sectors are kept in a ring."""
+    slot = bytearray(src) + bytearray(max(0, dst_size - len(src)))
+    snapshots = {}
+    out = bytearray()
+    sector_cur = -1
+
+    def read_src(dst_off, src_off, length):
+        res = bytearray()
+        for i in range(length):
+            src_idx = (src_off + i) // sector_size
+            dst_idx = (dst_off + i) // sector_size
+            if src_idx + backlog < dst_idx:
+                raise ValueError('reference to an overwritten sector')
+            if src_idx in snapshots:
+                res.append(snapshots[src_idx][(src_off + i) % sector_size])
+            elif src_idx > sector_cur:
+                res.append(slot[src_off + i])
+            else:
+                raise ValueError('old contents of sector %d are lost' % src_idx)
+        return res
+
+    for op, length, src_off, data in cmds:
+        for i in range(length):
+            pos = len(out)
+            idx = pos // sector_size
+            while sector_cur < idx:
+                sector_cur += 1
+                start = sector_cur * sector_size
+                if start < len(src):
+                    snapshots[sector_cur] = bytes(slot[start:start + sector_size])
+                    snapshots.pop(sector_cur - backlog - 1, None)
+                if sector_cur > 0:
+                    prev = (sector_cur - 1) * sector_size
+                    slot[prev:prev + sector_size] = out[prev:prev + sector_size]
+            if op == OP_INSERT:
+                out.append(data[i])
+            else:
+                byte = read_src(pos, src_off + i, 1)[0]
+                out.append((byte + data[i]) & 0xFF if op == OP_ADD else byte)
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('old', help='signed MCUboot image installed in the slot (.bin)')
+    parser.add_argument('new', help='new signed MCUboot image (.bin)')
+    parser.add_argument('output', help='delta update file')
+    parser.add_argument('-s', '--sector-size', type=int, default=4096,
+                        help='flash sector size (RUUVI_MCUBOOT_FILE_IMG_PATCH_SECTOR_SIZE)')
+    parser.add_argument('-b', '--backlog', type=int, default=1,
+                        help='number of overwritten sectors the patch may refer to '
+                             '(must not exceed RUUVI_MCUBOOT_FILE_IMG_PATCH_BACKLOG)')
+    parser.add_argument('--no-compress', action='store_true', help='do not compress the patch')
+    parser.add_argument('-w', '--window-sz2', type=int, default=10, help='compression window size, log2')
+    parser.add_argument('-l', '--lookahead-sz2', type=int, default=4, help='compression lookahead size, log2')
+    args = parser.parse_args()
+
+    with open(args.old, 'rb') as f:
+        src = f.read()
+    with open(args.new, 'rb') as f:
+        dst = f.read()
+
+    cmds = Differ(src, dst, args.sector_size, args.backlog).diff()
+    if apply_in_place(src, cmds, len(dst), args.sector_size, args.backlog) != dst:
+        sys.exit('Internal error: the patch does not reproduce the new image')
+
+    patch = bytearray(struct.pack(HDR_FMT, MAGIC, len(src), len(dst), args.sector_size, args.backlog,
+                                  hashlib.sha256(src).digest(), get_image_hash(dst)))
+    for op, length, src_off, data in cmds:
+        patch += struct.pack(CMD_FMT, op, length, src_off)
+        patch += data
+
+    if args.no_compress:
+        out = bytes(patch)
+    else:
+        out = struct.pack('<IIBBxx', compress_img.MAGIC, len(patch), args.window_sz2, args.lookahead_sz2)
+        out += compress_img.compress(bytes(patch), args.window_sz2, args.lookahead_sz2)
+    with open(args.output, 'wb') as f:
+        f.write(out)
+    print('%s: %d commands, %d -> %d bytes (%.1f%% of the new image)' % (
+        args.output, len(cmds), len(dst), len(out), 100.0 * len(out) / max(len(dst), 1)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+# @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+"""Convert a signed MCUboot image into a sparse update file without its erased (0xFF) regions.
+
+The sparse update file consists of a header, a table of data runs and the data of the runs:
+
+    uint32_t magic;          "RSP1"
+    uint32_t img_size;       size of the expanded image
+    uint32_t run_cnt;
+    uint32_t reserved;
+
+    uint32_t offset;         offset of the data run in the image
+    uint32_t len;            length of the data run
+
+The bytes of the image outside the data runs are 0xFF. The bootloader expands
+the image as it is read, so the signature and the hash cover the expanded
+image, and the erased regions are neither stored nor programmed.
+"""
+
+import argparse
+import struct
+
+MAGIC = 0x31505352
+RUN_FMT = '<II'
+
+
+def find_runs(img, min_gap):
+    """Data runs of the image, 0xFF gaps shorter than min_gap are kept in the runs."""
+    runs = []
+    start = None
+    pos = 0
+    size = len(img)
+    while pos < size:
+        if img[pos] != 0xFF:
+            if start is None:
+                start = pos
+            pos += 1
+            continue
+        gap_end = pos
+        while gap_end < size and img[gap_end] == 0xFF:
+            gap_end += 1
+        if gap_end - pos >= min_gap or gap_end == size:
+            if start is not None:
+                runs.append((start, pos - start))
+                start = None
+        elif start is None:
+            start = pos
+        pos = gap_end
+    if start is not None:
+        runs.append((start, size - start))
+    return runs
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('input', help='signed MCUboot image (.bin)')
+    parser.add_argument('output', help='sparse update file')
+    parser.add_argument('-g', '--min-gap', type=int, default=64,
+                        help='min length of an erased region which is not stored')
+    args = parser.parse_args()
+
+    with open(args.input, 'rb') as f:
+        img = f.read()
+
+    runs = find_runs(img, max(args.min_gap, struct.calcsize(RUN_FMT) + 1))
+    out = bytearray(struct.pack('<IIII', MAGIC, len(img), len(runs), 0))
+    for offset, length in runs:
+        out += struct.pack(RUN_FMT, offset, length)
+    for offset, length in runs:
+        out += img[offset:offset + length]
+
+    expanded = bytearray(b'\xff' * len(img))
+    for offset, length in runs:
+        expanded[offset:offset + length] = img[offset:offset + length]
+    if expanded != img:
+        raise SystemExit('Internal error: the sparse file does not reproduce the image')
+
+    with open(args.output, 'wb') as f:
+        f.write(out)
+    print('%s: %d data runs, %d -> %d bytes (%.1f%%)' % (
+        args.output, len(runs), len(img), len(out), 100.0 * len(out) / max(len(img), 1)))
+
+
+if __name__ == '__main__':
+    main()
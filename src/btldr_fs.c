@@ -218,3 +218,71 @@ btldr_fs_get_file_size(struct fs_file_t* const p_file)
     (void)fs_seek(p_file, cur_offset, FS_SEEK_SET);
     return size;
 }
+
+bool
+btldr_fs_write_file(const char* const p_file_name, const void* const p_buf, const size_t len)
+{
+    const btldr_fs_abs_path_t* const p_abs_path = btldr_fs_lock_and_get_abs_path(p_file_name);
+
+    struct fs_file_t file = { 0 };
+    fs_file_t_init(&file);
+    zephyr_api_ret_t rc = fs_open(&file, p_abs_path->buf, FS_O_CREATE | FS_O_WRITE);
+    if (rc < 0)
+    {
+        LOG_ERR("Failed to open file %s for writing, rc=%d", p_file_name, rc);
+        btldr_fs_unlock();
+        return false;
+    }
+    bool res = true;
+    rc       = fs_truncate(&file, 0);
+    if (0 != rc)
+    {
+        LOG_ERR("Failed to truncate file %s, rc=%d", p_file_name, rc);
+        res = false;
+    }
+    else
+    {
+        const ssize_t len_written = fs_write(&file, p_buf, len);
+        if (len_written != (ssize_t)len)
+        {
+            LOG_ERR("Failed to write file %s, rc=%d", p_file_name, (int)len_written);
+            res = false;
+        }
+    }
+    rc = fs_close(&file);
+    if (0 != rc)
+    {
+        LOG_ERR("Failed to close file %s, rc=%d", p_file_name, rc);
+        res = false;
+    }
+    btldr_fs_unlock();
+    return res;
+}
+
+bool
+btldr_fs_read_file(const char* const p_file_name, void* const p_buf, const size_t len)
+{
+    const btldr_fs_abs_path_t* const p_abs_path = btldr_fs_lock_and_get_abs_path(p_file_name);
+
+    struct fs_file_t file = { 0 };
+    fs_file_t_init(&file);
+    const zephyr_api_ret_t rc = fs_open(&file, p_abs_path->buf, FS_O_READ);
+    if (rc < 0)
+    {
+        if (-ENOENT != rc)
+        {
+            LOG_ERR("Failed to open file %s, rc=%d", p_file_name, rc);
+        }
+        btldr_fs_unlock();
+        return false;
+    }
+    const ssize_t len_read = fs_read(&file, p_buf, len);
+    (void)fs_close(&file);
+    btldr_fs_unlock();
+    if (len_read != (ssize_t)len)
+    {
+        LOG_ERR("Failed to read file %s, rc=%d", p_file_name, (int)len_read);
+        return false;
+    }
+    return true;
+}
@@ -6,6 +6,7 @@
 #define BTLDR_FS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <sys/types.h>
 
 #ifdef __cplusplus
@@ -36,6 +37,21 @@ btldr_fs_unlink_file(const char* const p_file_name);
 off_t
 btldr_fs_get_file_size(struct fs_file_t* const p_file);
 
+/**
+ * Create or overwrite a small file with the given contents.
+ * LittleFS commits the new contents atomically when the file is closed,
+ * so after a power loss the file holds either the old or the new contents.
+ */
+bool
+btldr_fs_write_file(const char* const p_file_name, const void* const p_buf, const size_t len);
+
+/**
+ * Read exactly len bytes from the beginning of the file.
+ * @return false if the file does not exist or is shorter than len.
+ */
+bool
+btldr_fs_read_file(const char* const p_file_name, void* const p_buf, const size_t len);
+
 #ifdef __cplusplus
 }
 #endif
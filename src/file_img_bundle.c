@@ -0,0 +1,181 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#include "file_img_bundle.h"
+#include <string.h>
+#include <inttypes.h>
+#include <zephyr/logging/log.h>
+#include <bootutil/fault_injection_hardening.h>
+#include "file_img_validate.h"
+#include "file_tlv.h"
+#include "zephyr_api.h"
+
+LOG_MODULE_DECLARE(mcuboot, CONFIG_MCUBOOT_LOG_LEVEL);
+
+#define FILE_IMG_BUNDLE_TMPBUF_SZ 256
+
+static bool
+file_img_bundle_validate_manifest(
+    file_img_reader_t* const   p_reader,
+    const char* const          p_file_name,
+    struct image_header* const p_img_hdr,
+    uint32_t* const            p_manifest_end)
+{
+    static uint8_t tmp_buf[FILE_IMG_BUNDLE_TMPBUF_SZ];
+
+    const uint32_t   file_size = file_img_reader_get_size(p_reader);
+    zephyr_api_ret_t rc        = file_img_reader_read(p_reader, 0, p_img_hdr, sizeof(*p_img_hdr));
+    if (0 != rc)
+    {
+        LOG_ERR("Failed to read manifest header from file %s, rc=%d", p_file_name, rc);
+        return false;
+    }
+    if ((IMAGE_MAGIC != p_img_hdr->ih_magic) || (p_img_hdr->ih_hdr_size > file_size)
+        || (p_img_hdr->ih_img_size > (file_size - p_img_hdr->ih_hdr_size)))
+    {
+        LOG_ERR("Bad manifest header in file %s", p_file_name);
+        return false;
+    }
+
+    FIH_DECLARE(validity_res, FIH_FAILURE);
+    FIH_CALL(
+        file_img_validate,
+        validity_res,
+        p_img_hdr,
+        p_reader,
+        file_size,
+        tmp_buf,
+        sizeof(tmp_buf),
+        NULL,
+        0,
+        NULL);
+    if (FIH_NOT_EQ(validity_res, FIH_SUCCESS))
+    {
+        LOG_ERR("Manifest validation failed for file %s", p_file_name);
+        return false;
+    }
+
+    file_tlv_iter_t it = { 0 };
+    rc                 = file_tlv_iter_begin(&it, p_img_hdr, p_reader, IMAGE_TLV_ANY, false);
+    if (0 != rc)
+    {
+        LOG_ERR("Failed to find manifest TLV area in file %s, rc=%d", p_file_name, rc);
+        return false;
+    }
+    *p_manifest_end = it.tlv_end;
+    return true;
+}
+
+static bool
+file_img_bundle_check_entry(
+    const file_img_bundle_t* const       p_bundle,
+    const file_img_bundle_entry_t* const p_entry,
+    const uint32_t                       manifest_end,
+    const uint32_t                       file_size)
+{
+    if (p_entry->image_id >= (uint32_t)FILE_IMG_BUNDLE_IMAGE_CNT)
+    {
+        LOG_ERR("Bundle %s: unknown image ID %" PRIu32, p_bundle->p_file_name, p_entry->image_id);
+        return false;
+    }
+    if (p_entry != file_img_bundle_find(p_bundle, (file_img_bundle_image_e)p_entry->image_id))
+    {
+        LOG_ERR("Bundle %s: image ID %" PRIu32 " is duplicated", p_bundle->p_file_name, p_entry->image_id);
+        return false;
+    }
+    if ((p_entry->offset < manifest_end) || (p_entry->offset > file_size) || (0 == p_entry->size)
+        || (p_entry->size > (file_size - p_entry->offset)))
+    {
+        LOG_ERR(
+            "Bundle %s: image ID %" PRIu32 " at offset %" PRIu32 ", size %" PRIu32 " is out of bounds",
+            p_bundle->p_file_name,
+            p_entry->image_id,
+            p_entry->offset,
+            p_entry->size);
+        return false;
+    }
+    return true;
+}
+
+bool
+file_img_bundle_load(file_img_bundle_t* const p_bundle, const char* const p_file_name)
+{
+    memset(p_bundle, 0, sizeof(*p_bundle));
+    p_bundle->p_file_name = p_file_name;
+
+    const file_img_loc_t loc    = { .p_file_name = p_file_name, .offset = 0, .size = 0 };
+    file_img_reader_t    reader = { 0 };
+    if (!file_img_reader_open(&reader, &loc, FILE_IMG_READER_FA_ID_NONE))
+    {
+        return false;
+    }
+
+    struct image_header img_hdr      = { 0 };
+    uint32_t            manifest_end = 0;
+    if (!file_img_bundle_validate_manifest(&reader, p_file_name, &img_hdr, &manifest_end))
+    {
+        file_img_reader_close(&reader);
+        return false;
+    }
+
+    file_img_bundle_index_hdr_t index_hdr = { 0 };
+
+    zephyr_api_ret_t rc = file_img_reader_read(&reader, img_hdr.ih_hdr_size, &index_hdr, sizeof(index_hdr));
+    if ((0 != rc) || (FILE_IMG_BUNDLE_MAGIC != index_hdr.magic) || (0 == index_hdr.image_cnt)
+        || (index_hdr.image_cnt > (uint32_t)FILE_IMG_BUNDLE_IMAGE_CNT)
+        || (img_hdr.ih_img_size < (sizeof(index_hdr) + (index_hdr.image_cnt * sizeof(file_img_bundle_entry_t)))))
+    {
+        LOG_ERR("Bad index table in bundle %s, rc=%d", p_file_name, rc);
+        file_img_reader_close(&reader);
+        return false;
+    }
+    rc = file_img_reader_read(
+        &reader,
+        img_hdr.ih_hdr_size + sizeof(index_hdr),
+        p_bundle->entries,
+        index_hdr.image_cnt * sizeof(file_img_bundle_entry_t));
+    const uint32_t file_size = file_img_reader_get_size(&reader);
+    file_img_reader_close(&reader);
+    if (0 != rc)
+    {
+        LOG_ERR("Failed to read index table from bundle %s, rc=%d", p_file_name, rc);
+        return false;
+    }
+    p_bundle->image_cnt = index_hdr.image_cnt;
+
+    for (uint32_t i = 0; i < p_bundle->image_cnt; ++i)
+    {
+        if (!file_img_bundle_check_entry(p_bundle, &p_bundle->entries[i], manifest_end, file_size))
+        {
+            p_bundle->image_cnt = 0;
+            return false;
+        }
+    }
+    LOG_INF("Bundle %s: manifest validated, %" PRIu32 " images", p_file_name, p_bundle->image_cnt);
+    return true;
+}
+
+const file_img_bundle_entry_t*
+file_img_bundle_find(const file_img_bundle_t* const p_bundle, const file_img_bundle_image_e image_id)
+{
+    for (uint32_t i = 0; i < p_bundle->image_cnt; ++i)
+    {
+        if ((uint32_t)image_id == p_bundle->entries[i].image_id)
+        {
+            return &p_bundle->entries[i];
+        }
+    }
+    return NULL;
+}
+
+file_img_loc_t
+file_img_bundle_get_loc(const file_img_bundle_t* const p_bundle, const file_img_bundle_entry_t* const p_entry)
+{
+    const file_img_loc_t loc = {
+        .p_file_name = p_bundle->p_file_name,
+        .offset      = p_entry->offset,
+        .size        = p_entry->size,
+    };
+    return loc;
+}
@@ -0,0 +1,82 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#ifndef FILE_IMG_BUNDLE_H
+#define FILE_IMG_BUNDLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <bootutil/image.h>
+#include "file_img_reader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Magic of the index table in the bundle manifest: "RBD1" */
+#define FILE_IMG_BUNDLE_MAGIC 0x31444252U
+
+#define FILE_IMG_BUNDLE_FILE_NAME CONFIG_RUUVI_MCUBOOT_FILE_IMG_BUNDLE_FILE_NAME
+
+typedef enum file_img_bundle_image_e
+{
+    FILE_IMG_BUNDLE_IMAGE_MCUBOOT0 = 0, /* MCUboot in s0 */
+    FILE_IMG_BUNDLE_IMAGE_MCUBOOT1 = 1, /* MCUboot in s1 */
+    FILE_IMG_BUNDLE_IMAGE_LOADER   = 2, /* Firmware loader in mcuboot_secondary */
+    FILE_IMG_BUNDLE_IMAGE_APP      = 3, /* Application in mcuboot_primary */
+    FILE_IMG_BUNDLE_IMAGE_CNT,
+} file_img_bundle_image_e;
+
+/**
+ * The bundle starts with the manifest, which is an MCUboot image signed with the same key as the firmware images.
+ * The payload of the manifest is the index table: this header followed by image_cnt entries.
+ * The images follow the manifest, each of them may be stored in any of the supported formats
+ * (plain, compressed or delta update).
+ */
+typedef struct file_img_bundle_index_hdr_t
+{
+    uint32_t magic;
+    uint32_t image_cnt;
+} file_img_bundle_index_hdr_t;
+
+typedef struct file_img_bundle_entry_t
+{
+    uint32_t image_id; /* file_img_bundle_image_e */
+    uint32_t offset;   /* Offset of the image in the bundle file */
+    uint32_t size;     /* Size of the image in the bundle file */
+    uint8_t  img_hash[IMAGE_HASH_SIZE]; /* Image hash of the image (the value of its hash TLV) */
+} file_img_bundle_entry_t;
+
+typedef struct file_img_bundle_t
+{
+    const char*             p_file_name;
+    uint32_t                image_cnt;
+    file_img_bundle_entry_t entries[FILE_IMG_BUNDLE_IMAGE_CNT];
+} file_img_bundle_t;
+
+/**
+ * Validate the signature of the bundle manifest and load its index table.
+ * @return true if the manifest is valid and every image lies within the bundle file.
+ */
+bool
+file_img_bundle_load(file_img_bundle_t* const p_bundle, const char* const p_file_name);
+
+/**
+ * Find the image with the given ID in the bundle.
+ * @return pointer to the entry, NULL if the bundle does not contain the image.
+ */
+const file_img_bundle_entry_t*
+file_img_bundle_find(const file_img_bundle_t* const p_bundle, const file_img_bundle_image_e image_id);
+
+/**
+ * Get the location of the image in the bundle file.
+ */
+file_img_loc_t
+file_img_bundle_get_loc(const file_img_bundle_t* const p_bundle, const file_img_bundle_entry_t* const p_entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FILE_IMG_BUNDLE_H
@@ -0,0 +1,183 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#include "file_img_chunked.h"
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <zephyr/logging/log.h>
+#include <bootutil/crypto/sha.h>
+#include <bootutil/fault_injection_hardening.h>
+#include "file_img_validate.h"
+
+LOG_MODULE_DECLARE(mcuboot, CONFIG_MCUBOOT_LOG_LEVEL);
+
+_Static_assert(
+    FILE_IMG_CHUNKED_SIG_MAX_SIZE <= FILE_IMG_CHUNKED_CHUNK_SIZE_MAX,
+    "The signature is loaded into the chunk buffer");
+
+static zephyr_api_ret_t
+file_img_chunked_read_file(
+    const file_img_chunked_t* const p_chunked,
+    const off_t                     offset,
+    void* const                     p_buf,
+    const size_t                    len)
+{
+    const zephyr_api_ret_t rc = fs_seek(p_chunked->p_file, offset, FS_SEEK_SET);
+    if (0 != rc)
+    {
+        return rc;
+    }
+    const ssize_t len_read = fs_read(p_chunked->p_file, p_buf, len);
+    if (len_read < 0)
+    {
+        return (zephyr_api_ret_t)len_read;
+    }
+    if (len_read != (ssize_t)len)
+    {
+        return -EIO;
+    }
+    return 0;
+}
+
+zephyr_api_ret_t
+file_img_chunked_init(
+    file_img_chunked_t* const           p_chunked,
+    struct fs_file_t* const             p_file,
+    const file_img_chunked_hdr_t* const p_hdr,
+    const off_t                         hdr_off)
+{
+    if ((0 == p_hdr->img_size) || (0 == p_hdr->chunk_size) || (p_hdr->chunk_size > FILE_IMG_CHUNKED_CHUNK_SIZE_MAX)
+        || (0 != (p_hdr->chunk_size % sizeof(uint32_t))) || (p_hdr->chunk_cnt > FILE_IMG_CHUNKED_MAX_CHUNKS)
+        || (p_hdr->chunk_cnt != (((p_hdr->img_size - 1U) / p_hdr->chunk_size) + 1U))
+        || (p_hdr->sig_len > FILE_IMG_CHUNKED_SIG_MAX_SIZE))
+    {
+        LOG_ERR(
+            "Unsupported chunk parameters: img_size=%" PRIu32 ", chunk_size=%" PRIu32 ", chunk_cnt=%" PRIu32,
+            p_hdr->img_size,
+            p_hdr->chunk_size,
+            p_hdr->chunk_cnt);
+        return -EINVAL;
+    }
+    p_chunked->p_file        = p_file;
+    p_chunked->img_size      = p_hdr->img_size;
+    p_chunked->chunk_size    = p_hdr->chunk_size;
+    p_chunked->chunk_cnt     = p_hdr->chunk_cnt;
+    p_chunked->cur_chunk_idx = UINT32_MAX;
+    p_chunked->cur_chunk_len = 0;
+
+    const off_t  sig_off        = hdr_off + (off_t)sizeof(*p_hdr);
+    const size_t sig_len_padded = ((size_t)p_hdr->sig_len + (sizeof(uint32_t) - 1U)) & ~(sizeof(uint32_t) - 1U);
+    const off_t  table_off      = sig_off + (off_t)sig_len_padded;
+    const size_t table_size     = (size_t)p_hdr->chunk_cnt * IMAGE_HASH_SIZE;
+    p_chunked->data_off         = table_off + (off_t)table_size;
+
+    /* The signature is kept in the chunk buffer until the table is verified */
+    zephyr_api_ret_t rc = file_img_chunked_read_file(p_chunked, sig_off, p_chunked->buf, p_hdr->sig_len);
+    if (0 == rc)
+    {
+        rc = file_img_chunked_read_file(p_chunked, table_off, p_chunked->hashes, table_size);
+    }
+    if (0 != rc)
+    {
+        LOG_ERR("Failed to read chunk hash table, rc=%d", rc);
+        return rc;
+    }
+
+    uint8_t              root_hash[IMAGE_HASH_SIZE];
+    bootutil_sha_context sha_ctx;
+    bootutil_sha_init(&sha_ctx);
+    bootutil_sha_update(&sha_ctx, p_hdr, offsetof(file_img_chunked_hdr_t, key_hash));
+    bootutil_sha_update(&sha_ctx, p_chunked->hashes, table_size);
+    bootutil_sha_finish(&sha_ctx, root_hash);
+    bootutil_sha_drop(&sha_ctx);
+
+    FIH_DECLARE(fih_rc, FIH_FAILURE);
+    FIH_CALL(file_img_validate_sig, fih_rc, root_hash, p_hdr->key_hash, p_chunked->buf, p_hdr->sig_len);
+    if (FIH_NOT_EQ(fih_rc, FIH_SUCCESS))
+    {
+        LOG_ERR("Signature of the chunk hash table is not valid");
+        return -EBADMSG;
+    }
+    LOG_INF(
+        "Chunk hash table validated: %" PRIu32 " chunks of %" PRIu32 " bytes",
+        p_chunked->chunk_cnt,
+        p_chunked->chunk_size);
+    return 0;
+}
+
+static zephyr_api_ret_t
+file_img_chunked_load_chunk(file_img_chunked_t* const p_chunked, const uint32_t chunk_idx)
+{
+    const uint32_t chunk_off = chunk_idx * p_chunked->chunk_size;
+    const uint32_t chunk_len = ((p_chunked->img_size - chunk_off) > p_chunked->chunk_size)
+                                   ? p_chunked->chunk_size
+                                   : (p_chunked->img_size - chunk_off);
+
+    p_chunked->cur_chunk_idx = UINT32_MAX;
+
+    const zephyr_api_ret_t rc = file_img_chunked_read_file(
+        p_chunked,
+        p_chunked->data_off + (off_t)chunk_off,
+        p_chunked->buf,
+        chunk_len);
+    if (0 != rc)
+    {
+        return rc;
+    }
+
+    uint8_t              hash[IMAGE_HASH_SIZE];
+    bootutil_sha_context sha_ctx;
+    bootutil_sha_init(&sha_ctx);
+    bootutil_sha_update(&sha_ctx, p_chunked->buf, chunk_len);
+    bootutil_sha_finish(&sha_ctx, hash);
+    bootutil_sha_drop(&sha_ctx);
+
+    FIH_DECLARE(fih_rc, FIH_FAILURE);
+    FIH_CALL(boot_fih_memequal, fih_rc, hash, p_chunked->hashes[chunk_idx], IMAGE_HASH_SIZE);
+    if (FIH_NOT_EQ(fih_rc, FIH_SUCCESS))
+    {
+        LOG_ERR("Chunk %" PRIu32 " at offset 0x%08" PRIx32 " does not match its hash", chunk_idx, chunk_off);
+        return -EBADMSG;
+    }
+    p_chunked->cur_chunk_idx = chunk_idx;
+    p_chunked->cur_chunk_len = chunk_len;
+    return 0;
+}
+
+zephyr_api_ret_t
+file_img_chunked_read_at(
+    file_img_chunked_t* const p_chunked,
+    const uint32_t            offset,
+    uint8_t* const            p_buf,
+    const size_t              len)
+{
+    if ((offset > p_chunked->img_size) || (len > (p_chunked->img_size - offset)))
+    {
+        return -EINVAL;
+    }
+    size_t pos = 0;
+    while (pos < len)
+    {
+        const uint32_t cur_off   = offset + (uint32_t)pos;
+        const uint32_t chunk_idx = cur_off / p_chunked->chunk_size;
+        if (chunk_idx != p_chunked->cur_chunk_idx)
+        {
+            const zephyr_api_ret_t rc = file_img_chunked_load_chunk(p_chunked, chunk_idx);
+            if (0 != rc)
+            {
+                return rc;
+            }
+        }
+        const uint32_t off_in_chunk = cur_off - (chunk_idx * p_chunked->chunk_size);
+        size_t         part_len     = p_chunked->cur_chunk_len - off_in_chunk;
+        if (part_len > (len - pos))
+        {
+            part_len = len - pos;
+        }
+        memcpy(&p_buf[pos], &p_chunked->buf[off_in_chunk], part_len);
+        pos += part_len;
+    }
+    return 0;
+}
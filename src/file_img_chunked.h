@@ -0,0 +1,91 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#ifndef FILE_IMG_CHUNKED_H
+#define FILE_IMG_CHUNKED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <zephyr/fs/fs.h>
+#include <bootutil/image.h>
+#include "zephyr_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Magic of the chunk-verified update file container: "RCV1" */
+#define FILE_IMG_CHUNKED_MAGIC 0x31564352U
+
+#define FILE_IMG_CHUNKED_CHUNK_SIZE_MAX CONFIG_RUUVI_MCUBOOT_FILE_IMG_CHUNKED_CHUNK_SIZE_MAX
+#define FILE_IMG_CHUNKED_MAX_CHUNKS     CONFIG_RUUVI_MCUBOOT_FILE_IMG_CHUNKED_MAX_CHUNKS
+#define FILE_IMG_CHUNKED_SIG_MAX_SIZE   512
+
+/**
+ * Header of the chunk-verified update file container.
+ * It is followed by the signature (sig_len bytes, padded to a multiple of 4),
+ * the table of chunk_cnt hashes (IMAGE_HASH_SIZE bytes each) and the signed MCUboot image.
+ * The root hash is calculated over the fields from magic to chunk_cnt followed by the table of chunk hashes,
+ * it is signed with one of the image keys (key_hash is the hash of its public key).
+ * Chunk i covers the bytes [i * chunk_size, (i + 1) * chunk_size) of the image.
+ */
+typedef struct file_img_chunked_hdr_t
+{
+    uint32_t magic;
+    uint32_t img_size;   /* Size of the image */
+    uint32_t chunk_size; /* Size of each chunk except the last one */
+    uint32_t chunk_cnt;
+    uint8_t  key_hash[IMAGE_HASH_SIZE];
+    uint16_t sig_len;
+    uint8_t  reserved[2];
+} file_img_chunked_hdr_t;
+
+/**
+ * State of the chunk verifier.
+ * The hash table is kept in RAM, so it is read and checked against the signature only once, when the file is opened.
+ * The last verified chunk is cached, reads are served from it.
+ */
+typedef struct file_img_chunked_t
+{
+    struct fs_file_t* p_file;
+    off_t             data_off; /* Offset of the image in the file */
+    uint32_t          img_size;
+    uint32_t          chunk_size;
+    uint32_t          chunk_cnt;
+    uint32_t          cur_chunk_idx; /* Index of the chunk in buf, UINT32_MAX if none */
+    uint32_t          cur_chunk_len;
+    uint8_t           hashes[FILE_IMG_CHUNKED_MAX_CHUNKS][IMAGE_HASH_SIZE];
+    uint8_t           buf[FILE_IMG_CHUNKED_CHUNK_SIZE_MAX] __aligned(4);
+} file_img_chunked_t;
+
+/**
+ * Load the chunk hash table which follows the header at hdr_off in the file and verify its signature.
+ * @return 0 on success, negative error code otherwise.
+ */
+zephyr_api_ret_t
+file_img_chunked_init(
+    file_img_chunked_t* const           p_chunked,
+    struct fs_file_t* const             p_file,
+    const file_img_chunked_hdr_t* const p_hdr,
+    const off_t                         hdr_off);
+
+/**
+ * Read image data at the given offset.
+ * Each chunk is read from the file as a whole and checked against its hash before any of its bytes is returned.
+ * @return 0 on success, -EBADMSG if a chunk does not match its hash, negative error code otherwise.
+ */
+zephyr_api_ret_t
+file_img_chunked_read_at(
+    file_img_chunked_t* const p_chunked,
+    const uint32_t            offset,
+    uint8_t* const            p_buf,
+    const size_t              len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FILE_IMG_CHUNKED_H
@@ -0,0 +1,210 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#include "file_img_decomp.h"
+#include <string.h>
+#include <errno.h>
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_DECLARE(mcuboot, CONFIG_MCUBOOT_LOG_LEVEL);
+
+static zephyr_api_ret_t
+file_img_decomp_rewind(file_img_decomp_t* const p_decomp)
+{
+    const zephyr_api_ret_t rc = fs_seek(p_decomp->p_file, p_decomp->data_off, FS_SEEK_SET);
+    if (0 != rc)
+    {
+        LOG_ERR("Failed to seek to the beginning of the compressed stream, rc=%d", rc);
+        return rc;
+    }
+    p_decomp->pos           = 0;
+    p_decomp->head          = 0;
+    p_decomp->backref_index = 0;
+    p_decomp->backref_count = 0;
+    p_decomp->cur_byte      = 0;
+    p_decomp->bit_mask      = 0;
+    p_decomp->in_pos        = 0;
+    p_decomp->in_len        = 0;
+    /* heatshrink treats the bytes before the beginning of the stream as zeros */
+    memset(p_decomp->window, 0, sizeof(p_decomp->window));
+    return 0;
+}
+
+zephyr_api_ret_t
+file_img_decomp_init(
+    file_img_decomp_t* const           p_decomp,
+    struct fs_file_t* const            p_file,
+    const file_img_decomp_hdr_t* const p_hdr,
+    const off_t                        data_off)
+{
+    if ((p_hdr->window_sz2 < FILE_IMG_DECOMP_WINDOW_SZ2_MIN) || (p_hdr->window_sz2 > FILE_IMG_DECOMP_WINDOW_SZ2_MAX)
+        || (p_hdr->lookahead_sz2 < 3) || (p_hdr->lookahead_sz2 >= p_hdr->window_sz2))
+    {
+        LOG_ERR(
+            "Unsupported compression parameters: window_sz2=%u, lookahead_sz2=%u",
+            p_hdr->window_sz2,
+            p_hdr->lookahead_sz2);
+        return -EINVAL;
+    }
+    p_decomp->p_file        = p_file;
+    p_decomp->data_off      = data_off;
+    p_decomp->img_size      = p_hdr->img_size;
+    p_decomp->window_sz2    = p_hdr->window_sz2;
+    p_decomp->lookahead_sz2 = p_hdr->lookahead_sz2;
+    return file_img_decomp_rewind(p_decomp);
+}
+
+static zephyr_api_ret_t
+file_img_decomp_get_bits(file_img_decomp_t* const p_decomp, const uint8_t cnt, uint16_t* const p_val)
+{
+    uint16_t val = 0;
+    for (uint8_t i = 0; i < cnt; ++i)
+    {
+        if (0 == p_decomp->bit_mask)
+        {
+            if (p_decomp->in_pos >= p_decomp->in_len)
+            {
+                const ssize_t len = fs_read(p_decomp->p_file, p_decomp->in_buf, sizeof(p_decomp->in_buf));
+                if (len <= 0)
+                {
+                    LOG_ERR("Unexpected end of the compressed stream, rc=%d", (int)len);
+                    return (len < 0) ? (zephyr_api_ret_t)len : -EIO;
+                }
+                p_decomp->in_len = (uint16_t)len;
+                p_decomp->in_pos = 0;
+            }
+            p_decomp->cur_byte = p_decomp->in_buf[p_decomp->in_pos];
+            p_decomp->in_pos += 1;
+            p_decomp->bit_mask = 0x80U;
+        }
+        val = (uint16_t)(val << 1U);
+        if (0 != (p_decomp->cur_byte & p_decomp->bit_mask))
+        {
+            val |= 1U;
+        }
+        p_decomp->bit_mask >>= 1U;
+    }
+    *p_val = val;
+    return 0;
+}
+
+/**
+ * Decompress the next len bytes.
+ * @param p_buf Pointer to the output buffer, NULL to skip the bytes.
+ */
+static zephyr_api_ret_t
+file_img_decomp_read(file_img_decomp_t* const p_decomp, uint8_t* const p_buf, const size_t len)
+{
+    const uint16_t mask  = (uint16_t)((1U << p_decomp->window_sz2) - 1U);
+    size_t         n_out = 0;
+    while (n_out < len)
+    {
+        if (p_decomp->pos >= p_decomp->img_size)
+        {
+            LOG_ERR("Read beyond the end of the compressed image");
+            return -EIO;
+        }
+        uint8_t byte = 0;
+        if (0 != p_decomp->backref_count)
+        {
+            byte = p_decomp->window[(uint16_t)(p_decomp->head - p_decomp->backref_index) & mask];
+            p_decomp->backref_count -= 1;
+        }
+        else
+        {
+            uint16_t         tag = 0;
+            zephyr_api_ret_t rc  = file_img_decomp_get_bits(p_decomp, 1, &tag);
+            if (0 != rc)
+            {
+                return rc;
+            }
+            if (0 == tag)
+            {
+                /* Back-reference: index and count are stored decremented by one */
+                uint16_t index = 0;
+                uint16_t count = 0;
+                rc             = file_img_decomp_get_bits(p_decomp, p_decomp->window_sz2, &index);
+                if (0 == rc)
+                {
+                    rc = file_img_decomp_get_bits(p_decomp, p_decomp->lookahead_sz2, &count);
+                }
+                if (0 != rc)
+                {
+                    return rc;
+                }
+                p_decomp->backref_index = index + 1U;
+                p_decomp->backref_count = count + 1U;
+                continue;
+            }
+            uint16_t literal = 0;
+            rc               = file_img_decomp_get_bits(p_decomp, 8, &literal);
+            if (0 != rc)
+            {
+                return rc;
+            }
+            byte = (uint8_t)literal;
+        }
+        p_decomp->window[p_decomp->head & mask] = byte;
+        p_decomp->head                          = (uint16_t)((p_decomp->head + 1U) & mask);
+        p_decomp->pos += 1;
+        if (NULL != p_buf)
+        {
+            p_buf[n_out] = byte;
+        }
+        n_out += 1;
+    }
+    return 0;
+}
+
+zephyr_api_ret_t
+file_img_decomp_read_at(
+    file_img_decomp_t* const p_decomp,
+    const uint32_t           offset,
+    uint8_t* const           p_buf,
+    const size_t             len)
+{
+    uint32_t         off   = offset;
+    size_t           rem   = len;
+    uint8_t*         p_out = p_buf;
+    zephyr_api_ret_t rc    = 0;
+
+    if (off < p_decomp->pos)
+    {
+        const uint32_t back = p_decomp->pos - off;
+        if (back <= (1U << p_decomp->window_sz2))
+        {
+            /* The requested data is still in the window */
+            const uint16_t mask = (uint16_t)((1U << p_decomp->window_sz2) - 1U);
+            const size_t   n    = (rem < back) ? rem : back;
+            for (size_t i = 0; i < n; ++i)
+            {
+                p_out[i] = p_decomp->window[(uint16_t)(p_decomp->head - back + i) & mask];
+            }
+            off += (uint32_t)n;
+            rem -= n;
+            p_out += n;
+        }
+        else
+        {
+            rc = file_img_decomp_rewind(p_decomp);
+            if (0 != rc)
+            {
+                return rc;
+            }
+        }
+    }
+    if (0 == rem)
+    {
+        return 0;
+    }
+    if (off > p_decomp->pos)
+    {
+        rc = file_img_decomp_read(p_decomp, NULL, off - p_decomp->pos);
+        if (0 != rc)
+        {
+            return rc;
+        }
+    }
+    return file_img_decomp_read(p_decomp, p_out, rem);
+}
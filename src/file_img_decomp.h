@@ -0,0 +1,93 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#ifndef FILE_IMG_DECOMP_H
+#define FILE_IMG_DECOMP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <zephyr/fs/fs.h>
+#include "zephyr_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Magic of the compressed update file container: "RHS1" */
+#define FILE_IMG_DECOMP_MAGIC 0x31534852U
+
+#define FILE_IMG_DECOMP_WINDOW_SZ2_MIN 4
+#define FILE_IMG_DECOMP_WINDOW_SZ2_MAX CONFIG_RUUVI_MCUBOOT_FILE_IMG_DECOMP_WINDOW_SZ2_MAX
+
+#define FILE_IMG_DECOMP_IN_BUF_SIZE 256
+
+/**
+ * Header of the compressed update file container.
+ * It is followed by the MCUboot image compressed with heatshrink
+ * (https://github.com/atomicobject/heatshrink) using the given window and lookahead sizes.
+ */
+typedef struct file_img_decomp_hdr_t
+{
+    uint32_t magic;
+    uint32_t img_size; /* Size of the decompressed image */
+    uint8_t  window_sz2;
+    uint8_t  lookahead_sz2;
+    uint8_t  reserved[2];
+} file_img_decomp_hdr_t;
+
+/**
+ * State of the streaming heatshrink decoder.
+ * The window holds the last decompressed bytes, so short backward reads (e.g. of the TLV area
+ * after the image has been hashed) don't require decompressing the file again from the beginning.
+ */
+typedef struct file_img_decomp_t
+{
+    struct fs_file_t* p_file;
+    off_t             data_off; /* Offset of the compressed stream in the file */
+    uint32_t          img_size;
+    uint32_t          pos; /* Number of bytes decompressed so far */
+    uint8_t           window_sz2;
+    uint8_t           lookahead_sz2;
+    uint16_t          head;          /* Position of the next byte in the window */
+    uint16_t          backref_index; /* Distance of the pending back-reference */
+    uint16_t          backref_count; /* Number of bytes left to copy from the pending back-reference */
+    uint8_t           cur_byte;
+    uint8_t           bit_mask; /* Next bit of cur_byte to read, 0 if the next byte must be fetched */
+    uint16_t          in_pos;
+    uint16_t          in_len;
+    uint8_t           in_buf[FILE_IMG_DECOMP_IN_BUF_SIZE];
+    uint8_t           window[1U << FILE_IMG_DECOMP_WINDOW_SZ2_MAX];
+} file_img_decomp_t;
+
+/**
+ * Initialize the decoder for the compressed stream which starts at data_off in the file.
+ * @return 0 on success, -EINVAL if the parameters in the header are not supported.
+ */
+zephyr_api_ret_t
+file_img_decomp_init(
+    file_img_decomp_t* const           p_decomp,
+    struct fs_file_t* const            p_file,
+    const file_img_decomp_hdr_t* const p_hdr,
+    const off_t                        data_off);
+
+/**
+ * Read decompressed data at the given offset.
+ * Reading forward continues decompression, skipping the bytes in between;
+ * reading backward beyond the window restarts decompression from the beginning of the stream.
+ * @return 0 on success, negative error code otherwise.
+ */
+zephyr_api_ret_t
+file_img_decomp_read_at(
+    file_img_decomp_t* const p_decomp,
+    const uint32_t           offset,
+    uint8_t* const           p_buf,
+    const size_t             len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FILE_IMG_DECOMP_H
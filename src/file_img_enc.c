@@ -0,0 +1,132 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#include "file_img_enc.h"
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/logging/log.h>
+#include <bootutil/enc_key.h>
+#include "file_tlv.h"
+
+LOG_MODULE_DECLARE(mcuboot, CONFIG_MCUBOOT_LOG_LEVEL);
+
+#define FILE_IMG_ENC_AES_BLOCK_SIZE 16U
+
+zephyr_api_ret_t
+file_img_enc_init(
+    file_img_enc_t* const            p_enc,
+    file_img_reader_t* const         p_reader,
+    const struct image_header* const p_hdr)
+{
+    const uint32_t flags = p_hdr->ih_flags & FILE_IMG_ENC_FLAGS;
+    if (((IMAGE_F_ENCRYPTED_AES128 == flags) && (16 != BOOT_ENC_KEY_SIZE))
+        || ((IMAGE_F_ENCRYPTED_AES256 == flags) && (32 != BOOT_ENC_KEY_SIZE)) || (FILE_IMG_ENC_FLAGS == flags))
+    {
+        LOG_ERR("Image is encrypted with an unsupported AES key size, flags=0x%08" PRIx32, p_hdr->ih_flags);
+        return -ENOTSUP;
+    }
+
+    file_tlv_iter_t  it = { 0 };
+    zephyr_api_ret_t rc = file_tlv_iter_begin(&it, p_hdr, p_reader, EXPECTED_ENC_TLV, false);
+    if (0 != rc)
+    {
+        LOG_ERR("Failed to find TLV area of the encrypted image, rc=%d", rc);
+        return rc;
+    }
+    uint32_t off = 0;
+    uint16_t len = 0;
+    rc           = file_tlv_iter_next(&it, &off, &len, NULL);
+    if ((0 != rc) || (EXPECTED_ENC_LEN != len))
+    {
+        LOG_ERR("Encryption key TLV of the encrypted image is not found or has bad length, rc=%d", rc);
+        return -ENOENT;
+    }
+
+    uint8_t enc_tlv[EXPECTED_ENC_LEN];
+    rc = file_img_reader_read(p_reader, off, enc_tlv, sizeof(enc_tlv));
+    if (0 != rc)
+    {
+        LOG_ERR("Failed to read encryption key TLV, rc=%d", rc);
+        return rc;
+    }
+
+    uint8_t enc_key[BOOT_ENC_KEY_SIZE];
+    if (0 != boot_decrypt_key(enc_tlv, enc_key))
+    {
+        LOG_ERR("Failed to unwrap the image encryption key");
+        return -EBADMSG;
+    }
+    bootutil_aes_ctr_init(&p_enc->aes_ctr);
+    rc = bootutil_aes_ctr_set_key(&p_enc->aes_ctr, enc_key);
+    memset(enc_key, 0, sizeof(enc_key));
+    if (0 != rc)
+    {
+        LOG_ERR("Failed to set the image encryption key, rc=%d", rc);
+        bootutil_aes_ctr_drop(&p_enc->aes_ctr);
+        return -EIO;
+    }
+    p_enc->payload_off = p_hdr->ih_hdr_size;
+    p_enc->payload_end = (uint32_t)p_hdr->ih_hdr_size + p_hdr->ih_img_size;
+    return 0;
+}
+
+void
+file_img_enc_deinit(file_img_enc_t* const p_enc)
+{
+    bootutil_aes_ctr_drop(&p_enc->aes_ctr);
+}
+
+/**
+ * Decrypt whole AES blocks of the image body, the counter is the number of the AES block, as in boot_enc_decrypt().
+ */
+static void
+file_img_enc_decrypt_blocks(
+    file_img_enc_t* const p_enc,
+    const uint32_t        blk_idx,
+    uint8_t* const        p_data,
+    const uint32_t        len)
+{
+    uint8_t nonce[FILE_IMG_ENC_AES_BLOCK_SIZE];
+    memset(nonce, 0, sizeof(nonce));
+    nonce[12] = (uint8_t)(blk_idx >> 24U);
+    nonce[13] = (uint8_t)(blk_idx >> 16U);
+    nonce[14] = (uint8_t)(blk_idx >> 8U);
+    nonce[15] = (uint8_t)blk_idx;
+    (void)bootutil_aes_ctr_decrypt(&p_enc->aes_ctr, nonce, p_data, len, 0, p_data);
+}
+
+void
+file_img_enc_decrypt(file_img_enc_t* const p_enc, const uint32_t offset, uint8_t* const p_buf, const size_t len)
+{
+    const uint32_t start = (offset > p_enc->payload_off) ? offset : p_enc->payload_off;
+    const uint32_t end   = ((offset + len) < p_enc->payload_end) ? (offset + (uint32_t)len) : p_enc->payload_end;
+    if (start >= end)
+    {
+        return;
+    }
+    uint32_t payload_off = start - p_enc->payload_off;
+    uint8_t* p_data      = &p_buf[start - offset];
+    uint32_t rem_len     = end - start;
+
+    const uint32_t blk_off = payload_off % FILE_IMG_ENC_AES_BLOCK_SIZE;
+    if (0 != blk_off)
+    {
+        /* The bootutil AES-CTR backends start a new key stream block on every call,
+         * so a read which starts inside an AES block decrypts that block as a whole */
+        uint8_t        blk[FILE_IMG_ENC_AES_BLOCK_SIZE] = { 0 };
+        const uint32_t blk_len = MIN(FILE_IMG_ENC_AES_BLOCK_SIZE - blk_off, rem_len);
+        memcpy(&blk[blk_off], p_data, blk_len);
+        file_img_enc_decrypt_blocks(p_enc, payload_off / FILE_IMG_ENC_AES_BLOCK_SIZE, blk, sizeof(blk));
+        memcpy(p_data, &blk[blk_off], blk_len);
+        payload_off += blk_len;
+        p_data += blk_len;
+        rem_len -= blk_len;
+    }
+    if (0 != rem_len)
+    {
+        file_img_enc_decrypt_blocks(p_enc, payload_off / FILE_IMG_ENC_AES_BLOCK_SIZE, p_data, rem_len);
+    }
+}
@@ -0,0 +1,67 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#ifndef FILE_IMG_ENC_H
+#define FILE_IMG_ENC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <bootutil/image.h>
+#include <bootutil/crypto/aes_ctr.h>
+#include "file_img_reader.h"
+#include "zephyr_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FILE_IMG_ENC_FLAGS (IMAGE_F_ENCRYPTED_AES128 | IMAGE_F_ENCRYPTED_AES256)
+
+/**
+ * State of the AES-CTR decryption of an image encrypted by imgtool (MCUBOOT_ENC_IMAGES format).
+ * Only the image body (after the header and before the TLV area) is encrypted,
+ * the image hash and the signature cover the plaintext.
+ */
+typedef struct file_img_enc_t
+{
+    uint32_t                 payload_off; /* Offset of the encrypted image body */
+    uint32_t                 payload_end;
+    bootutil_aes_ctr_context aes_ctr;
+} file_img_enc_t;
+
+/**
+ * Check if the image is encrypted.
+ */
+static inline bool
+file_img_enc_is_encrypted(const struct image_header* const p_hdr)
+{
+    return (IMAGE_MAGIC == p_hdr->ih_magic) && (0 != (p_hdr->ih_flags & FILE_IMG_ENC_FLAGS));
+}
+
+/**
+ * Unwrap the AES key from the encryption TLV of the image with the bootloader's private key.
+ * @return 0 on success, negative error code otherwise.
+ */
+zephyr_api_ret_t
+file_img_enc_init(
+    file_img_enc_t* const            p_enc,
+    file_img_reader_t* const         p_reader,
+    const struct image_header* const p_hdr);
+
+void
+file_img_enc_deinit(file_img_enc_t* const p_enc);
+
+/**
+ * Decrypt in place the part of the buffer which belongs to the encrypted image body.
+ * @param offset Offset of the buffer in the image.
+ */
+void
+file_img_enc_decrypt(file_img_enc_t* const p_enc, const uint32_t offset, uint8_t* const p_buf, const size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FILE_IMG_ENC_H
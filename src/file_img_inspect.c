@@ -0,0 +1,143 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#include "file_img_inspect.h"
+#include <string.h>
+#include <fw_info.h>
+
+/**
+ * Copy the part of the data read at offset which falls into the region [region_off, region_off + region_len).
+ */
+static void
+file_img_inspect_capture(
+    const uint32_t       region_off,
+    const uint32_t       region_len,
+    uint8_t* const       p_region,
+    const uint32_t       offset,
+    const uint8_t* const p_data,
+    const size_t         len)
+{
+    const uint32_t end        = offset + (uint32_t)len;
+    const uint32_t region_end = region_off + region_len;
+    const uint32_t start      = (offset > region_off) ? offset : region_off;
+    const uint32_t stop       = (end < region_end) ? end : region_end;
+    if (start < stop)
+    {
+        memcpy(&p_region[start - region_off], &p_data[start - offset], stop - start);
+    }
+}
+
+static uint32_t
+file_img_inspect_prot_tlv_off(const file_img_inspect_t* const p_inspect)
+{
+    return (uint32_t)p_inspect->hdr.ih_hdr_size + p_inspect->hdr.ih_img_size;
+}
+
+static bool
+file_img_inspect_is_captured(const file_img_inspect_t* const p_inspect, const uint32_t offset, const uint32_t len)
+{
+    return (offset + len) <= p_inspect->seq_end;
+}
+
+void
+file_img_inspect_init(file_img_inspect_t* const p_inspect, const struct image_header* const p_hdr)
+{
+    memset(p_inspect, 0, sizeof(*p_inspect));
+    p_inspect->hdr = *p_hdr;
+}
+
+void
+file_img_inspect_feed(
+    file_img_inspect_t* const p_inspect,
+    const uint32_t            offset,
+    const uint8_t* const      p_data,
+    const size_t              len)
+{
+    if ((offset <= p_inspect->seq_end) && ((offset + len) > p_inspect->seq_end))
+    {
+        p_inspect->seq_end = offset + (uint32_t)len;
+    }
+    file_img_inspect_capture(
+        (uint32_t)p_inspect->hdr.ih_hdr_size + sizeof(uint32_t),
+        sizeof(p_inspect->reset_addr),
+        (uint8_t*)&p_inspect->reset_addr,
+        offset,
+        p_data,
+        len);
+    for (uint32_t i = 0; i < FW_INFO_OFFSET_COUNT; ++i)
+    {
+        file_img_inspect_capture(
+            fw_info_allowed_offsets[i],
+            sizeof(p_inspect->fw_info[i]),
+            p_inspect->fw_info[i],
+            offset,
+            p_data,
+            len);
+    }
+    if (p_inspect->hdr.ih_protect_tlv_size <= sizeof(p_inspect->prot_tlvs))
+    {
+        file_img_inspect_capture(
+            file_img_inspect_prot_tlv_off(p_inspect),
+            p_inspect->hdr.ih_protect_tlv_size,
+            p_inspect->prot_tlvs,
+            offset,
+            p_data,
+            len);
+    }
+}
+
+bool
+file_img_inspect_get_reset_addr(const file_img_inspect_t* const p_inspect, uint32_t* const p_reset_addr)
+{
+    if (!file_img_inspect_is_captured(
+            p_inspect,
+            (uint32_t)p_inspect->hdr.ih_hdr_size + sizeof(uint32_t),
+            sizeof(p_inspect->reset_addr)))
+    {
+        return false;
+    }
+    *p_reset_addr = p_inspect->reset_addr;
+    return true;
+}
+
+bool
+file_img_inspect_find_fw_info(
+    const file_img_inspect_t* const p_inspect,
+    struct fw_info* const           p_fw_info,
+    bool* const                     p_is_found)
+{
+    static const uint32_t fw_info_magic[/* NOSONAR */] = { FIRMWARE_INFO_MAGIC };
+
+    *p_is_found = false;
+    for (uint32_t i = 0; i < FW_INFO_OFFSET_COUNT; ++i)
+    {
+        if (!file_img_inspect_is_captured(p_inspect, fw_info_allowed_offsets[i], sizeof(p_inspect->fw_info[i])))
+        {
+            return false;
+        }
+        memcpy(p_fw_info, p_inspect->fw_info[i], sizeof(*p_fw_info));
+        if (0 == memcmp(p_fw_info->magic, fw_info_magic, CONFIG_FW_INFO_MAGIC_LEN))
+        {
+            *p_is_found = true;
+            return true;
+        }
+    }
+    return true;
+}
+
+bool
+file_img_inspect_find_hw_rev(
+    const file_img_inspect_t* const p_inspect,
+    fw_image_hw_rev_t* const        p_hw_rev,
+    bool* const                     p_is_found)
+{
+    const uint32_t prot_tlv_size = p_inspect->hdr.ih_protect_tlv_size;
+    if ((prot_tlv_size > sizeof(p_inspect->prot_tlvs))
+        || (!file_img_inspect_is_captured(p_inspect, file_img_inspect_prot_tlv_off(p_inspect), prot_tlv_size)))
+    {
+        return false;
+    }
+    *p_is_found = fw_img_hw_rev_find_in_buf(p_inspect->prot_tlvs, prot_tlv_size, p_hw_rev);
+    return true;
+}
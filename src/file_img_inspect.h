@@ -0,0 +1,82 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#ifndef FILE_IMG_INSPECT_H
+#define FILE_IMG_INSPECT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <bootutil/image.h>
+#include <fw_info_bare.h>
+#include "fw_img_hw_rev.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Max size of the protected TLV area which is captured, a bigger area is read from the file */
+#define FILE_IMG_INSPECT_PROT_TLV_MAX_SIZE 256U
+
+/**
+ * Data captured from the image while it is read sequentially by the validation (hashing) pass,
+ * so that the checks which follow the validation don't have to read the update file again.
+ * The captured data is used only if the whole region has been read through the reader.
+ */
+typedef struct file_img_inspect_t
+{
+    struct image_header hdr;
+    uint32_t            seq_end; /* End of the data read sequentially from the beginning of the image */
+    uint32_t            reset_addr;
+    uint8_t             fw_info[FW_INFO_OFFSET_COUNT][sizeof(struct fw_info)]; /* At fw_info_allowed_offsets */
+    uint8_t             prot_tlvs[FILE_IMG_INSPECT_PROT_TLV_MAX_SIZE];
+} file_img_inspect_t;
+
+void
+file_img_inspect_init(file_img_inspect_t* const p_inspect, const struct image_header* const p_hdr);
+
+/**
+ * Capture the parts of the data read from the image at the given offset.
+ */
+void
+file_img_inspect_feed(
+    file_img_inspect_t* const p_inspect,
+    const uint32_t            offset,
+    const uint8_t* const      p_data,
+    const size_t              len);
+
+/**
+ * Get the reset vector (the 2nd word of the vector table after the image header).
+ * @return false if it has not been captured.
+ */
+bool
+file_img_inspect_get_reset_addr(const file_img_inspect_t* const p_inspect, uint32_t* const p_reset_addr);
+
+/**
+ * Find fw_info at one of fw_info_allowed_offsets in the captured data.
+ * @param[out] p_is_found Set to true if fw_info has been found.
+ * @return false if a candidate offset has not been captured, in this case the file has to be searched.
+ */
+bool
+file_img_inspect_find_fw_info(
+    const file_img_inspect_t* const p_inspect,
+    struct fw_info* const           p_fw_info,
+    bool* const                     p_is_found);
+
+/**
+ * Find the Ruuvi HW revision TLVs in the captured protected TLV area.
+ * @param[out] p_is_found Set to true if both TLVs have been found.
+ * @return false if the protected TLV area has not been captured, in this case the file has to be searched.
+ */
+bool
+file_img_inspect_find_hw_rev(
+    const file_img_inspect_t* const p_inspect,
+    fw_image_hw_rev_t* const        p_hw_rev,
+    bool* const                     p_is_found);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FILE_IMG_INSPECT_H
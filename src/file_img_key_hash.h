@@ -0,0 +1,28 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#ifndef FILE_IMG_KEY_HASH_H
+#define FILE_IMG_KEY_HASH_H
+
+#include <stdint.h>
+#include <bootutil/image.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Hashes of the image keys in the order of bootutil_keys[], generated at build time
+ * from the signature key file by scripts/gen_key_hash.py.
+ * The generated table has the size of IMAGE_HASH_SIZE, otherwise the definition doesn't compile.
+ */
+extern const uint8_t g_file_img_key_hash[][IMAGE_HASH_SIZE];
+
+extern const uint32_t g_file_img_key_hash_cnt;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FILE_IMG_KEY_HASH_H
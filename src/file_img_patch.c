@@ -0,0 +1,548 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#include "file_img_patch.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <zephyr/drivers/flash.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/logging/log.h>
+#include <bootutil/crypto/sha.h>
+#include <bootutil/fault_injection_hardening.h>
+#include "btldr_fs.h"
+#include "file_img_reader.h"
+#include "mcuboot_fa_utils.h"
+#include "mcuboot_img_journal.h"
+
+LOG_MODULE_DECLARE(mcuboot, CONFIG_MCUBOOT_LOG_LEVEL);
+
+#define FILE_IMG_PATCH_SNAPSHOT_MAGIC          0x31504E53U /* "SNP1" */
+#define FILE_IMG_PATCH_SNAPSHOT_FILE_NAME_SIZE 24
+#define FILE_IMG_PATCH_ADD_BUF_SIZE            64
+
+/**
+ * Old contents of a sector of the slot.
+ * Every snapshot is saved to LittleFS before the sector is erased, so that an interrupted patching can be resumed.
+ */
+typedef struct file_img_patch_snapshot_t
+{
+    uint32_t magic;
+    uint32_t fa_id;
+    uint8_t  dst_hash[IMAGE_HASH_SIZE];
+    uint32_t sector_idx;
+    uint32_t crc; /* CRC32 of all the previous fields and the data */
+    uint8_t  data[FILE_IMG_PATCH_SECTOR_SIZE];
+} file_img_patch_snapshot_t;
+
+static file_img_patch_snapshot_t g_file_img_patch_snapshots[FILE_IMG_PATCH_SNAPSHOT_CNT];
+
+static void
+file_img_patch_get_snapshot_file_name(const uint32_t slot_idx, char* const p_buf, const size_t buf_size)
+{
+    (void)snprintf(p_buf, buf_size, "mcuboot_patch%" PRIu32 ".snp", slot_idx);
+}
+
+static uint32_t
+file_img_patch_snapshot_calc_crc(const file_img_patch_snapshot_t* const p_snapshot)
+{
+    const uint32_t crc = crc32_ieee((const uint8_t*)p_snapshot, offsetof(file_img_patch_snapshot_t, crc));
+    return crc32_ieee_update(crc, p_snapshot->data, sizeof(p_snapshot->data));
+}
+
+static bool
+file_img_patch_snapshot_take(file_img_patch_t* const p_patch, const uint32_t sector_idx)
+{
+    const uint32_t                   slot_idx   = sector_idx % FILE_IMG_PATCH_SNAPSHOT_CNT;
+    file_img_patch_snapshot_t* const p_snapshot = &g_file_img_patch_snapshots[slot_idx];
+
+    const zephyr_api_ret_t rc = flash_area_read(
+        p_patch->p_fa,
+        (off_t)(sector_idx * FILE_IMG_PATCH_SECTOR_SIZE),
+        p_snapshot->data,
+        sizeof(p_snapshot->data));
+    if (0 != rc)
+    {
+        LOG_ERR("Failed to read sector %" PRIu32 " of flash area %d, rc=%d", sector_idx, p_patch->p_fa->fa_id, rc);
+        p_patch->snapshot_is_valid[slot_idx] = false;
+        return false;
+    }
+    p_snapshot->magic      = FILE_IMG_PATCH_SNAPSHOT_MAGIC;
+    p_snapshot->fa_id      = p_patch->p_fa->fa_id;
+    p_snapshot->sector_idx = sector_idx;
+    memcpy(p_snapshot->dst_hash, p_patch->hdr.dst_hash, sizeof(p_snapshot->dst_hash));
+    p_snapshot->crc                      = file_img_patch_snapshot_calc_crc(p_snapshot);
+    p_patch->snapshot_is_valid[slot_idx] = true;
+    p_patch->snapshot_is_saved[slot_idx] = false;
+    return true;
+}
+
+static bool
+file_img_patch_snapshot_save(file_img_patch_t* const p_patch, const uint32_t slot_idx)
+{
+    char file_name[FILE_IMG_PATCH_SNAPSHOT_FILE_NAME_SIZE];
+    file_img_patch_get_snapshot_file_name(slot_idx, file_name, sizeof(file_name));
+    if (!btldr_fs_write_file(file_name, &g_file_img_patch_snapshots[slot_idx], sizeof(file_img_patch_snapshot_t)))
+    {
+        LOG_ERR("Failed to save the old contents of sector %" PRIu32, g_file_img_patch_snapshots[slot_idx].sector_idx);
+        return false;
+    }
+    p_patch->snapshot_is_saved[slot_idx] = true;
+    return true;
+}
+
+static bool
+file_img_patch_snapshot_load(file_img_patch_t* const p_patch, const uint32_t sector_idx)
+{
+    const uint32_t                   slot_idx   = sector_idx % FILE_IMG_PATCH_SNAPSHOT_CNT;
+    file_img_patch_snapshot_t* const p_snapshot = &g_file_img_patch_snapshots[slot_idx];
+    char                             file_name[FILE_IMG_PATCH_SNAPSHOT_FILE_NAME_SIZE];
+
+    p_patch->snapshot_is_valid[slot_idx] = false;
+    file_img_patch_get_snapshot_file_name(slot_idx, file_name, sizeof(file_name));
+    if ((!btldr_fs_is_file_exist(file_name)) || (!btldr_fs_read_file(file_name, p_snapshot, sizeof(*p_snapshot))))
+    {
+        return false;
+    }
+    if ((FILE_IMG_PATCH_SNAPSHOT_MAGIC != p_snapshot->magic) || ((uint32_t)p_patch->p_fa->fa_id != p_snapshot->fa_id)
+        || (sector_idx != p_snapshot->sector_idx)
+        || (0 != memcmp(p_snapshot->dst_hash, p_patch->hdr.dst_hash, sizeof(p_snapshot->dst_hash)))
+        || (file_img_patch_snapshot_calc_crc(p_snapshot) != p_snapshot->crc))
+    {
+        return false;
+    }
+    p_patch->snapshot_is_valid[slot_idx] = true;
+    p_patch->snapshot_is_saved[slot_idx] = true;
+    return true;
+}
+
+static bool
+file_img_patch_check_src_hash(const file_img_patch_t* const p_patch)
+{
+    /* The snapshot buffer is not in use before the patching has been started */
+    uint8_t* const       p_buf = g_file_img_patch_snapshots[0].data;
+    uint8_t              hash[IMAGE_HASH_SIZE];
+    bootutil_sha_context sha_ctx;
+
+    bootutil_sha_init(&sha_ctx);
+    uint32_t off = 0;
+    while (off < p_patch->hdr.src_size)
+    {
+        const size_t           len = MIN(FILE_IMG_PATCH_SECTOR_SIZE, p_patch->hdr.src_size - off);
+        const zephyr_api_ret_t rc  = flash_area_read(p_patch->p_fa, (off_t)off, p_buf, len);
+        if (0 != rc)
+        {
+            LOG_ERR("Failed to read flash area %d at offset 0x%08" PRIx32 ", rc=%d", p_patch->p_fa->fa_id, off, rc);
+            bootutil_sha_drop(&sha_ctx);
+            return false;
+        }
+        bootutil_sha_update(&sha_ctx, p_buf, len);
+        off += len;
+    }
+    bootutil_sha_finish(&sha_ctx, hash);
+    bootutil_sha_drop(&sha_ctx);
+
+    FIH_DECLARE(fih_rc, FIH_FAILURE);
+    FIH_CALL(boot_fih_memequal, fih_rc, hash, p_patch->hdr.src_hash, sizeof(hash));
+    if (FIH_NOT_EQ(fih_rc, FIH_SUCCESS))
+    {
+        LOG_ERR("The patch does not apply to the image in flash area %d", p_patch->p_fa->fa_id);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Check if the slot already contains the new image: its hash TLV is the image hash of the new image.
+ * Only the TLV is compared, the image read from the slot is validated as usual afterwards.
+ */
+static bool
+file_img_patch_is_applied(const file_img_patch_t* const p_patch, const fa_id_t fa_id)
+{
+    uint8_t slot_hash[IMAGE_HASH_SIZE];
+    if (!load_image_hash_tlv(fa_id, EXPECTED_HASH_TLV, slot_hash))
+    {
+        return false;
+    }
+    FIH_DECLARE(fih_rc, FIH_FAILURE);
+    FIH_CALL(boot_fih_memequal, fih_rc, slot_hash, p_patch->hdr.dst_hash, sizeof(slot_hash));
+    return FIH_EQ(fih_rc, FIH_SUCCESS);
+}
+
+/**
+ * Load the old contents of the sectors which the rest of the new image may still refer to.
+ */
+static bool
+file_img_patch_prepare_resume(file_img_patch_t* const p_patch, const uint32_t resume_off)
+{
+    const uint32_t sector_idx = resume_off / FILE_IMG_PATCH_SECTOR_SIZE;
+    const uint32_t first_idx  = (sector_idx > p_patch->hdr.backlog) ? (sector_idx - p_patch->hdr.backlog) : 0;
+    for (uint32_t idx = first_idx; idx <= sector_idx; ++idx)
+    {
+        if ((idx * FILE_IMG_PATCH_SECTOR_SIZE) >= p_patch->hdr.src_size)
+        {
+            /* Sectors beyond the old image are not referred to */
+            break;
+        }
+        if (file_img_patch_snapshot_load(p_patch, idx))
+        {
+            continue;
+        }
+        /* The sector at the resume offset is erased only after its snapshot has been saved */
+        if ((idx != sector_idx) || (!file_img_patch_snapshot_take(p_patch, idx)))
+        {
+            LOG_ERR("Old contents of sector %" PRIu32 " are lost, the patching can't be resumed", idx);
+            return false;
+        }
+    }
+    p_patch->resume_off     = resume_off;
+    p_patch->src_floor      = sector_idx + 1;
+    p_patch->sector_idx_cur = (int32_t)sector_idx - 1;
+    LOG_INF("Resume patching of flash area %d at offset 0x%08" PRIx32, p_patch->p_fa->fa_id, resume_off);
+    return true;
+}
+
+static void
+file_img_patch_restart(file_img_patch_t* const p_patch)
+{
+    p_patch->cmd_off     = p_patch->data_off;
+    p_patch->cmd_len     = 0;
+    p_patch->cmd_src_off = 0;
+    p_patch->cmd_op      = FILE_IMG_PATCH_OP_COPY;
+    p_patch->pos         = 0;
+}
+
+bool
+file_img_patch_open(
+    file_img_patch_t* const           p_patch,
+    struct file_img_reader_t* const   p_reader,
+    const file_img_patch_hdr_t* const p_hdr,
+    const uint32_t                    data_off,
+    const fa_id_t                     fa_id)
+{
+    memset(p_patch, 0, sizeof(*p_patch));
+    p_patch->p_reader       = p_reader;
+    p_patch->hdr            = *p_hdr;
+    p_patch->data_off       = data_off;
+    p_patch->sector_idx_cur = -1;
+    file_img_patch_restart(p_patch);
+
+    if ((FILE_IMG_PATCH_SECTOR_SIZE != p_hdr->sector_size) || (p_hdr->backlog > FILE_IMG_PATCH_BACKLOG))
+    {
+        LOG_ERR(
+            "Unsupported patch parameters: sector_size=%" PRIu32 ", backlog=%" PRIu32,
+            p_hdr->sector_size,
+            p_hdr->backlog);
+        return false;
+    }
+
+    zephyr_api_ret_t rc = flash_area_open(fa_id, &p_patch->p_fa);
+    if (0 != rc)
+    {
+        LOG_ERR("Failed to open flash area %d, rc=%d", fa_id, rc);
+        return false;
+    }
+    struct flash_pages_info page_info = { 0 };
+    rc = flash_get_page_info_by_offs(flash_area_get_device(p_patch->p_fa), p_patch->p_fa->fa_off, &page_info);
+    if ((0 != rc) || (FILE_IMG_PATCH_SECTOR_SIZE != page_info.size))
+    {
+        LOG_ERR("Flash area %d does not match the sector size of the patch, rc=%d", fa_id, rc);
+        flash_area_close(p_patch->p_fa);
+        return false;
+    }
+    if ((p_hdr->src_size > p_patch->p_fa->fa_size) || (p_hdr->dst_size > p_patch->p_fa->fa_size))
+    {
+        LOG_ERR("Patch does not fit into flash area %d", fa_id);
+        flash_area_close(p_patch->p_fa);
+        return false;
+    }
+
+    uint32_t journal_size = 0;
+    uint32_t resume_off   = 0;
+    if (mcuboot_img_journal_load(fa_id, p_hdr->dst_hash, &journal_size, &resume_off))
+    {
+        if ((resume_off > journal_size) || (journal_size > p_hdr->dst_size)
+            || (0 != (resume_off % FILE_IMG_PATCH_SECTOR_SIZE))
+            || (!file_img_patch_prepare_resume(p_patch, resume_off)))
+        {
+            flash_area_close(p_patch->p_fa);
+            return false;
+        }
+    }
+    else if (file_img_patch_is_applied(p_patch, fa_id))
+    {
+        /* The whole new image is read from the slot, so the installation of an applied patch can be skipped */
+        p_patch->resume_off = p_hdr->dst_size;
+        LOG_INF("The patch has already been applied to flash area %d", fa_id);
+    }
+    else if (!file_img_patch_check_src_hash(p_patch))
+    {
+        flash_area_close(p_patch->p_fa);
+        return false;
+    }
+    else
+    {
+        /* The old image is intact */
+    }
+    return true;
+}
+
+void
+file_img_patch_close(file_img_patch_t* const p_patch)
+{
+    flash_area_close(p_patch->p_fa);
+    p_patch->p_fa = NULL;
+}
+
+static zephyr_api_ret_t
+file_img_patch_next_cmd(file_img_patch_t* const p_patch)
+{
+    file_img_patch_cmd_t   cmd = { 0 };
+    const zephyr_api_ret_t rc  = file_img_reader_read_raw(p_patch->p_reader, p_patch->cmd_off, &cmd, sizeof(cmd));
+    if (0 != rc)
+    {
+        LOG_ERR("Failed to read patch command at offset 0x%08" PRIx32 ", rc=%d", p_patch->cmd_off, rc);
+        return rc;
+    }
+    if ((cmd.op > FILE_IMG_PATCH_OP_INSERT) || (0 == cmd.len) || (cmd.len > (p_patch->hdr.dst_size - p_patch->pos))
+        || ((FILE_IMG_PATCH_OP_INSERT != cmd.op)
+            && ((cmd.src_off > p_patch->hdr.src_size) || (cmd.len > (p_patch->hdr.src_size - cmd.src_off)))))
+    {
+        LOG_ERR(
+            "Invalid patch command at offset 0x%08" PRIx32 ": op=%u, len=%" PRIu32,
+            p_patch->cmd_off,
+            cmd.op,
+            cmd.len);
+        return -EINVAL;
+    }
+    p_patch->cmd_off += sizeof(cmd);
+    p_patch->cmd_op      = cmd.op;
+    p_patch->cmd_len     = cmd.len;
+    p_patch->cmd_src_off = cmd.src_off;
+    return 0;
+}
+
+/**
+ * Read the old image for the new image at dst_off.
+ * The old contents of an overwritten sector come from its snapshot.
+ */
+static zephyr_api_ret_t
+file_img_patch_read_src(
+    const file_img_patch_t* const p_patch,
+    const uint32_t                dst_off,
+    const uint32_t                src_off,
+    uint8_t* const                p_buf,
+    const size_t                  len)
+{
+    size_t n_read = 0;
+    while (n_read < len)
+    {
+        const uint32_t dst_idx = (dst_off + n_read) / FILE_IMG_PATCH_SECTOR_SIZE;
+        const uint32_t src_idx = (src_off + n_read) / FILE_IMG_PATCH_SECTOR_SIZE;
+        const uint32_t sec_off = (src_off + n_read) % FILE_IMG_PATCH_SECTOR_SIZE;
+
+        size_t n = MIN(len - n_read, FILE_IMG_PATCH_SECTOR_SIZE - sec_off);
+        n        = MIN(n, FILE_IMG_PATCH_SECTOR_SIZE - ((dst_off + n_read) % FILE_IMG_PATCH_SECTOR_SIZE));
+
+        if ((src_idx + p_patch->hdr.backlog) < dst_idx)
+        {
+            LOG_ERR(
+                "Patch refers to sector %" PRIu32 " of the old image, which is overwritten by sector %" PRIu32,
+                src_idx,
+                dst_idx);
+            return -EINVAL;
+        }
+        const uint32_t                         slot_idx   = src_idx % FILE_IMG_PATCH_SNAPSHOT_CNT;
+        const file_img_patch_snapshot_t* const p_snapshot = &g_file_img_patch_snapshots[slot_idx];
+        if (p_patch->snapshot_is_valid[slot_idx] && (src_idx == p_snapshot->sector_idx))
+        {
+            memcpy(&p_buf[n_read], &p_snapshot->data[sec_off], n);
+        }
+        else if (src_idx >= p_patch->src_floor)
+        {
+            const zephyr_api_ret_t rc = flash_area_read(p_patch->p_fa, (off_t)(src_off + n_read), &p_buf[n_read], n);
+            if (0 != rc)
+            {
+                LOG_ERR("Failed to read flash area %d, rc=%d", p_patch->p_fa->fa_id, rc);
+                return rc;
+            }
+        }
+        else
+        {
+            LOG_ERR("Old contents of sector %" PRIu32 " are not available", src_idx);
+            return -EIO;
+        }
+        n_read += n;
+    }
+    return 0;
+}
+
+static zephyr_api_ret_t
+file_img_patch_add(file_img_patch_t* const p_patch, uint8_t* const p_buf, const size_t len)
+{
+    uint8_t buf[FILE_IMG_PATCH_ADD_BUF_SIZE];
+    size_t  n_done = 0;
+    while (n_done < len)
+    {
+        const size_t           n  = MIN(len - n_done, sizeof(buf));
+        const zephyr_api_ret_t rc = file_img_reader_read_raw(p_patch->p_reader, p_patch->cmd_off + n_done, buf, n);
+        if (0 != rc)
+        {
+            return rc;
+        }
+        for (size_t i = 0; i < n; ++i)
+        {
+            p_buf[n_done + i] = (uint8_t)(p_buf[n_done + i] + buf[i]);
+        }
+        n_done += n;
+    }
+    return 0;
+}
+
+/**
+ * Produce the next len bytes of the new image.
+ * @param p_buf Pointer to the output buffer, NULL to skip the bytes.
+ */
+static zephyr_api_ret_t
+file_img_patch_produce(file_img_patch_t* const p_patch, uint8_t* const p_buf, const size_t len)
+{
+    size_t n_out = 0;
+    while (n_out < len)
+    {
+        zephyr_api_ret_t rc = 0;
+        if (0 == p_patch->cmd_len)
+        {
+            rc = file_img_patch_next_cmd(p_patch);
+            if (0 != rc)
+            {
+                return rc;
+            }
+        }
+        const size_t n = MIN(len - n_out, p_patch->cmd_len);
+        if (NULL != p_buf)
+        {
+            if (FILE_IMG_PATCH_OP_INSERT == p_patch->cmd_op)
+            {
+                rc = file_img_reader_read_raw(p_patch->p_reader, p_patch->cmd_off, &p_buf[n_out], n);
+            }
+            else
+            {
+                rc = file_img_patch_read_src(p_patch, p_patch->pos, p_patch->cmd_src_off, &p_buf[n_out], n);
+                if ((0 == rc) && (FILE_IMG_PATCH_OP_ADD == p_patch->cmd_op))
+                {
+                    rc = file_img_patch_add(p_patch, &p_buf[n_out], n);
+                }
+            }
+            if (0 != rc)
+            {
+                return rc;
+            }
+        }
+        if (FILE_IMG_PATCH_OP_COPY != p_patch->cmd_op)
+        {
+            p_patch->cmd_off += n;
+        }
+        p_patch->cmd_src_off += n;
+        p_patch->cmd_len -= n;
+        p_patch->pos += n;
+        n_out += n;
+    }
+    return 0;
+}
+
+/**
+ * Save the old contents of the sectors up to the given one before they are overwritten.
+ */
+static zephyr_api_ret_t
+file_img_patch_enter_sector(file_img_patch_t* const p_patch, const uint32_t sector_idx)
+{
+    while (p_patch->sector_idx_cur < (int32_t)sector_idx)
+    {
+        const uint32_t idx      = (uint32_t)(p_patch->sector_idx_cur + 1);
+        const uint32_t slot_idx = idx % FILE_IMG_PATCH_SNAPSHOT_CNT;
+        const bool     is_taken = p_patch->snapshot_is_valid[slot_idx]
+                              && (idx == g_file_img_patch_snapshots[slot_idx].sector_idx);
+        if ((idx * FILE_IMG_PATCH_SECTOR_SIZE) < p_patch->hdr.src_size)
+        {
+            if ((!is_taken) && (!file_img_patch_snapshot_take(p_patch, idx)))
+            {
+                return -EIO;
+            }
+            if ((!p_patch->snapshot_is_saved[slot_idx]) && (!file_img_patch_snapshot_save(p_patch, slot_idx)))
+            {
+                return -EIO;
+            }
+        }
+        p_patch->sector_idx_cur = (int32_t)idx;
+        p_patch->src_floor      = idx + 1;
+    }
+    return 0;
+}
+
+zephyr_api_ret_t
+file_img_patch_read_at(file_img_patch_t* const p_patch, const uint32_t offset, uint8_t* const p_buf, const size_t len)
+{
+    uint32_t off    = offset;
+    size_t   n_done = 0;
+    if (off < p_patch->resume_off)
+    {
+        const size_t           n  = MIN(len, p_patch->resume_off - off);
+        const zephyr_api_ret_t rc = flash_area_read(p_patch->p_fa, (off_t)off, p_buf, n);
+        if (0 != rc)
+        {
+            LOG_ERR("Failed to read flash area %d, rc=%d", p_patch->p_fa->fa_id, rc);
+            return rc;
+        }
+        off += n;
+        n_done += n;
+    }
+    if (n_done == len)
+    {
+        return 0;
+    }
+    if (p_patch->is_writing)
+    {
+        const zephyr_api_ret_t rc = file_img_patch_enter_sector(
+            p_patch,
+            (off + (len - n_done) - 1) / FILE_IMG_PATCH_SECTOR_SIZE);
+        if (0 != rc)
+        {
+            return rc;
+        }
+    }
+    if (off < p_patch->pos)
+    {
+        file_img_patch_restart(p_patch);
+    }
+    zephyr_api_ret_t rc = file_img_patch_produce(p_patch, NULL, off - p_patch->pos);
+    if (0 != rc)
+    {
+        return rc;
+    }
+    return file_img_patch_produce(p_patch, &p_buf[n_done], len - n_done);
+}
+
+void
+file_img_patch_begin_write(file_img_patch_t* const p_patch)
+{
+    p_patch->is_writing = true;
+}
+
+void
+file_img_patch_end_write(file_img_patch_t* const p_patch)
+{
+    p_patch->is_writing = false;
+    for (uint32_t i = 0; i < FILE_IMG_PATCH_SNAPSHOT_CNT; ++i)
+    {
+        char file_name[FILE_IMG_PATCH_SNAPSHOT_FILE_NAME_SIZE];
+        file_img_patch_get_snapshot_file_name(i, file_name, sizeof(file_name));
+        if (btldr_fs_is_file_exist(file_name))
+        {
+            (void)btldr_fs_unlink_file(file_name);
+        }
+        p_patch->snapshot_is_valid[i] = false;
+    }
+}
@@ -0,0 +1,136 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#ifndef FILE_IMG_PATCH_H
+#define FILE_IMG_PATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <zephyr/storage/flash_map.h>
+#include <bootutil/image.h>
+#include "ruuvi_fa_id.h"
+#include "zephyr_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Magic of the delta update file: "RDP1" */
+#define FILE_IMG_PATCH_MAGIC 0x31504452U
+
+#define FILE_IMG_PATCH_SECTOR_SIZE CONFIG_RUUVI_MCUBOOT_FILE_IMG_PATCH_SECTOR_SIZE
+#define FILE_IMG_PATCH_BACKLOG     CONFIG_RUUVI_MCUBOOT_FILE_IMG_PATCH_BACKLOG
+
+/* Number of sectors of the old image kept in RAM while the slot is patched in place */
+#define FILE_IMG_PATCH_SNAPSHOT_CNT (FILE_IMG_PATCH_BACKLOG + 1)
+
+/**
+ * Header of the delta update file.
+ * It is followed by a sequence of commands, each of them producing the next cmd.len bytes of the new image:
+ * - COPY:   the bytes are copied from the old image at cmd.src_off,
+ * - ADD:    cmd.len bytes of data follow the command, they are added (mod 256) to the old image at cmd.src_off,
+ * - INSERT: cmd.len bytes of data follow the command, they are copied to the new image as is.
+ *
+ * The patch is applied in place, sector by sector, so the old image is gradually overwritten.
+ * The new image in sector N may refer only to the old image in sectors N - backlog and above,
+ * the old contents of the sectors which have already been overwritten are kept in RAM.
+ */
+typedef struct file_img_patch_hdr_t
+{
+    uint32_t magic;
+    uint32_t src_size;    /* Size of the old image in the slot */
+    uint32_t dst_size;    /* Size of the new image */
+    uint32_t sector_size; /* Flash sector size the patch has been generated for */
+    uint32_t backlog;     /* Number of overwritten sectors the commands may still refer to */
+    uint8_t  src_hash[IMAGE_HASH_SIZE]; /* Hash of the first src_size bytes of the slot */
+    uint8_t  dst_hash[IMAGE_HASH_SIZE]; /* Image hash of the new image (the value of its hash TLV) */
+} file_img_patch_hdr_t;
+
+typedef enum file_img_patch_op_e
+{
+    FILE_IMG_PATCH_OP_COPY   = 0,
+    FILE_IMG_PATCH_OP_ADD    = 1,
+    FILE_IMG_PATCH_OP_INSERT = 2,
+} file_img_patch_op_e;
+
+typedef struct file_img_patch_cmd_t
+{
+    uint8_t  op;
+    uint8_t  reserved[3];
+    uint32_t len;
+    uint32_t src_off;
+} file_img_patch_cmd_t;
+
+struct file_img_reader_t;
+
+/**
+ * State of the patch applier.
+ * Any offset of the new image can be read, reading backward restarts the command stream from the beginning.
+ */
+typedef struct file_img_patch_t
+{
+    struct file_img_reader_t* p_reader; /* Reader of the command stream */
+    const struct flash_area*  p_fa;     /* Slot which contains the old image and receives the new one */
+    file_img_patch_hdr_t      hdr;
+    uint32_t                  data_off;    /* Offset of the first command in the command stream */
+    uint32_t                  cmd_off;     /* Offset of the next command or command data in the command stream */
+    uint32_t                  cmd_len;     /* Number of bytes left in the current command */
+    uint32_t                  cmd_src_off; /* Offset in the old image of the next byte of the current command */
+    uint8_t                   cmd_op;
+    uint32_t                  pos;        /* Offset of the next byte of the new image to be produced */
+    uint32_t                  resume_off; /* The new image is already in the slot below this offset */
+    uint32_t                  src_floor;  /* Index of the first sector of the slot which has not been overwritten */
+    int32_t                   sector_idx_cur; /* Index of the sector being written, -1 before the first one */
+    bool                      is_writing;
+    bool                      snapshot_is_valid[FILE_IMG_PATCH_SNAPSHOT_CNT];
+    bool                      snapshot_is_saved[FILE_IMG_PATCH_SNAPSHOT_CNT];
+} file_img_patch_t;
+
+/**
+ * Prepare applying the patch to the given slot.
+ * If the copy journal shows that the slot has been partially patched already, the patching is resumed:
+ * the part which has been written is read from the slot and the saved sectors of the old image are loaded.
+ * If the hash TLV of the slot is the image hash of the new image, the patch has already been applied,
+ * and the whole new image is read from the slot.
+ * Otherwise the hash of the old image in the slot is checked.
+ * @return true on success, in this case the patch must be closed with file_img_patch_close().
+ */
+bool
+file_img_patch_open(
+    file_img_patch_t* const           p_patch,
+    struct file_img_reader_t* const   p_reader,
+    const file_img_patch_hdr_t* const p_hdr,
+    const uint32_t                    data_off,
+    const fa_id_t                     fa_id);
+
+void
+file_img_patch_close(file_img_patch_t* const p_patch);
+
+/**
+ * Read the new image at the given offset.
+ * @return 0 on success, negative error code otherwise.
+ */
+zephyr_api_ret_t
+file_img_patch_read_at(file_img_patch_t* const p_patch, const uint32_t offset, uint8_t* const p_buf, const size_t len);
+
+/**
+ * Start writing the new image to the slot.
+ * From now on the new image must be read sequentially, sector by sector, and each sector must be read before
+ * it is erased, so that its old contents can be saved.
+ */
+void
+file_img_patch_begin_write(file_img_patch_t* const p_patch);
+
+/**
+ * Finish writing the new image and remove the saved sectors of the old image.
+ */
+void
+file_img_patch_end_write(file_img_patch_t* const p_patch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FILE_IMG_PATCH_H
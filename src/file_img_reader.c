@@ -0,0 +1,578 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#include "file_img_reader.h"
+#include <errno.h>
+#include <string.h>
+#include <inttypes.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/logging/log.h>
+#include "btldr_fs.h"
+#include "file_img_inspect.h"
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_COMPRESSED)
+#include "file_img_decomp.h"
+#endif
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_PATCH)
+#include "file_img_patch.h"
+#endif
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_CHUNKED)
+#include "file_img_chunked.h"
+#endif
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_ENCRYPTED)
+#include <sysflash/pm_sysflash.h>
+#include "file_img_enc.h"
+#endif
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_SPARSE)
+#include "file_img_sparse.h"
+#endif
+
+LOG_MODULE_DECLARE(mcuboot, CONFIG_MCUBOOT_LOG_LEVEL);
+
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_COMPRESSED)
+/* Only one compressed file is open at a time, so a single decoder keeps the RAM usage predictable */
+static file_img_decomp_t g_file_img_decomp;
+static bool              g_file_img_decomp_is_used;
+
+static bool
+file_img_reader_open_compressed(file_img_reader_t* const p_reader, const char* const p_file_name)
+{
+    file_img_decomp_hdr_t hdr = { 0 };
+
+    const ssize_t len = fs_read(&p_reader->file, &hdr, sizeof(hdr));
+    if (len != sizeof(hdr))
+    {
+        LOG_ERR("Failed to read compressed container header from file %s, rc=%d", p_file_name, (int)len);
+        return false;
+    }
+    if (g_file_img_decomp_is_used)
+    {
+        LOG_ERR("Failed to open file %s: another compressed file is already open", p_file_name);
+        return false;
+    }
+    if (0 != file_img_decomp_init(&g_file_img_decomp, &p_reader->file, &hdr, (off_t)(p_reader->base_off + sizeof(hdr))))
+    {
+        return false;
+    }
+    g_file_img_decomp_is_used = true;
+    p_reader->p_decomp        = &g_file_img_decomp;
+    p_reader->raw_size        = hdr.img_size;
+    LOG_INF("File %s is compressed, decompressed size: %" PRIu32, p_file_name, hdr.img_size);
+    return true;
+}
+#endif // CONFIG_RUUVI_MCUBOOT_FILE_IMG_COMPRESSED
+
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_CHUNKED)
+/* Only one chunk-verified file is open at a time, the hash table and the chunk buffer are big */
+static file_img_chunked_t g_file_img_chunked;
+static bool               g_file_img_chunked_is_used;
+
+static bool
+file_img_reader_open_chunked(file_img_reader_t* const p_reader, const char* const p_file_name)
+{
+    file_img_chunked_hdr_t hdr = { 0 };
+
+    const ssize_t len = fs_read(&p_reader->file, &hdr, sizeof(hdr));
+    if (len != sizeof(hdr))
+    {
+        LOG_ERR("Failed to read chunk-verified container header from file %s, rc=%d", p_file_name, (int)len);
+        return false;
+    }
+    if (g_file_img_chunked_is_used)
+    {
+        LOG_ERR("Failed to open file %s: another chunk-verified file is already open", p_file_name);
+        return false;
+    }
+    if (0 != file_img_chunked_init(&g_file_img_chunked, &p_reader->file, &hdr, (off_t)p_reader->base_off))
+    {
+        LOG_ERR("Failed to load chunk hash table from file %s", p_file_name);
+        return false;
+    }
+    g_file_img_chunked_is_used = true;
+    p_reader->p_chunked        = &g_file_img_chunked;
+    p_reader->raw_size         = hdr.img_size;
+    LOG_INF("File %s is chunk-verified, image size: %" PRIu32, p_file_name, hdr.img_size);
+    return true;
+}
+#endif // CONFIG_RUUVI_MCUBOOT_FILE_IMG_CHUNKED
+
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_SPARSE)
+/* Only one sparse file is open at a time */
+static file_img_sparse_t g_file_img_sparse;
+static bool              g_file_img_sparse_is_used;
+
+static bool
+file_img_reader_open_sparse(file_img_reader_t* const p_reader, const char* const p_file_name, const uint32_t size)
+{
+    file_img_sparse_hdr_t hdr = { 0 };
+
+    const ssize_t len = fs_read(&p_reader->file, &hdr, sizeof(hdr));
+    if (len != sizeof(hdr))
+    {
+        LOG_ERR("Failed to read sparse container header from file %s, rc=%d", p_file_name, (int)len);
+        return false;
+    }
+    if (g_file_img_sparse_is_used)
+    {
+        LOG_ERR("Failed to open file %s: another sparse file is already open", p_file_name);
+        return false;
+    }
+    const off_t hdr_off = (off_t)p_reader->base_off;
+    if (0 != file_img_sparse_init(&g_file_img_sparse, &p_reader->file, &hdr, hdr_off, hdr_off + (off_t)size))
+    {
+        LOG_ERR("Bad sparse container in file %s", p_file_name);
+        return false;
+    }
+    g_file_img_sparse_is_used = true;
+    p_reader->p_sparse        = &g_file_img_sparse;
+    p_reader->raw_size        = hdr.img_size;
+    LOG_INF("File %s is sparse, expanded size: %" PRIu32, p_file_name, hdr.img_size);
+    return true;
+}
+#endif // CONFIG_RUUVI_MCUBOOT_FILE_IMG_SPARSE
+
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_PATCH)
+/* Only one delta update is open at a time, the patch applier shares the snapshots of the slot anyway */
+static file_img_patch_t g_file_img_patch;
+static bool             g_file_img_patch_is_used;
+
+static bool
+file_img_reader_open_patch(file_img_reader_t* const p_reader, const char* const p_file_name, const fa_id_t fa_id)
+{
+    file_img_patch_hdr_t hdr = { 0 };
+
+    if ((p_reader->raw_size < sizeof(hdr)) || (0 != file_img_reader_read_raw(p_reader, 0, &hdr, sizeof(hdr))))
+    {
+        LOG_ERR("Failed to read patch header from file %s", p_file_name);
+        return false;
+    }
+    if (g_file_img_patch_is_used)
+    {
+        LOG_ERR("Failed to open file %s: another delta update is already open", p_file_name);
+        return false;
+    }
+    if (!file_img_patch_open(&g_file_img_patch, p_reader, &hdr, sizeof(hdr), fa_id))
+    {
+        LOG_ERR("Failed to apply the patch in file %s to flash area %d", p_file_name, fa_id);
+        return false;
+    }
+    g_file_img_patch_is_used = true;
+    p_reader->p_patch        = &g_file_img_patch;
+    p_reader->img_size       = hdr.dst_size;
+    LOG_INF(
+        "File %s is a delta update for flash area %d, image size: %" PRIu32 " -> %" PRIu32,
+        p_file_name,
+        fa_id,
+        hdr.src_size,
+        hdr.dst_size);
+    return true;
+}
+#endif // CONFIG_RUUVI_MCUBOOT_FILE_IMG_PATCH
+
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_ENCRYPTED)
+/* Only one encrypted image is open at a time */
+static file_img_enc_t g_file_img_enc;
+static bool           g_file_img_enc_is_used;
+
+/**
+ * Check if the plaintext of an encrypted image can be installed to the flash area.
+ * The image header keeps the encryption flag and the TLV area keeps the encryption TLV,
+ * so the image must not be installed to a slot which MCUboot decrypts itself (mcuboot_secondary).
+ */
+static bool
+file_img_reader_is_plaintext_dst(const fa_id_t fa_id)
+{
+    return (FILE_IMG_READER_FA_ID_NONE == fa_id) || ((fa_id_t)PM_ID(mcuboot_primary) == fa_id)
+           || ((fa_id_t)PM_ID(s0) == fa_id) || ((fa_id_t)PM_ID(s1) == fa_id);
+}
+
+/**
+ * Set up decryption if the image is encrypted.
+ * The decryption is applied to the image as it is read, so validation and installation see the plaintext.
+ */
+static bool
+file_img_reader_open_encrypted(file_img_reader_t* const p_reader, const char* const p_file_name, const fa_id_t fa_id)
+{
+    struct image_header hdr = { 0 };
+    if ((p_reader->img_size < sizeof(hdr)) || (0 != file_img_reader_read(p_reader, 0, &hdr, sizeof(hdr))))
+    {
+        /* Not an image, it will be rejected by the caller */
+        return true;
+    }
+    if (!file_img_enc_is_encrypted(&hdr))
+    {
+        return true;
+    }
+    if (!file_img_reader_is_plaintext_dst(fa_id))
+    {
+        LOG_ERR("Failed to open file %s: the encrypted image can't be installed to flash area %d", p_file_name, fa_id);
+        return false;
+    }
+    if (g_file_img_enc_is_used)
+    {
+        LOG_ERR("Failed to open file %s: another encrypted file is already open", p_file_name);
+        return false;
+    }
+    if (0 != file_img_enc_init(&g_file_img_enc, p_reader, &hdr))
+    {
+        LOG_ERR("Failed to decrypt the image in file %s", p_file_name);
+        return false;
+    }
+    g_file_img_enc_is_used = true;
+    p_reader->p_enc        = &g_file_img_enc;
+    LOG_INF("File %s contains an encrypted image", p_file_name);
+    return true;
+}
+#endif // CONFIG_RUUVI_MCUBOOT_FILE_IMG_ENCRYPTED
+
+static bool
+file_img_reader_detect_format(file_img_reader_t* const p_reader, const file_img_loc_t* const p_loc, const fa_id_t fa_id)
+{
+    const char* const p_file_name = p_loc->p_file_name;
+    const off_t       file_size   = btldr_fs_get_file_size(&p_reader->file);
+    if ((file_size < (off_t)p_loc->offset) || (file_size > (off_t)UINT32_MAX)
+        || (p_loc->size > ((uint32_t)file_size - p_loc->offset)))
+    {
+        LOG_ERR(
+            "Image at offset %" PRIu32 ", size %" PRIu32 " does not fit into file %s",
+            p_loc->offset,
+            p_loc->size,
+            p_file_name);
+        return false;
+    }
+    p_reader->base_off = p_loc->offset;
+    const uint32_t size = (0 != p_loc->size) ? p_loc->size : ((uint32_t)file_size - p_loc->offset);
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_COMPRESSED) || defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_CHUNKED) \
+    || defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_SPARSE)
+    uint32_t magic = 0;
+    if (0 != fs_seek(&p_reader->file, (off_t)p_reader->base_off, FS_SEEK_SET))
+    {
+        LOG_ERR("Failed to seek in file %s", p_file_name);
+        return false;
+    }
+    const ssize_t len = fs_read(&p_reader->file, &magic, sizeof(magic));
+    if (sizeof(magic) != len)
+    {
+        magic = 0;
+    }
+    if (0 != fs_seek(&p_reader->file, (off_t)p_reader->base_off, FS_SEEK_SET))
+    {
+        LOG_ERR("Failed to seek in file %s", p_file_name);
+        return false;
+    }
+#endif
+    bool is_container = false;
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_COMPRESSED)
+    if (FILE_IMG_DECOMP_MAGIC == magic)
+    {
+        if (!file_img_reader_open_compressed(p_reader, p_file_name))
+        {
+            return false;
+        }
+        is_container = true;
+    }
+#endif
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_CHUNKED)
+    if (FILE_IMG_CHUNKED_MAGIC == magic)
+    {
+        if (!file_img_reader_open_chunked(p_reader, p_file_name))
+        {
+            return false;
+        }
+        is_container = true;
+    }
+#endif
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_SPARSE)
+    if (FILE_IMG_SPARSE_MAGIC == magic)
+    {
+        if (!file_img_reader_open_sparse(p_reader, p_file_name, size))
+        {
+            return false;
+        }
+        is_container = true;
+    }
+#endif
+    if (!is_container)
+    {
+        p_reader->raw_size = size;
+    }
+    p_reader->img_size = p_reader->raw_size;
+
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_PATCH)
+    uint32_t patch_magic = 0;
+    if ((p_reader->raw_size >= sizeof(patch_magic))
+        && (0 == file_img_reader_read_raw(p_reader, 0, &patch_magic, sizeof(patch_magic)))
+        && (FILE_IMG_PATCH_MAGIC == patch_magic))
+    {
+        if (FILE_IMG_READER_FA_ID_NONE == fa_id)
+        {
+            LOG_ERR("File %s: a delta update is not expected here", p_file_name);
+            return false;
+        }
+        return file_img_reader_open_patch(p_reader, p_file_name, fa_id);
+    }
+#else
+    ARG_UNUSED(fa_id);
+#endif
+    return true;
+}
+
+bool
+file_img_reader_open(file_img_reader_t* const p_reader, const file_img_loc_t* const p_loc, const fa_id_t fa_id)
+{
+    p_reader->file      = btldr_fs_open_file(p_loc->p_file_name);
+    p_reader->base_off  = 0;
+    p_reader->raw_size  = 0;
+    p_reader->img_size  = 0;
+    p_reader->p_decomp  = NULL;
+    p_reader->p_patch   = NULL;
+    p_reader->p_chunked = NULL;
+    p_reader->p_enc     = NULL;
+    p_reader->p_sparse  = NULL;
+    p_reader->p_ram     = NULL;
+    p_reader->p_inspect = NULL;
+    p_reader->p_tlv_idx = NULL;
+    file_img_reader_set_read_ahead(p_reader, NULL, 0);
+    if (NULL == p_reader->file.filep)
+    {
+        return false;
+    }
+    if (!file_img_reader_detect_format(p_reader, p_loc, fa_id))
+    {
+        file_img_reader_close(p_reader);
+        return false;
+    }
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_ENCRYPTED)
+    if (!file_img_reader_open_encrypted(p_reader, p_loc->p_file_name, fa_id))
+    {
+        file_img_reader_close(p_reader);
+        return false;
+    }
+#endif
+    return true;
+}
+
+void
+file_img_reader_open_ram(file_img_reader_t* const p_reader, const uint8_t* const p_buf, const uint32_t size)
+{
+    memset(p_reader, 0, sizeof(*p_reader));
+    p_reader->raw_size = size;
+    p_reader->img_size = size;
+    p_reader->p_ram    = p_buf;
+}
+
+void
+file_img_reader_close(file_img_reader_t* const p_reader)
+{
+    if (NULL != p_reader->p_ram)
+    {
+        /* No file and no decoders are open */
+        p_reader->p_ram = NULL;
+        return;
+    }
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_ENCRYPTED)
+    if (NULL != p_reader->p_enc)
+    {
+        file_img_enc_deinit(p_reader->p_enc);
+        g_file_img_enc_is_used = false;
+        p_reader->p_enc        = NULL;
+    }
+#endif
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_PATCH)
+    if (NULL != p_reader->p_patch)
+    {
+        file_img_patch_close(p_reader->p_patch);
+        g_file_img_patch_is_used = false;
+        p_reader->p_patch        = NULL;
+    }
+#endif
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_COMPRESSED)
+    if (NULL != p_reader->p_decomp)
+    {
+        g_file_img_decomp_is_used = false;
+        p_reader->p_decomp        = NULL;
+    }
+#endif
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_SPARSE)
+    if (NULL != p_reader->p_sparse)
+    {
+        g_file_img_sparse_is_used = false;
+        p_reader->p_sparse        = NULL;
+    }
+#endif
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_CHUNKED)
+    if (NULL != p_reader->p_chunked)
+    {
+        g_file_img_chunked_is_used = false;
+        p_reader->p_chunked        = NULL;
+    }
+#endif
+    btldr_fs_close_file(&p_reader->file);
+}
+
+void
+file_img_reader_set_read_ahead(file_img_reader_t* const p_reader, uint8_t* const p_buf, const uint32_t buf_size)
+{
+    p_reader->p_ra_buf = p_buf;
+    p_reader->ra_size  = buf_size;
+    p_reader->ra_off   = 0;
+    p_reader->ra_len   = 0;
+}
+
+static bool
+file_img_reader_is_ra_buf(const file_img_reader_t* const p_reader, const void* const p_buf, const size_t len)
+{
+    const uintptr_t buf = (uintptr_t)p_buf;
+    const uintptr_t ra  = (uintptr_t)p_reader->p_ra_buf;
+    return (buf < (ra + p_reader->ra_size)) && (ra < (buf + len));
+}
+
+static zephyr_api_ret_t
+file_img_reader_read_raw_direct(
+    file_img_reader_t* const p_reader,
+    const uint32_t           offset,
+    void* const              p_buf,
+    const size_t             len)
+{
+    if (NULL != p_reader->p_ram)
+    {
+        memcpy(p_buf, &p_reader->p_ram[offset], len);
+        return 0;
+    }
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_COMPRESSED)
+    if (NULL != p_reader->p_decomp)
+    {
+        return file_img_decomp_read_at(p_reader->p_decomp, offset, p_buf, len);
+    }
+#endif
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_CHUNKED)
+    if (NULL != p_reader->p_chunked)
+    {
+        return file_img_chunked_read_at(p_reader->p_chunked, offset, p_buf, len);
+    }
+#endif
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_SPARSE)
+    if (NULL != p_reader->p_sparse)
+    {
+        return file_img_sparse_read_at(p_reader->p_sparse, offset, p_buf, len);
+    }
+#endif
+    const zephyr_api_ret_t rc = fs_seek(&p_reader->file, (off_t)(p_reader->base_off + offset), FS_SEEK_SET);
+    if (0 != rc)
+    {
+        return rc;
+    }
+    const ssize_t len_read = fs_read(&p_reader->file, p_buf, len);
+    if (len_read < 0)
+    {
+        return (zephyr_api_ret_t)len_read;
+    }
+    if (len_read != (ssize_t)len)
+    {
+        return -EIO;
+    }
+    return 0;
+}
+
+zephyr_api_ret_t
+file_img_reader_read_raw(file_img_reader_t* const p_reader, const uint32_t offset, void* const p_buf, const size_t len)
+{
+    if ((offset > p_reader->raw_size) || (len > (p_reader->raw_size - offset)))
+    {
+        return -EINVAL;
+    }
+    if ((NULL == p_reader->p_ra_buf) || (len >= p_reader->ra_size))
+    {
+        if ((NULL != p_reader->p_ra_buf) && file_img_reader_is_ra_buf(p_reader, p_buf, len))
+        {
+            p_reader->ra_len = 0;
+        }
+        return file_img_reader_read_raw_direct(p_reader, offset, p_buf, len);
+    }
+    if ((offset < p_reader->ra_off) || ((offset + len) > (p_reader->ra_off + p_reader->ra_len)))
+    {
+        const uint32_t fill_len = MIN(p_reader->ra_size, p_reader->raw_size - offset);
+        p_reader->ra_len        = 0;
+
+        const zephyr_api_ret_t rc = file_img_reader_read_raw_direct(p_reader, offset, p_reader->p_ra_buf, fill_len);
+        if (0 != rc)
+        {
+            return rc;
+        }
+        p_reader->ra_off = offset;
+        p_reader->ra_len = fill_len;
+    }
+    /* The destination may overlap the window, e.g. the last block of the image read into the hashing buffer */
+    memmove(p_buf, &p_reader->p_ra_buf[offset - p_reader->ra_off], len);
+    if (file_img_reader_is_ra_buf(p_reader, p_buf, len))
+    {
+        p_reader->ra_len = 0;
+    }
+    return 0;
+}
+
+zephyr_api_ret_t
+file_img_reader_read(file_img_reader_t* const p_reader, const uint32_t offset, void* const p_buf, const size_t len)
+{
+    if ((offset > p_reader->img_size) || (len > (p_reader->img_size - offset)))
+    {
+        return -EINVAL;
+    }
+    zephyr_api_ret_t rc = 0;
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_PATCH)
+    if (NULL != p_reader->p_patch)
+    {
+        rc = file_img_patch_read_at(p_reader->p_patch, offset, p_buf, len);
+    }
+    else
+#endif
+    {
+        rc = file_img_reader_read_raw(p_reader, offset, p_buf, len);
+    }
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_ENCRYPTED)
+    if ((0 == rc) && (NULL != p_reader->p_enc))
+    {
+        file_img_enc_decrypt(p_reader->p_enc, offset, p_buf, len);
+    }
+#endif
+    if ((0 == rc) && (NULL != p_reader->p_inspect))
+    {
+        file_img_inspect_feed(p_reader->p_inspect, offset, p_buf, len);
+    }
+    return rc;
+}
+
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_PATCH)
+bool
+file_img_reader_check_img_hash(const file_img_reader_t* const p_reader, const uint8_t* const p_img_hash)
+{
+    if (NULL == p_reader->p_patch)
+    {
+        return true;
+    }
+    if (0 != memcmp(p_reader->p_patch->hdr.dst_hash, p_img_hash, sizeof(p_reader->p_patch->hdr.dst_hash)))
+    {
+        LOG_ERR("Image hash in the patch header does not match the patched image");
+        return false;
+    }
+    return true;
+}
+
+uint32_t
+file_img_reader_get_in_place_resume_off(const file_img_reader_t* const p_reader)
+{
+    return p_reader->p_patch->resume_off;
+}
+
+void
+file_img_reader_begin_in_place_write(file_img_reader_t* const p_reader)
+{
+    file_img_patch_begin_write(p_reader->p_patch);
+}
+
+void
+file_img_reader_end_in_place_write(file_img_reader_t* const p_reader)
+{
+    file_img_patch_end_write(p_reader->p_patch);
+}
+#endif // CONFIG_RUUVI_MCUBOOT_FILE_IMG_PATCH
@@ -0,0 +1,184 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#ifndef FILE_IMG_READER_H
+#define FILE_IMG_READER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <zephyr/fs/fs.h>
+#include "ruuvi_fa_id.h"
+#include "zephyr_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct file_img_decomp_t;
+struct file_img_patch_t;
+struct file_img_chunked_t;
+struct file_img_enc_t;
+struct file_img_sparse_t;
+struct file_img_inspect_t;
+struct file_tlv_index_t;
+
+/* Destination slot of an image which is not installed (e.g. a bundle manifest), delta updates are rejected */
+#define FILE_IMG_READER_FA_ID_NONE ((fa_id_t)-1)
+
+/**
+ * Location of an image in an update file: the whole file or a member of a bundle.
+ */
+typedef struct file_img_loc_t
+{
+    const char* p_file_name;
+    uint32_t    offset; /* Offset of the image data in the file */
+    uint32_t    size;   /* Size of the image data in the file, 0 if it extends to the end of the file */
+} file_img_loc_t;
+
+/**
+ * Random access to the MCUboot image stored in an update file.
+ * Offsets are always relative to the beginning of the image, regardless of how the image is stored in the file,
+ * so that validation, TLV parsing and installation don't depend on the file format.
+ */
+typedef struct file_img_reader_t
+{
+    struct fs_file_t           file;
+    uint32_t                   base_off;  /* Offset of the image data in the file */
+    uint32_t                   raw_size;  /* Size of the data stored in the file after decompression/expansion */
+    uint32_t                   img_size;  /* Size of the image data available through the reader */
+    struct file_img_decomp_t*  p_decomp;  /* Streaming decompressor, NULL if the file is not compressed */
+    struct file_img_patch_t*   p_patch;   /* Patch applier, NULL if the file is not a delta update */
+    struct file_img_chunked_t* p_chunked; /* Chunk verifier, NULL if the file is not chunk-verified */
+    struct file_img_enc_t*     p_enc;     /* Image decryption, NULL if the image is not encrypted */
+    struct file_img_sparse_t*  p_sparse;  /* Sparse image expander, NULL if the file is not sparse */
+    const uint8_t*             p_ram;     /* Image already loaded into RAM, NULL if the image is read from the file */
+    uint8_t*                   p_ra_buf;  /* Read-ahead window, NULL if small reads go to the file directly */
+    uint32_t                   ra_size;   /* Size of the read-ahead window */
+    uint32_t                   ra_off;    /* Offset of the data in the read-ahead window */
+    uint32_t                   ra_len;    /* Length of the data in the read-ahead window, 0 if it is empty */
+    struct file_img_inspect_t* p_inspect; /* Captures the image data as it is read, NULL if not inspected */
+    struct file_tlv_index_t*   p_tlv_idx; /* TLV index of the image, NULL if the TLV area is walked in the file */
+} file_img_reader_t;
+
+/**
+ * Open the update file and detect the format of the image at the given location.
+ * @param fa_id Flash area ID of the destination slot, a delta update is applied to the image in this slot.
+ * @return true on success, in this case the reader must be closed with file_img_reader_close().
+ */
+bool
+file_img_reader_open(file_img_reader_t* const p_reader, const file_img_loc_t* const p_loc, const fa_id_t fa_id);
+
+/**
+ * Open a reader over an image which has already been read from the update file into RAM,
+ * so that it is installed without reading the file again. The buffer must stay valid until the reader is closed.
+ */
+void
+file_img_reader_open_ram(file_img_reader_t* const p_reader, const uint8_t* const p_buf, const uint32_t size);
+
+void
+file_img_reader_close(file_img_reader_t* const p_reader);
+
+/**
+ * Serve small reads (headers, TLVs) from a read-ahead window, so that a TLV walk costs one or two file reads
+ * instead of a seek and a read per TLV. Reads which are not smaller than the window go to the file directly.
+ * The buffer may also be used as the destination of reads through the reader (e.g. the hashing buffer),
+ * the window is dropped in this case.
+ */
+void
+file_img_reader_set_read_ahead(file_img_reader_t* const p_reader, uint8_t* const p_buf, const uint32_t buf_size);
+
+/**
+ * Pass every piece of the image read through the reader (after patching and decryption) to the inspector,
+ * so that the data needed after the validation is captured by the hashing pass. NULL stops the inspection.
+ */
+static inline void
+file_img_reader_set_inspect(file_img_reader_t* const p_reader, struct file_img_inspect_t* const p_inspect)
+{
+    p_reader->p_inspect = p_inspect;
+}
+
+/**
+ * Attach the TLV index of the image (see file_tlv_index_build()), so that TLV lookups don't read the file.
+ * NULL detaches the index.
+ */
+static inline void
+file_img_reader_set_tlv_index(file_img_reader_t* const p_reader, struct file_tlv_index_t* const p_tlv_index)
+{
+    p_reader->p_tlv_idx = p_tlv_index;
+}
+
+static inline uint32_t
+file_img_reader_get_size(const file_img_reader_t* const p_reader)
+{
+    return p_reader->img_size;
+}
+
+/**
+ * Read exactly len bytes of the image at the given offset.
+ * @return 0 on success, negative error code otherwise.
+ */
+zephyr_api_ret_t
+file_img_reader_read(file_img_reader_t* const p_reader, const uint32_t offset, void* const p_buf, const size_t len);
+
+/**
+ * Read exactly len bytes of the data stored in the file (after decompression, but before applying a patch).
+ * @return 0 on success, negative error code otherwise.
+ */
+zephyr_api_ret_t
+file_img_reader_read_raw(file_img_reader_t* const p_reader, const uint32_t offset, void* const p_buf, const size_t len);
+
+/**
+ * Check if the image is a delta update, which is applied in place to the destination slot.
+ */
+static inline bool
+file_img_reader_is_in_place(const file_img_reader_t* const p_reader)
+{
+    return NULL != p_reader->p_patch;
+}
+
+/**
+ * Check if every chunk of the image is verified against the signed chunk hash table as it is read,
+ * in this case the image doesn't have to be hashed as a whole before it is installed.
+ */
+static inline bool
+file_img_reader_is_chunk_verified(const file_img_reader_t* const p_reader)
+{
+    return NULL != p_reader->p_chunked;
+}
+
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_PATCH)
+/**
+ * Check that a delta update produces the image with the given hash (the hash calculated during validation).
+ * Always true for other files.
+ */
+bool
+file_img_reader_check_img_hash(const file_img_reader_t* const p_reader, const uint8_t* const p_img_hash);
+
+/**
+ * Get the offset from which the image of a delta update still has to be written to the destination slot.
+ */
+uint32_t
+file_img_reader_get_in_place_resume_off(const file_img_reader_t* const p_reader);
+
+/**
+ * Start writing the image of a delta update to the destination slot.
+ * From now on the image must be read sequentially, sector by sector, and each sector must be read
+ * before it is erased.
+ */
+void
+file_img_reader_begin_in_place_write(file_img_reader_t* const p_reader);
+
+/**
+ * Finish writing the image of a delta update to the destination slot.
+ */
+void
+file_img_reader_end_in_place_write(file_img_reader_t* const p_reader);
+#endif // CONFIG_RUUVI_MCUBOOT_FILE_IMG_PATCH
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FILE_IMG_READER_H
@@ -0,0 +1,167 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#include "file_img_sparse.h"
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_DECLARE(mcuboot, CONFIG_MCUBOOT_LOG_LEVEL);
+
+static zephyr_api_ret_t
+file_img_sparse_read_file(
+    const file_img_sparse_t* const p_sparse,
+    const off_t                    offset,
+    void* const                    p_buf,
+    const size_t                   len)
+{
+    const zephyr_api_ret_t rc = fs_seek(p_sparse->p_file, offset, FS_SEEK_SET);
+    if (0 != rc)
+    {
+        return rc;
+    }
+    const ssize_t len_read = fs_read(p_sparse->p_file, p_buf, len);
+    if (len_read < 0)
+    {
+        return (zephyr_api_ret_t)len_read;
+    }
+    if (len_read != (ssize_t)len)
+    {
+        return -EIO;
+    }
+    return 0;
+}
+
+static zephyr_api_ret_t
+file_img_sparse_load_run(file_img_sparse_t* const p_sparse)
+{
+    if (p_sparse->cur_idx >= p_sparse->run_cnt)
+    {
+        return 0;
+    }
+    return file_img_sparse_read_file(
+        p_sparse,
+        p_sparse->table_off + (off_t)(p_sparse->cur_idx * sizeof(file_img_sparse_run_t)),
+        &p_sparse->cur_run,
+        sizeof(p_sparse->cur_run));
+}
+
+static zephyr_api_ret_t
+file_img_sparse_rewind(file_img_sparse_t* const p_sparse)
+{
+    p_sparse->cur_idx      = 0;
+    p_sparse->cur_data_off = p_sparse->data_off;
+    p_sparse->prev_end     = 0;
+    return file_img_sparse_load_run(p_sparse);
+}
+
+static zephyr_api_ret_t
+file_img_sparse_next_run(file_img_sparse_t* const p_sparse)
+{
+    p_sparse->prev_end = p_sparse->cur_run.offset + p_sparse->cur_run.len;
+    p_sparse->cur_data_off += (off_t)p_sparse->cur_run.len;
+    p_sparse->cur_idx += 1;
+    return file_img_sparse_load_run(p_sparse);
+}
+
+zephyr_api_ret_t
+file_img_sparse_init(
+    file_img_sparse_t* const           p_sparse,
+    struct fs_file_t* const            p_file,
+    const file_img_sparse_hdr_t* const p_hdr,
+    const off_t                        hdr_off,
+    const off_t                        file_end)
+{
+    p_sparse->p_file    = p_file;
+    p_sparse->table_off = hdr_off + (off_t)sizeof(*p_hdr);
+    p_sparse->img_size  = p_hdr->img_size;
+    p_sparse->run_cnt   = p_hdr->run_cnt;
+    p_sparse->data_off  = p_sparse->table_off + (off_t)((uint64_t)p_hdr->run_cnt * sizeof(file_img_sparse_run_t));
+    if (p_sparse->data_off > file_end)
+    {
+        LOG_ERR("Sparse run table does not fit into the file: %" PRIu32 " runs", p_hdr->run_cnt);
+        return -EINVAL;
+    }
+
+    /* Check the whole table once, so that reads don't have to handle inconsistent runs */
+    zephyr_api_ret_t rc = file_img_sparse_rewind(p_sparse);
+    while ((0 == rc) && (p_sparse->cur_idx < p_sparse->run_cnt))
+    {
+        const file_img_sparse_run_t* const p_run = &p_sparse->cur_run;
+        if ((p_run->offset < p_sparse->prev_end) || (0 == p_run->len) || (p_run->offset > p_sparse->img_size)
+            || (p_run->len > (p_sparse->img_size - p_run->offset)))
+        {
+            LOG_ERR(
+                "Bad sparse run %" PRIu32 ": offset 0x%08" PRIx32 ", length %" PRIu32,
+                p_sparse->cur_idx,
+                p_run->offset,
+                p_run->len);
+            return -EINVAL;
+        }
+        rc = file_img_sparse_next_run(p_sparse);
+    }
+    if (0 != rc)
+    {
+        LOG_ERR("Failed to read sparse run table, rc=%d", rc);
+        return rc;
+    }
+    if (p_sparse->cur_data_off != file_end)
+    {
+        LOG_ERR("Size of the sparse data does not match the run table");
+        return -EINVAL;
+    }
+    LOG_INF(
+        "Sparse image: %" PRIu32 " data runs, %" PRIu32 " of %" PRIu32 " bytes stored",
+        p_sparse->run_cnt,
+        (uint32_t)(file_end - p_sparse->data_off),
+        p_sparse->img_size);
+    return file_img_sparse_rewind(p_sparse);
+}
+
+zephyr_api_ret_t
+file_img_sparse_read_at(
+    file_img_sparse_t* const p_sparse,
+    const uint32_t           offset,
+    uint8_t* const           p_buf,
+    const size_t             len)
+{
+    if ((offset > p_sparse->img_size) || (len > (p_sparse->img_size - offset)))
+    {
+        return -EINVAL;
+    }
+    const uint32_t end = offset + (uint32_t)len;
+    memset(p_buf, UINT8_MAX, len);
+
+    zephyr_api_ret_t rc = 0;
+    if (offset < p_sparse->prev_end)
+    {
+        /* Reading backward, e.g. the TLV area after the image has been hashed */
+        rc = file_img_sparse_rewind(p_sparse);
+    }
+    while ((0 == rc) && (p_sparse->cur_idx < p_sparse->run_cnt) && (p_sparse->cur_run.offset < end))
+    {
+        const uint32_t run_end = p_sparse->cur_run.offset + p_sparse->cur_run.len;
+        if (run_end > offset)
+        {
+            const uint32_t copy_start = (p_sparse->cur_run.offset > offset) ? p_sparse->cur_run.offset : offset;
+            const uint32_t copy_end   = (run_end < end) ? run_end : end;
+            rc                        = file_img_sparse_read_file(
+                p_sparse,
+                p_sparse->cur_data_off + (off_t)(copy_start - p_sparse->cur_run.offset),
+                &p_buf[copy_start - offset],
+                copy_end - copy_start);
+            if (run_end > end)
+            {
+                /* The rest of the run is needed by the next read */
+                break;
+            }
+        }
+        if (0 == rc)
+        {
+            rc = file_img_sparse_next_run(p_sparse);
+        }
+    }
+    return rc;
+}
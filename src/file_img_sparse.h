@@ -0,0 +1,87 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#ifndef FILE_IMG_SPARSE_H
+#define FILE_IMG_SPARSE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <zephyr/fs/fs.h>
+#include "zephyr_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Magic of the sparse update file container: "RSP1" */
+#define FILE_IMG_SPARSE_MAGIC 0x31505352U
+
+/**
+ * Header of the sparse update file container.
+ * It is followed by the table of run_cnt data runs (sorted by offset, not overlapping)
+ * and the data of the runs, stored back to back. The bytes of the image outside the data runs are 0xFF.
+ */
+typedef struct file_img_sparse_hdr_t
+{
+    uint32_t magic;
+    uint32_t img_size; /* Size of the expanded image */
+    uint32_t run_cnt;
+    uint32_t reserved;
+} file_img_sparse_hdr_t;
+
+typedef struct file_img_sparse_run_t
+{
+    uint32_t offset; /* Offset of the run in the expanded image */
+    uint32_t len;
+} file_img_sparse_run_t;
+
+/**
+ * State of the sparse image expander.
+ * The run table is read from the file as the image is read, the cursor points to the first run
+ * which does not end before the last read, so that sequential reads don't look up the table again.
+ */
+typedef struct file_img_sparse_t
+{
+    struct fs_file_t*     p_file;
+    off_t                 table_off; /* Offset of the run table in the file */
+    uint32_t              img_size;
+    uint32_t              run_cnt;
+    uint32_t              cur_idx;      /* Index of the current run, run_cnt if past the last run */
+    file_img_sparse_run_t cur_run;      /* Current run */
+    off_t                 cur_data_off; /* Offset of the data of the current run in the file */
+    uint32_t              prev_end;     /* End of the run before the current one, 0 for the first run */
+    off_t                 data_off;     /* Offset of the data of the first run in the file */
+} file_img_sparse_t;
+
+/**
+ * Check the run table which follows the header at hdr_off in the file.
+ * @param file_end Offset of the end of the container in the file.
+ * @return 0 on success, -EINVAL if the table is not consistent, negative error code otherwise.
+ */
+zephyr_api_ret_t
+file_img_sparse_init(
+    file_img_sparse_t* const           p_sparse,
+    struct fs_file_t* const            p_file,
+    const file_img_sparse_hdr_t* const p_hdr,
+    const off_t                        hdr_off,
+    const off_t                        file_end);
+
+/**
+ * Read expanded image data at the given offset.
+ * @return 0 on success, negative error code otherwise.
+ */
+zephyr_api_ret_t
+file_img_sparse_read_at(
+    file_img_sparse_t* const p_sparse,
+    const uint32_t           offset,
+    uint8_t* const           p_buf,
+    const size_t             len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FILE_IMG_SPARSE_H
@@ -59,6 +59,9 @@
 
 #include "file_tlv.h"
 #include "zephyr_api.h"
+#if defined(CONFIG_RUUVI_MCUBOOT_KEY_HASH_TABLE)
+#include "file_img_key_hash.h"
+#endif
 
 LOG_MODULE_DECLARE(mcuboot, CONFIG_MCUBOOT_LOG_LEVEL);
 
@@ -71,7 +74,7 @@ LOG_MODULE_DECLARE(mcuboot, CONFIG_MCUBOOT_LOG_LEVEL);
 static zephyr_api_ret_t
 file_img_hash(
     const struct image_header* const hdr,
-    struct fs_file_t* const          p_file,
+    file_img_reader_t* const         p_reader,
     uint8_t* const                   tmp_buf,
     const uint32_t                   tmp_buf_sz,
     uint8_t* const                   hash_result,
@@ -112,7 +115,7 @@ file_img_hash(
         {
             blk_sz = tmp_buf_sz;
         }
-        const zephyr_api_ret_t rc = load_image_data(p_file, off, tmp_buf, blk_sz);
+        const zephyr_api_ret_t rc = load_image_data(p_reader, off, tmp_buf, blk_sz);
         if (0 != rc)
         {
             bootutil_sha_drop(&sha_ctx);
@@ -185,6 +188,76 @@ file_img_hash(
 
 #if !defined(CONFIG_BOOT_SIGNATURE_USING_KMU)
 #if !defined(MCUBOOT_HW_KEY)
+#if defined(CONFIG_RUUVI_MCUBOOT_KEY_HASH_TABLE)
+/*
+ * Find the key by its hash in the key hash table generated at build time.
+ * All the entries are compared, so the lookup time does not depend on the key,
+ * and the comparison is hardened against fault injection.
+ */
+static int32_t
+file_img_find_key_in_table(const uint8_t* const keyhash, const uint8_t keyhash_len)
+{
+    int32_t key_id = -1;
+    for (uint32_t i = 0; i < g_file_img_key_hash_cnt; ++i)
+    {
+        FIH_DECLARE(fih_rc, FIH_FAILURE);
+        FIH_CALL(boot_fih_memequal, fih_rc, g_file_img_key_hash[i], keyhash, keyhash_len);
+        if (FIH_EQ(fih_rc, FIH_SUCCESS) && (key_id < 0))
+        {
+            key_id = (int32_t)i;
+        }
+    }
+    return key_id;
+}
+
+static bool g_file_img_key_hash_is_checked;
+static bool g_file_img_key_hash_is_valid;
+
+/**
+ * Check once that the table matches bootutil_keys[].
+ * The table and autogen-pubkey.c are generated separately from BOOT_SIGNATURE_KEY_FILE,
+ * so equal counts don't prove that they contain the same keys.
+ */
+static bool
+file_img_is_key_hash_table_valid(void)
+{
+    if (g_file_img_key_hash_is_checked)
+    {
+        return g_file_img_key_hash_is_valid;
+    }
+    g_file_img_key_hash_is_checked = true;
+    if (g_file_img_key_hash_cnt != (uint32_t)bootutil_key_cnt)
+    {
+        LOG_WRN(
+            "Key hash table has %u keys, but the bootloader has %d keys",
+            (unsigned)g_file_img_key_hash_cnt,
+            bootutil_key_cnt);
+        return false;
+    }
+    bootutil_sha_context sha_ctx = { 0 };
+    uint8_t              hash[IMAGE_HASH_SIZE];
+    bool                 is_valid = true;
+    for (int32_t i = 0; i < bootutil_key_cnt; ++i)
+    {
+        const struct bootutil_key* key = &bootutil_keys[i];
+        bootutil_sha_init(&sha_ctx);
+        bootutil_sha_update(&sha_ctx, key->key, *key->len);
+        bootutil_sha_finish(&sha_ctx, hash);
+        if (0 != memcmp(hash, g_file_img_key_hash[i], IMAGE_HASH_SIZE))
+        {
+            is_valid = false;
+        }
+    }
+    bootutil_sha_drop(&sha_ctx);
+    if (!is_valid)
+    {
+        LOG_WRN("Key hash table doesn't match the bootloader keys, the keys are hashed for every image");
+    }
+    g_file_img_key_hash_is_valid = is_valid;
+    return is_valid;
+}
+#endif // CONFIG_RUUVI_MCUBOOT_KEY_HASH_TABLE
+
 static int32_t
 file_img_find_key(const uint8_t* const keyhash, const uint8_t keyhash_len)
 {
@@ -196,6 +269,13 @@ file_img_find_key(const uint8_t* const keyhash, const uint8_t keyhash_len)
         return -1;
     }
 
+#if defined(CONFIG_RUUVI_MCUBOOT_KEY_HASH_TABLE)
+    /* The keys are hashed here only if the table differs from bootutil_keys[] */
+    if (file_img_is_key_hash_table_valid())
+    {
+        return file_img_find_key_in_table(keyhash, keyhash_len);
+    }
+#endif
     for (int32_t i = 0; i < bootutil_key_cnt; ++i)
     {
         const struct bootutil_key* key = &bootutil_keys[i];
@@ -267,12 +347,12 @@ file_img_find_key(uint8_t image_index, uint8_t* key, uint16_t key_len)
 int32_t
 file_img_get_security_cnt(
     const struct image_header* const hdr,
-    struct fs_file_t* const          p_file,
+    file_img_reader_t* const         p_reader,
     uint32_t* const                  img_security_cnt)
 {
     file_tlv_iter_t it = { 0 };
 
-    if ((NULL == hdr) || (NULL == p_file) || (NULL == img_security_cnt))
+    if ((NULL == hdr) || (NULL == p_reader) || (NULL == img_security_cnt))
     {
         /* Invalid parameter. */
         return BOOT_EBADARGS;
@@ -284,7 +364,7 @@ file_img_get_security_cnt(
         return BOOT_EBADIMAGE;
     }
 
-    zephyr_api_ret_t rc = file_tlv_iter_begin(&it, hdr, p_file, IMAGE_TLV_SEC_CNT, true);
+    zephyr_api_ret_t rc = file_tlv_iter_begin(&it, hdr, p_reader, IMAGE_TLV_SEC_CNT, true);
     if (0 != rc)
     {
         return rc;
@@ -309,7 +389,7 @@ file_img_get_security_cnt(
         return BOOT_EBADIMAGE;
     }
 
-    rc = LOAD_IMAGE_DATA(hdr, p_file, off, (void*)img_security_cnt, len);
+    rc = LOAD_IMAGE_DATA(hdr, p_reader, off, (void*)img_security_cnt, len);
     if (0 != rc)
     {
         return BOOT_EFLASH;
@@ -327,7 +407,7 @@ file_img_get_security_cnt(
  * Value of TLV does not matter, presence decides.
  */
 static int
-file_img_check_for_pure(const struct image_header* hdr, struct fs_file_t* const p_file)
+file_img_check_for_pure(const struct image_header* hdr, file_img_reader_t* const p_reader)
 {
     file_tlv_iter_t it { 0 };
 
@@ -356,40 +436,42 @@ file_img_check_for_pure(const struct image_header* hdr, struct fs_file_t* const
 #endif
 
 #ifndef ALLOW_ROGUE_TLVS
+/* Bit of the TLV type in a 64-bit TLV bitmap, no bit for the types which don't fit */
+#define FILE_IMG_TLV_BIT(type) /* NOSONAR */ (((type) < 64U) ? ((uint64_t)1U << ((type) & 63U)) : (uint64_t)0U)
+
 /*
- * The following list of TLVs are the only entries allowed in the unprotected
+ * The following TLVs are the only entries allowed in the unprotected
  * TLV section.  All other TLV entries must be in the protected section.
+ * All of them have types below 64, so they are checked with a single bit test.
  */
-static const uint16_t allowed_unprot_tlvs[] /* NOSONAR */ = {
-    IMAGE_TLV_KEYHASH,
-    IMAGE_TLV_PUBKEY,
-    IMAGE_TLV_SHA256,
-    IMAGE_TLV_SHA384,
-    IMAGE_TLV_SHA512,
-    IMAGE_TLV_RSA2048_PSS,
-    IMAGE_TLV_ECDSA224,
-    IMAGE_TLV_ECDSA_SIG,
-    IMAGE_TLV_RSA3072_PSS,
-    IMAGE_TLV_ED25519,
+static const uint64_t allowed_unprot_tlvs_bitmap = FILE_IMG_TLV_BIT(IMAGE_TLV_KEYHASH)
+                                                   | FILE_IMG_TLV_BIT(IMAGE_TLV_PUBKEY)
+                                                   | FILE_IMG_TLV_BIT(IMAGE_TLV_SHA256)
+                                                   | FILE_IMG_TLV_BIT(IMAGE_TLV_SHA384)
+                                                   | FILE_IMG_TLV_BIT(IMAGE_TLV_SHA512)
+                                                   | FILE_IMG_TLV_BIT(IMAGE_TLV_RSA2048_PSS)
+                                                   | FILE_IMG_TLV_BIT(IMAGE_TLV_ECDSA224)
+                                                   | FILE_IMG_TLV_BIT(IMAGE_TLV_ECDSA_SIG)
+                                                   | FILE_IMG_TLV_BIT(IMAGE_TLV_RSA3072_PSS)
+                                                   | FILE_IMG_TLV_BIT(IMAGE_TLV_ED25519)
 #if defined(MCUBOOT_SIGN_PURE)
-    IMAGE_TLV_SIG_PURE,
+                                                   | FILE_IMG_TLV_BIT(IMAGE_TLV_SIG_PURE)
 #endif
-    IMAGE_TLV_ENC_RSA2048,
-    IMAGE_TLV_ENC_KW,
-    IMAGE_TLV_ENC_EC256,
-    IMAGE_TLV_ENC_X25519,
-    /* Mark end with ANY. */
-    IMAGE_TLV_ANY,
-};
+                                                   | FILE_IMG_TLV_BIT(IMAGE_TLV_ENC_RSA2048)
+                                                   | FILE_IMG_TLV_BIT(IMAGE_TLV_ENC_KW)
+                                                   | FILE_IMG_TLV_BIT(IMAGE_TLV_ENC_EC256)
+                                                   | FILE_IMG_TLV_BIT(IMAGE_TLV_ENC_X25519);
+
+_Static_assert(IMAGE_TLV_ENC_X25519 < 64U, "Unprotected TLV types must fit into the bitmap"); // NOSONAR
 #endif
 
 static inline bool
 file_image_validate_tlv_expected_hash(
-    struct fs_file_t* const p_file,
-    const uint32_t          off,
-    const uint16_t          len,
-    const uint8_t* const    p_hash,
-    bool* const             p_image_hash_valid)
+    file_img_reader_t* const p_reader,
+    const uint32_t           off,
+    const uint16_t           len,
+    const uint8_t* const     p_hash,
+    bool* const              p_image_hash_valid)
 {
     uint8_t buf[IMAGE_HASH_SIZE];
     /* Verify the image hash. This must always be present. */
@@ -397,7 +479,7 @@ file_image_validate_tlv_expected_hash(
     {
         return false;
     }
-    zephyr_api_ret_t rc = LOAD_IMAGE_DATA(hdr, p_file, off, buf, IMAGE_HASH_SIZE);
+    zephyr_api_ret_t rc = LOAD_IMAGE_DATA(hdr, p_reader, off, buf, IMAGE_HASH_SIZE);
     if (0 != rc)
     {
         return false;
@@ -417,10 +499,10 @@ file_image_validate_tlv_expected_hash(
 
 static inline bool
 file_image_validate_tlv_expected_key(
-    struct fs_file_t* const p_file,
-    const uint32_t          off,
-    const uint16_t          len,
-    int32_t* const          p_key_id)
+    file_img_reader_t* const p_reader,
+    const uint32_t           off,
+    const uint16_t           len,
+    int32_t* const           p_key_id)
 {
     uint8_t buf[KEY_BUF_SIZE];
 #ifdef MCUBOOT_HW_KEY
@@ -434,7 +516,7 @@ file_image_validate_tlv_expected_key(
         return false;
     }
 #ifndef MCUBOOT_HW_KEY
-    zephyr_api_ret_t rc = LOAD_IMAGE_DATA(hdr, p_file, off, buf, len);
+    zephyr_api_ret_t rc = LOAD_IMAGE_DATA(hdr, p_reader, off, buf, len);
     if (0 != rc)
     {
         return false;
@@ -458,12 +540,12 @@ file_image_validate_tlv_expected_key(
 
 static inline bool
 file_image_validate_tlv_expected_sig(
-    struct fs_file_t* const p_file,
-    const uint32_t          off,
-    const uint16_t          len,
-    uint8_t* const          p_hash,
-    fih_ret* const          p_valid_signature,
-    int32_t* const          p_key_id)
+    file_img_reader_t* const p_reader,
+    const uint32_t           off,
+    const uint16_t           len,
+    uint8_t* const           p_hash,
+    fih_ret* const           p_valid_signature,
+    int32_t* const           p_key_id)
 {
     uint8_t buf[SIG_BUF_SIZE];
     if ((0 == EXPECTED_SIG_LEN(len)) || (len > sizeof(buf)))
@@ -471,7 +553,7 @@ file_image_validate_tlv_expected_sig(
         LOG_ERR("EXPECTED_SIG_TLV: invalid signature length: %u", len);
         return false;
     }
-    zephyr_api_ret_t rc = LOAD_IMAGE_DATA(hdr, p_file, off, buf, len);
+    zephyr_api_ret_t rc = LOAD_IMAGE_DATA(hdr, p_reader, off, buf, len);
     if (0 != rc)
     {
         LOG_ERR("EXPECTED_SIG_TLV: failed to load signature data, rc=%d", rc);
@@ -503,12 +585,12 @@ file_image_validate_tlv_expected_sig(
 
 static inline zephyr_api_ret_t
 file_image_validate_tlv(
-    struct fs_file_t* const p_file,
-    file_tlv_iter_t* const  p_it,
-    uint8_t* const          p_hash,
-    int32_t* const          p_key_id,
-    bool* const             p_image_hash_valid,
-    fih_ret* const          p_valid_signature)
+    file_img_reader_t* const p_reader,
+    file_tlv_iter_t* const   p_it,
+    uint8_t* const           p_hash,
+    int32_t* const           p_key_id,
+    bool* const              p_image_hash_valid,
+    fih_ret* const           p_valid_signature)
 {
     uint32_t off  = 0;
     uint16_t len  = 0;
@@ -526,21 +608,9 @@ file_image_validate_tlv(
      * the signature.  We also allow encryption related keys to be in the
      * unprotected area.
      */
-    if (0 == file_tlv_iter_is_prot(p_it, off))
+    if ((0 == file_tlv_iter_is_prot(p_it, off)) && (0 == (allowed_unprot_tlvs_bitmap & FILE_IMG_TLV_BIT(type))))
     {
-        bool found = false;
-        for (const uint16_t* p = allowed_unprot_tlvs; *p != IMAGE_TLV_ANY; ++p)
-        {
-            if (type == *p)
-            {
-                found = true;
-                break;
-            }
-        }
-        if (!found)
-        {
-            return -1;
-        }
+        return -1;
     }
 #endif
     switch (type)
@@ -549,7 +619,7 @@ file_image_validate_tlv(
         case EXPECTED_HASH_TLV:
         {
             LOG_INF("Handle record: EXPECTED_HASH_TLV");
-            if (!file_image_validate_tlv_expected_hash(p_file, off, len, p_hash, p_image_hash_valid))
+            if (!file_image_validate_tlv_expected_hash(p_reader, off, len, p_hash, p_image_hash_valid))
             {
                 return -1;
             }
@@ -561,7 +631,7 @@ file_image_validate_tlv(
         case EXPECTED_KEY_TLV:
         {
             LOG_INF("Handle record: EXPECTED_KEY_TLV");
-            if (!file_image_validate_tlv_expected_key(p_file, off, len, p_key_id))
+            if (!file_image_validate_tlv_expected_key(p_reader, off, len, p_key_id))
             {
                 return -1;
             }
@@ -584,7 +654,7 @@ file_image_validate_tlv(
             }
 #endif /* !defined(CONFIG_BOOT_SIGNATURE_USING_KMU) */
 
-            if (!file_image_validate_tlv_expected_sig(p_file, off, len, p_hash, p_valid_signature, p_key_id))
+            if (!file_image_validate_tlv_expected_sig(p_reader, off, len, p_hash, p_valid_signature, p_key_id))
             {
                 return -1;
             }
@@ -600,17 +670,20 @@ file_image_validate_tlv(
 
 /*
  * Verify the integrity of the image.
+ * If out_hash is not NULL, the image hash (IMAGE_HASH_SIZE bytes) is copied there
+ * after it has been checked against the hash TLV.
  * Return non-zero if image could not be validated/does not validate.
  */
 fih_ret
 file_img_validate(
     const struct image_header* const hdr,
-    struct fs_file_t* const          p_file,
+    file_img_reader_t* const         p_reader,
     const uint32_t                   fa_size,
     uint8_t* const                   tmp_buf,
     const uint32_t                   tmp_buf_sz,
     const uint8_t* const             seed,
-    const ssize_t                    seed_len)
+    const ssize_t                    seed_len,
+    uint8_t* const                   out_hash)
 {
 #ifdef EXPECTED_SIG_TLV
     FIH_DECLARE(valid_signature, FIH_FAILURE);
@@ -629,7 +702,7 @@ file_img_validate(
 #endif
 
 #if defined(EXPECTED_HASH_TLV) && !defined(MCUBOOT_SIGN_PURE)
-    rc = file_img_hash(hdr, p_file, tmp_buf, tmp_buf_sz, hash, seed, seed_len);
+    rc = file_img_hash(hdr, p_reader, tmp_buf, tmp_buf_sz, hash, seed, seed_len);
     if (0 != rc)
     {
         goto OUT; // NOSONAR
@@ -638,14 +711,14 @@ file_img_validate(
 
 #if defined(MCUBOOT_SIGN_PURE)
     /* If Pure type signature is expected then it has to be there */
-    rc = file_img_check_for_pure(hdr, p_file);
+    rc = file_img_check_for_pure(hdr, p_reader);
     if (0 != rc)
     {
         goto OUT; // NOSONAR
     }
 #endif
 
-    rc = file_tlv_iter_begin(&it, hdr, p_file, IMAGE_TLV_ANY, false);
+    rc = file_tlv_iter_begin(&it, hdr, p_reader, IMAGE_TLV_ANY, false);
     if (0 != rc)
     {
         goto OUT; // NOSONAR
@@ -674,7 +747,7 @@ file_img_validate(
      */
     while (true)
     {
-        rc = file_image_validate_tlv(p_file, &it, hash, &key_id, &image_hash_valid, &valid_signature);
+        rc = file_image_validate_tlv(p_reader, &it, hash, &key_id, &image_hash_valid, &valid_signature);
         if (rc < 0)
         {
             goto OUT; // NOSONAR
@@ -691,6 +764,10 @@ file_img_validate(
     {
         goto OUT; // NOSONAR
     }
+    if (NULL != out_hash)
+    {
+        memcpy(out_hash, hash, IMAGE_HASH_SIZE);
+    }
 #elif defined(MCUBOOT_SIGN_PURE)
     /* This returns true on EQ, rc is err on non-0 */
     rc = FIH_NOT_EQ(valid_signature, FIH_SUCCESS);
@@ -715,3 +792,73 @@ OUT:
 
     FIH_RET(fih_rc);
 }
+
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_CHUNKED)
+fih_ret
+file_img_validate_sig(
+    const uint8_t* const p_hash,
+    const uint8_t* const p_key_hash,
+    const uint8_t* const p_sig,
+    const uint16_t       sig_len)
+{
+    FIH_DECLARE(fih_rc, FIH_FAILURE);
+#if defined(EXPECTED_SIG_TLV) && !defined(MCUBOOT_SIGN_PURE) && !defined(MCUBOOT_HW_KEY) \
+    && !defined(MCUBOOT_BUILTIN_KEY) && !defined(CONFIG_BOOT_SIGNATURE_USING_KMU)
+    if ((0 == EXPECTED_SIG_LEN(sig_len)) || (sig_len > SIG_BUF_SIZE))
+    {
+        LOG_ERR("Invalid signature length: %u", sig_len);
+        FIH_RET(fih_rc);
+    }
+    const int32_t key_id = file_img_find_key(p_key_hash, IMAGE_HASH_SIZE);
+    if ((key_id < 0) || (key_id >= bootutil_key_cnt))
+    {
+        LOG_ERR("Signing key is not one of the image keys");
+        FIH_RET(fih_rc);
+    }
+    /* bootutil_verify_sig() takes non-const buffers */
+    uint8_t hash_buf[IMAGE_HASH_SIZE];
+    uint8_t sig_buf[SIG_BUF_SIZE];
+    memcpy(hash_buf, p_hash, sizeof(hash_buf));
+    memcpy(sig_buf, p_sig, sig_len);
+    FIH_CALL(bootutil_verify_sig, fih_rc, hash_buf, IMAGE_HASH_SIZE, sig_buf, sig_len, (uint8_t)key_id);
+#else
+    ARG_UNUSED(p_hash);
+    ARG_UNUSED(p_key_hash);
+    ARG_UNUSED(p_sig);
+    ARG_UNUSED(sig_len);
+    LOG_ERR("Signatures of chunk hash tables are not supported with this signing configuration");
+#endif
+    FIH_RET(fih_rc);
+}
+
+zephyr_api_ret_t
+file_img_get_hash_tlv(
+    const struct image_header* const hdr,
+    file_img_reader_t* const         p_reader,
+    const uint32_t                   fa_size,
+    uint8_t* const                   out_hash)
+{
+    file_tlv_iter_t  it = { 0 };
+    zephyr_api_ret_t rc = file_tlv_iter_begin(&it, hdr, p_reader, EXPECTED_HASH_TLV, false);
+    if (0 != rc)
+    {
+        return rc;
+    }
+    if (it.tlv_end > fa_size)
+    {
+        return -1;
+    }
+    uint32_t off = 0;
+    uint16_t len = 0;
+    rc           = file_tlv_iter_next(&it, &off, &len, NULL);
+    if (0 != rc)
+    {
+        return -1;
+    }
+    if (IMAGE_HASH_SIZE != len)
+    {
+        return -1;
+    }
+    return LOAD_IMAGE_DATA(hdr, p_reader, off, out_hash, IMAGE_HASH_SIZE);
+}
+#endif // CONFIG_RUUVI_MCUBOOT_FILE_IMG_CHUNKED
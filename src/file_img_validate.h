@@ -8,9 +8,9 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <sys/types.h>
-#include <zephyr/fs/fs_interface.h>
 #include <bootutil/image.h>
 #include <bootutil/fault_injection_hardening.h>
+#include "file_img_reader.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -18,17 +18,45 @@ extern "C" {
 
 /*
  * Verify the integrity of the image.
+ * If out_hash is not NULL, the image hash (IMAGE_HASH_SIZE bytes) is copied there
+ * after it has been checked against the hash TLV.
  * Return non-zero if image could not be validated/does not validate.
  */
 fih_ret
 file_img_validate(
     const struct image_header* const hdr,
-    struct fs_file_t* const          p_file,
+    file_img_reader_t* const         p_reader,
     const uint32_t                   fa_size,
     uint8_t* const                   tmp_buf,
     const uint32_t                   tmp_buf_sz,
     const uint8_t* const             seed,
-    const ssize_t                    seed_len);
+    const ssize_t                    seed_len,
+    uint8_t* const                   out_hash);
+
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_CHUNKED)
+/*
+ * Verify a signature over the given hash, made with the image key whose hash is p_key_hash.
+ * Used for the chunk hash tables of chunk-verified update files.
+ */
+fih_ret
+file_img_validate_sig(
+    const uint8_t* const p_hash,
+    const uint8_t* const p_key_hash,
+    const uint8_t* const p_sig,
+    const uint16_t       sig_len);
+
+/*
+ * Get the image hash from the hash TLV without hashing the image.
+ * Only for images whose data is verified as it is read (chunk-verified update files).
+ * Return non-zero if the hash TLV is not found.
+ */
+zephyr_api_ret_t
+file_img_get_hash_tlv(
+    const struct image_header* const hdr,
+    file_img_reader_t* const         p_reader,
+    const uint32_t                   fa_size,
+    uint8_t* const                   out_hash);
+#endif // CONFIG_RUUVI_MCUBOOT_FILE_IMG_CHUNKED
 
 #ifdef __cplusplus
 }
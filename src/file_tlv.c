@@ -29,33 +29,19 @@
 #include "zephyr_api.h"
 
 /*
- * Initialize a TLV iterator.
- *
- * @param it An iterator struct
- * @param hdr image_header of the slot's image
- * @param p_file fs_file_t of the opened file which is storing the image
- * @param type Type of TLV to look for
- * @param prot true if TLV has to be stored in the protected area, false otherwise
- *
- * @returns 0 if the TLV iterator was successfully started
- *          -1 on errors
+ * Initialize a TLV iterator which walks the TLV area in the file.
  */
-zephyr_api_ret_t
-file_tlv_iter_begin(
+static zephyr_api_ret_t
+file_tlv_iter_begin_in_file(
     file_tlv_iter_t* const           it,
     const struct image_header* const hdr,
-    struct fs_file_t* const          p_file,
+    file_img_reader_t* const         p_reader,
     const uint16_t                   type,
     const bool                       prot)
 {
-    if ((NULL == it) || (NULL == hdr) || (NULL == p_file))
-    {
-        return -1;
-    }
-
     uint32_t              offset = BOOT_TLV_OFF(hdr);
     struct image_tlv_info info   = { 0 };
-    if (LOAD_IMAGE_DATA(hdr, p_file, offset, (void*)&info, sizeof(info)))
+    if (LOAD_IMAGE_DATA(hdr, p_reader, offset, (void*)&info, sizeof(info)))
     {
         return -1;
     }
@@ -67,7 +53,7 @@ file_tlv_iter_begin(
             return -1;
         }
 
-        if (LOAD_IMAGE_DATA(hdr, p_file, offset + info.it_tlv_tot, (void*)&info, sizeof(info)))
+        if (LOAD_IMAGE_DATA(hdr, p_reader, offset + info.it_tlv_tot, (void*)&info, sizeof(info)))
         {
             return -1;
         }
@@ -87,16 +73,94 @@ file_tlv_iter_begin(
     }
 
     it->hdr      = hdr;
-    it->p_file   = p_file;
+    it->p_reader = p_reader;
     it->type     = type;
     it->prot     = prot;
     it->prot_end = offset + it->hdr->ih_protect_tlv_size;
     it->tlv_end  = offset + it->hdr->ih_protect_tlv_size + info.it_tlv_tot;
+    it->p_index  = NULL;
+    it->idx      = 0;
     // position on first TLV
     it->tlv_off = offset + sizeof(info);
     return 0;
 }
 
+/*
+ * Initialize a TLV iterator.
+ *
+ * @param it An iterator struct
+ * @param hdr image_header of the slot's image
+ * @param p_reader reader of the opened file which is storing the image
+ * @param type Type of TLV to look for
+ * @param prot true if TLV has to be stored in the protected area, false otherwise
+ *
+ * @returns 0 if the TLV iterator was successfully started
+ *          -1 on errors
+ */
+zephyr_api_ret_t
+file_tlv_iter_begin(
+    file_tlv_iter_t* const           it,
+    const struct image_header* const hdr,
+    file_img_reader_t* const         p_reader,
+    const uint16_t                   type,
+    const bool                       prot)
+{
+    if ((NULL == it) || (NULL == hdr) || (NULL == p_reader))
+    {
+        return -1;
+    }
+
+    const file_tlv_index_t* const p_index = p_reader->p_tlv_idx;
+    if ((NULL == p_index) || (BOOT_TLV_OFF(hdr) != p_index->tlv_start)
+        || (hdr->ih_protect_tlv_size != p_index->prot_size))
+    {
+        return file_tlv_iter_begin_in_file(it, hdr, p_reader, type, prot);
+    }
+
+    it->hdr      = hdr;
+    it->p_reader = p_reader;
+    it->type     = type;
+    it->prot     = prot;
+    it->prot_end = p_index->prot_end;
+    it->tlv_end  = p_index->tlv_end;
+    it->tlv_off  = p_index->tlv_end;
+    it->p_index  = p_index;
+    it->idx      = 0;
+    return 0;
+}
+
+/*
+ * Find next TLV in the TLV index, the same way as file_tlv_iter_next() finds it in the file.
+ */
+static zephyr_api_ret_t
+file_tlv_iter_next_in_index(file_tlv_iter_t* const it, uint32_t* const off, uint16_t* const len, uint16_t* const type)
+{
+    while (it->idx < it->p_index->cnt)
+    {
+        const file_tlv_index_entry_t* const p_entry = &it->p_index->entries[it->idx];
+
+        /* No more TLVs in the protected area */
+        if (it->prot && (p_entry->off >= it->prot_end))
+        {
+            return 1;
+        }
+
+        it->idx += 1;
+        if ((IMAGE_TLV_ANY == it->type) || (p_entry->type == it->type))
+        {
+            if (NULL != type)
+            {
+                *type = p_entry->type;
+            }
+            *off = p_entry->off;
+            *len = p_entry->len;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
 /*
  * Find next TLV
  *
@@ -112,11 +176,16 @@ file_tlv_iter_begin(
 zephyr_api_ret_t
 file_tlv_iter_next(file_tlv_iter_t* const it, uint32_t* const off, uint16_t* const len, uint16_t* const type)
 {
-    if ((NULL == it) || (NULL == it->hdr) || (NULL == it->p_file))
+    if ((NULL == it) || (NULL == it->hdr) || (NULL == it->p_reader))
     {
         return -1;
     }
 
+    if (NULL != it->p_index)
+    {
+        return file_tlv_iter_next_in_index(it, off, len, type);
+    }
+
     while (it->tlv_off < it->tlv_end)
     {
         if ((it->hdr->ih_protect_tlv_size > 0) && (it->tlv_off == it->prot_end))
@@ -125,7 +194,7 @@ file_tlv_iter_next(file_tlv_iter_t* const it, uint32_t* const off, uint16_t* con
         }
 
         struct image_tlv tlv = { 0 };
-        zephyr_api_ret_t rc  = LOAD_IMAGE_DATA(it->hdr, it->p_file, it->tlv_off, (void*)&tlv, sizeof tlv);
+        zephyr_api_ret_t rc  = LOAD_IMAGE_DATA(it->hdr, it->p_reader, it->tlv_off, (void*)&tlv, sizeof tlv);
         if (0 != rc)
         {
             return -1;
@@ -168,10 +237,61 @@ file_tlv_iter_next(file_tlv_iter_t* const it, uint32_t* const off, uint16_t* con
 zephyr_api_ret_t
 file_tlv_iter_is_prot(const file_tlv_iter_t* const it, const uint32_t off)
 {
-    if ((NULL == it) || (NULL == it->hdr) || (NULL == it->p_file))
+    if ((NULL == it) || (NULL == it->hdr) || (NULL == it->p_reader))
     {
         return -1;
     }
 
     return off < it->prot_end;
 }
+
+/*
+ * Walk through the TLV area of the image once and collect all the TLVs.
+ */
+zephyr_api_ret_t
+file_tlv_index_build(
+    file_tlv_index_t* const          p_index,
+    const struct image_header* const hdr,
+    file_img_reader_t* const         p_reader)
+{
+    if ((NULL == p_index) || (NULL == hdr) || (NULL == p_reader))
+    {
+        return -1;
+    }
+
+    file_tlv_iter_t  it = { 0 };
+    zephyr_api_ret_t rc = file_tlv_iter_begin_in_file(&it, hdr, p_reader, IMAGE_TLV_ANY, false);
+    if (0 != rc)
+    {
+        return rc;
+    }
+    p_index->tlv_start = BOOT_TLV_OFF(hdr);
+    p_index->prot_size = hdr->ih_protect_tlv_size;
+    p_index->prot_end  = it.prot_end;
+    p_index->tlv_end   = it.tlv_end;
+    p_index->cnt       = 0;
+
+    while (true)
+    {
+        uint32_t off  = 0;
+        uint16_t len  = 0;
+        uint16_t type = 0;
+        rc            = file_tlv_iter_next(&it, &off, &len, &type);
+        if (0 != rc)
+        {
+            break;
+        }
+        if (p_index->cnt >= FILE_TLV_INDEX_MAX_ENTRIES)
+        {
+            return -1;
+        }
+        file_tlv_index_entry_t* const p_entry = &p_index->entries[p_index->cnt];
+
+        p_entry->type = type;
+        p_entry->len  = len;
+        p_entry->off  = off;
+        p_index->cnt += 1;
+    }
+    /* 1 means that all the TLVs have been collected */
+    return (1 == rc) ? 0 : -1;
+}
@@ -8,30 +8,70 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <bootutil/image.h>
-#include <zephyr/fs/fs.h>
+#include "file_img_reader.h"
 #include "zephyr_api.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Max number of TLVs (protected and unprotected) in the TLV index of an image */
+#define FILE_TLV_INDEX_MAX_ENTRIES 16
+
+typedef struct file_tlv_index_entry_t
+{
+    uint16_t type;
+    uint16_t len;
+    uint32_t off; /* Offset of the TLV's payload, the TLV is protected if it is before prot_end */
+} file_tlv_index_entry_t;
+
+/**
+ * TLVs of an image collected by one walk through its TLV area,
+ * so that the following lookups don't read the TLV headers from the file again.
+ */
+typedef struct file_tlv_index_t
+{
+    uint32_t               tlv_start; /* Offset of the TLV area (BOOT_TLV_OFF) */
+    uint16_t               prot_size; /* ih_protect_tlv_size of the indexed image */
+    uint32_t               prot_end;
+    uint32_t               tlv_end;
+    uint32_t               cnt;
+    file_tlv_index_entry_t entries[FILE_TLV_INDEX_MAX_ENTRIES];
+} file_tlv_index_t;
+
 typedef struct file_tlv_iter_t
 {
     const struct image_header* hdr;
-    struct fs_file_t*          p_file;
+    file_img_reader_t*         p_reader;
     uint16_t                   type;
     bool                       prot;
     uint32_t                   prot_end;
     uint32_t                   tlv_off;
     uint32_t                   tlv_end;
+    const file_tlv_index_t*    p_index; /* TLV index of the image, NULL if the TLVs are read from the file */
+    uint32_t                   idx;     /* Next entry of the TLV index */
 } file_tlv_iter_t;
 
+/*
+ * Walk through the TLV area of the image once and collect all the TLVs.
+ * The index is used by the iterators of the image after it is attached to the reader
+ * with file_img_reader_set_tlv_index().
+ *
+ * @returns 0 on success
+ *          -1 on errors or if the image has more than FILE_TLV_INDEX_MAX_ENTRIES TLVs
+ */
+zephyr_api_ret_t
+file_tlv_index_build(
+    file_tlv_index_t* const          p_index,
+    const struct image_header* const hdr,
+    file_img_reader_t* const         p_reader);
+
 /*
  * Initialize a TLV iterator.
  *
  * @param it An iterator struct
  * @param hdr image_header of the slot's image
- * @param p_file fs_file_t of the opened file which is storing the image
+ * @param p_reader reader of the opened file which is storing the image
  * @param type Type of TLV to look for
  * @param prot true if TLV has to be stored in the protected area, false otherwise
  *
@@ -42,7 +82,7 @@ zephyr_api_ret_t
 file_tlv_iter_begin(
     file_tlv_iter_t* const           it,
     const struct image_header* const hdr,
-    struct fs_file_t* const          p_file,
+    file_img_reader_t* const         p_reader,
     const uint16_t                   type,
     const bool                       prot);
 
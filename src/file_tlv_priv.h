@@ -32,7 +32,7 @@
 
 #include "sysflash/sysflash.h"
 
-#include <zephyr/fs/fs.h>
+#include "file_img_reader.h"
 #include <flash_map_backend/flash_map_backend.h>
 
 #include "bootutil/bootutil.h"
@@ -428,23 +428,13 @@ bootsim_get_ram_info(void);
 #define IMAGE_RAM_BASE ((uintptr_t)0)
 
 static inline zephyr_api_ret_t
-load_image_data(struct fs_file_t* const p_file, uint32_t start, uint8_t* output, uint32_t size)
+load_image_data(file_img_reader_t* const p_reader, uint32_t start, uint8_t* output, uint32_t size)
 {
-    zephyr_api_ret_t rc = fs_seek(p_file, start, FS_SEEK_SET);
-    if (rc < 0)
-    {
-        return rc;
-    }
-    rc = fs_read(p_file, output, size);
-    if (rc != size)
-    {
-        return -1;
-    }
-    return 0;
+    return file_img_reader_read(p_reader, start, output, size);
 }
 
-#define LOAD_IMAGE_DATA(hdr, p_file, start, output, size) /* NOSONAR */ \
-    (load_image_data((p_file), (start), (output), (size)))
+#define LOAD_IMAGE_DATA(hdr, p_reader, start, output, size) /* NOSONAR */ \
+    (load_image_data((p_reader), (start), (output), (size)))
 #endif /* MCUBOOT_RAM_LOAD */
 
 uint32_t
@@ -3,10 +3,11 @@
  */
 
 #include "fw_img_hw_rev.h"
-#include <zephyr/fs/fs.h>
+#include <string.h>
 #include <zephyr/storage/flash_map.h>
 #include <bootutil/bootutil_public.h>
 #include <zephyr/logging/log.h>
+#include "file_tlv.h"
 #include "zephyr_api.h"
 
 LOG_MODULE_DECLARE(mcuboot, CONFIG_MCUBOOT_LOG_LEVEL);
@@ -63,42 +64,6 @@ find_tlvs_in_flash_area(
     return true;
 }
 
-static bool
-find_tlvs_in_file(
-    struct fs_file_t* const p_file,
-    const uint16_t          magic,
-    size_t                  start_offset,
-    size_t* const           p_tlvs_start_off,
-    size_t* const           p_tlvs_end_off)
-{
-    struct image_tlv_info tlv_info = { 0 };
-
-    zephyr_api_ret_t rc = fs_seek(p_file, start_offset, FS_SEEK_SET);
-    if (0 != rc)
-    {
-        LOG_ERR("Failed to seek to the beginning of the image TLVs, rc=%d", rc);
-        return false;
-    }
-    rc = fs_read(p_file, &tlv_info, sizeof(tlv_info));
-    if (rc < 0)
-    {
-        LOG_ERR("Failed to read TLV info, rc=%d", rc);
-        return false;
-    }
-
-    if (tlv_info.it_magic != magic)
-    {
-        /* No TLVs. */
-        LOG_ERR("TLVs with magic 0x%04x not found", magic);
-        return false;
-    }
-
-    *p_tlvs_start_off = start_offset + sizeof(tlv_info);
-    *p_tlvs_end_off   = *p_tlvs_start_off + tlv_info.it_tlv_tot;
-
-    return true;
-}
-
 static bool
 fw_img_hw_rev_handle_tlv_hw_rev_in_flash_area(
     const struct image_tlv* const p_tlv,
@@ -258,7 +223,8 @@ fw_img_hw_rev_find_in_flash_area(const fa_id_t fa_id, fw_image_hw_rev_t* const p
 static bool
 fw_img_hw_rev_handle_tlv_hw_rev_in_file(
     const struct image_tlv* const p_tlv,
-    struct fs_file_t* const       p_file,
+    file_img_reader_t* const      p_reader,
+    const size_t                  data_off,
     fw_image_hw_rev_t* const      p_hw_rev)
 {
     if (IMAGE_TLV_RUUVI_HW_REV_ID == p_tlv->it_type)
@@ -279,8 +245,8 @@ fw_img_hw_rev_handle_tlv_hw_rev_in_file(
 
         uint8_t buf[sizeof(p_hw_rev->hw_rev_num)] = { 0 };
 
-        const zephyr_api_ret_t rc = fs_read(p_file, buf, sizeof(buf));
-        if (rc < 0)
+        const zephyr_api_ret_t rc = file_img_reader_read(p_reader, data_off, buf, sizeof(buf));
+        if (0 != rc)
         {
             LOG_ERR("Failed to read TLV, rc=%d", rc);
             return false;
@@ -303,8 +269,8 @@ fw_img_hw_rev_handle_tlv_hw_rev_in_file(
             LOG_ERR("Duplicate Ruuvi HW revision name TLV");
             return false;
         }
-        const zephyr_api_ret_t rc = fs_read(p_file, p_hw_rev->hw_rev_name, p_tlv->it_len);
-        if (rc < 0)
+        const zephyr_api_ret_t rc = file_img_reader_read(p_reader, data_off, p_hw_rev->hw_rev_name, p_tlv->it_len);
+        if (0 != rc)
         {
             LOG_ERR("Failed to read TLV, rc=%d", rc);
             return false;
@@ -316,66 +282,113 @@ fw_img_hw_rev_handle_tlv_hw_rev_in_file(
 }
 
 bool
-fw_img_hw_rev_find_in_file(struct fs_file_t* const p_file, fw_image_hw_rev_t* const p_hw_rev)
+fw_img_hw_rev_find_in_file(file_img_reader_t* const p_reader, fw_image_hw_rev_t* const p_hw_rev)
 {
     p_hw_rev->hw_rev_num     = 0;
     p_hw_rev->hw_rev_name[0] = '\0';
 
     struct image_header img_hdr = { 0 };
-    zephyr_api_ret_t    rc      = fs_seek(p_file, 0, FS_SEEK_SET);
+    zephyr_api_ret_t    rc      = file_img_reader_read(p_reader, 0, (void*)&img_hdr, sizeof(img_hdr));
     if (0 != rc)
     {
-        LOG_ERR("Failed to seek to the beginning of the file, rc=%d", rc);
-        return false;
-    }
-    ssize_t len = fs_read(p_file, (void*)&img_hdr, sizeof(img_hdr));
-    if (len < 0)
-    {
-        LOG_ERR("Failed reading image header, rc=%zd", len);
+        LOG_ERR("Failed reading image header, rc=%d", rc);
         return false;
     }
-    if (len != sizeof(img_hdr))
+
+    /* Look for the HW revision in the protected TLVs, the TLV index of the image is used if it is attached */
+    file_tlv_iter_t it = { 0 };
+    rc                 = file_tlv_iter_begin(&it, &img_hdr, p_reader, IMAGE_TLV_ANY, true);
+    if (0 != rc)
     {
-        LOG_ERR("Failed reading image header, len=%zd, expected len=%zu", len, sizeof(img_hdr));
+        LOG_ERR("Failed to find TLV area, rc=%d", rc);
         return false;
     }
 
-    /* Read the image's TLVs. Try to find the protected TLVs. */
-    size_t tlvs_start_off = 0;
-    size_t tlvs_end_off   = 0;
-    if (!find_tlvs_in_file(
-            p_file,
-            IMAGE_TLV_PROT_INFO_MAGIC,
-            img_hdr.ih_hdr_size + img_hdr.ih_img_size,
-            &tlvs_start_off,
-            &tlvs_end_off))
+    uint32_t data_off = 0;
+    uint16_t len      = 0;
+    uint16_t type     = 0;
+    while (0 == file_tlv_iter_next(&it, &data_off, &len, &type))
     {
-        return false;
-    }
+        const struct image_tlv tlv = { .it_type = type, .it_len = len };
+        if (!fw_img_hw_rev_handle_tlv_hw_rev_in_file(&tlv, p_reader, data_off, p_hw_rev))
+        {
+            return false;
+        }
 
-    size_t data_off = tlvs_start_off;
+        if (('\0' != p_hw_rev->hw_rev_name[0]) && (0 != p_hw_rev->hw_rev_num))
+        {
+            LOG_DBG(
+                "Found Ruuvi HW revision TLVs: ID=%" PRIu32 ", name='%s'",
+                p_hw_rev->hw_rev_num,
+                p_hw_rev->hw_rev_name);
+            return true;
+        }
+    }
+    LOG_ERR("Ruuvi HW revision TLVs not found");
+    return false;
+}
 
-    struct image_tlv tlv = { 0 };
-    while ((data_off + sizeof(tlv)) <= tlvs_end_off)
+static bool
+fw_img_hw_rev_handle_tlv_hw_rev_in_buf(
+    const struct image_tlv* const p_tlv,
+    const uint8_t* const          p_data,
+    fw_image_hw_rev_t* const      p_hw_rev)
+{
+    if (IMAGE_TLV_RUUVI_HW_REV_ID == p_tlv->it_type)
     {
-        rc = fs_seek(p_file, data_off, FS_SEEK_SET);
-        if (0 != rc)
+        if ((p_tlv->it_len != sizeof(p_hw_rev->hw_rev_num)) || (0 != p_hw_rev->hw_rev_num))
         {
-            LOG_ERR("Failed to seek to %zu, rc=%d", data_off, rc);
+            LOG_ERR("Invalid or duplicate Ruuvi HW revision ID TLV, len=%u", p_tlv->it_len);
             return false;
         }
-        rc = fs_read(p_file, &tlv, sizeof(tlv));
-        if (rc < 0)
+        p_hw_rev->hw_rev_num = u32_from_bytes_be(p_data);
+    }
+    if (IMAGE_TLV_RUUVI_HW_REV_NAME == p_tlv->it_type)
+    {
+        if ((p_tlv->it_len >= sizeof(p_hw_rev->hw_rev_name)) || ('\0' != p_hw_rev->hw_rev_name[0]))
         {
-            LOG_ERR("Failed to read TLV, rc=%d", rc);
+            LOG_ERR("Invalid or duplicate Ruuvi HW revision name TLV, len=%u", p_tlv->it_len);
             return false;
         }
+        memcpy(p_hw_rev->hw_rev_name, p_data, p_tlv->it_len);
+        p_hw_rev->hw_rev_name[p_tlv->it_len] = '\0';
+    }
+    return true;
+}
+
+bool
+fw_img_hw_rev_find_in_buf(const uint8_t* const p_prot_tlvs, const size_t size, fw_image_hw_rev_t* const p_hw_rev)
+{
+    p_hw_rev->hw_rev_num     = 0;
+    p_hw_rev->hw_rev_name[0] = '\0';
 
-        if (!fw_img_hw_rev_handle_tlv_hw_rev_in_file(&tlv, p_file, p_hw_rev))
+    struct image_tlv_info tlv_info = { 0 };
+    if (size < sizeof(tlv_info))
+    {
+        LOG_ERR("Protected TLVs not found");
+        return false;
+    }
+    memcpy(&tlv_info, p_prot_tlvs, sizeof(tlv_info));
+    if ((IMAGE_TLV_PROT_INFO_MAGIC != tlv_info.it_magic) || (tlv_info.it_tlv_tot > size))
+    {
+        LOG_ERR("Invalid protected TLV info: magic=0x%04x, size=%u", tlv_info.it_magic, tlv_info.it_tlv_tot);
+        return false;
+    }
+
+    size_t           data_off = sizeof(tlv_info);
+    struct image_tlv tlv      = { 0 };
+    while ((data_off + sizeof(tlv)) <= tlv_info.it_tlv_tot)
+    {
+        memcpy(&tlv, &p_prot_tlvs[data_off], sizeof(tlv));
+        if ((data_off + sizeof(tlv) + tlv.it_len) > tlv_info.it_tlv_tot)
+        {
+            LOG_ERR("TLV at offset %zu exceeds the protected TLV area", data_off);
+            return false;
+        }
+        if (!fw_img_hw_rev_handle_tlv_hw_rev_in_buf(&tlv, &p_prot_tlvs[data_off + sizeof(tlv)], p_hw_rev))
         {
             return false;
         }
-
         if (('\0' != p_hw_rev->hw_rev_name[0]) && (0 != p_hw_rev->hw_rev_num))
         {
             LOG_DBG(
@@ -384,7 +397,6 @@ fw_img_hw_rev_find_in_file(struct fs_file_t* const p_file, fw_image_hw_rev_t* co
                 p_hw_rev->hw_rev_name);
             return true;
         }
-
         data_off += sizeof(tlv) + tlv.it_len;
     }
     LOG_ERR("Ruuvi HW revision TLVs not found");
@@ -8,9 +8,9 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
-#include <zephyr/fs/fs.h>
 #include "ruuvi_image_tlv.h"
 #include "ruuvi_fa_id.h"
+#include "file_img_reader.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -28,7 +28,13 @@ bool
 fw_img_hw_rev_find_in_flash_area(const fa_id_t fa_id, fw_image_hw_rev_t* const p_hw_rev);
 
 bool
-fw_img_hw_rev_find_in_file(struct fs_file_t* const p_file, fw_image_hw_rev_t* const p_hw_rev);
+fw_img_hw_rev_find_in_file(file_img_reader_t* const p_reader, fw_image_hw_rev_t* const p_hw_rev);
+
+/**
+ * Find the Ruuvi HW revision TLVs in the protected TLV area (starting with struct image_tlv_info) loaded into RAM.
+ */
+bool
+fw_img_hw_rev_find_in_buf(const uint8_t* const p_prot_tlvs, const size_t size, fw_image_hw_rev_t* const p_hw_rev);
 
 #ifdef __cplusplus
 }
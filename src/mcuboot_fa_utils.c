@@ -4,6 +4,8 @@
 
 #include "mcuboot_fa_utils.h"
 #include <stddef.h>
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
 #include <zephyr/storage/flash_map.h>
 #include <zephyr/logging/log.h>
 #include <sysflash/pm_sysflash.h>
@@ -86,3 +88,69 @@ load_image_header(const fa_id_t fa_id, struct image_header* const p_img_hdr)
     flash_area_close(p_fa);
     return true;
 }
+
+bool
+is_flash_area_memory_mapped(const struct flash_area* const p_fa)
+{
+    return flash_area_get_device(p_fa) == DEVICE_DT_GET(DT_CHOSEN(zephyr_flash_controller));
+}
+
+bool
+find_image_tlv_in_flash_area(
+    const struct flash_area* const   p_fa,
+    const struct image_header* const p_hdr,
+    const uint16_t                   tlv_type,
+    uint32_t* const                  p_tlv_off,
+    uint16_t* const                  p_tlv_len)
+{
+    const uint32_t        info_off = (uint32_t)p_hdr->ih_hdr_size + p_hdr->ih_img_size + p_hdr->ih_protect_tlv_size;
+    struct image_tlv_info info     = { 0 };
+    if ((0 != flash_area_read(p_fa, info_off, &info, sizeof(info))) || (IMAGE_TLV_INFO_MAGIC != info.it_magic))
+    {
+        return false;
+    }
+    const uint32_t tlv_end = info_off + info.it_tlv_tot;
+    if (tlv_end > flash_area_get_size(p_fa))
+    {
+        return false;
+    }
+    uint32_t off = info_off + (uint32_t)sizeof(info);
+    while ((off + sizeof(struct image_tlv)) <= tlv_end)
+    {
+        struct image_tlv tlv = { 0 };
+        if (0 != flash_area_read(p_fa, off, &tlv, sizeof(tlv)))
+        {
+            return false;
+        }
+        off += (uint32_t)sizeof(tlv);
+        if ((tlv_type == tlv.it_type) && ((off + tlv.it_len) <= tlv_end))
+        {
+            *p_tlv_off = off;
+            *p_tlv_len = tlv.it_len;
+            return true;
+        }
+        off += tlv.it_len;
+    }
+    return false;
+}
+
+bool
+load_image_hash_tlv(const fa_id_t fa_id, const uint16_t tlv_type, uint8_t* const p_hash)
+{
+    const struct flash_area* p_fa = NULL;
+    if (0 != flash_area_open(fa_id, &p_fa))
+    {
+        return false;
+    }
+    struct image_header img_hdr  = { 0 };
+    uint32_t            tlv_off  = 0;
+    uint16_t            tlv_len  = 0;
+    bool                is_found = false;
+    if ((0 == boot_image_load_header(p_fa, &img_hdr))
+        && find_image_tlv_in_flash_area(p_fa, &img_hdr, tlv_type, &tlv_off, &tlv_len) && (IMAGE_HASH_SIZE == tlv_len))
+    {
+        is_found = (0 == flash_area_read(p_fa, tlv_off, p_hash, IMAGE_HASH_SIZE));
+    }
+    flash_area_close(p_fa);
+    return is_found;
+}
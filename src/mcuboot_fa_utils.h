@@ -10,6 +10,8 @@
 #include "ruuvi_fa_id.h"
 #include "bootutil/image.h"
 
+struct flash_area;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -25,6 +27,34 @@ get_image_slot_name(const fa_id_t fa_id);
 bool
 load_image_header(const fa_id_t fa_id, struct image_header* const p_img_hdr);
 
+/**
+ * Check if the flash area is in the internal flash, which is memory-mapped at CONFIG_FLASH_BASE_ADDRESS.
+ * The content of other flash areas (e.g. in the external flash) must be read with flash_area_read().
+ */
+bool
+is_flash_area_memory_mapped(const struct flash_area* const p_fa);
+
+/**
+ * Find the TLV of the given type in the unprotected TLV area of the image in the flash area.
+ * @param p_tlv_off Pointer to store the offset of the TLV value in the flash area.
+ * @param p_tlv_len Pointer to store the length of the TLV value.
+ * @return true if the TLV is found.
+ */
+bool
+find_image_tlv_in_flash_area(
+    const struct flash_area* const   p_fa,
+    const struct image_header* const p_hdr,
+    const uint16_t                   tlv_type,
+    uint32_t* const                  p_tlv_off,
+    uint16_t* const                  p_tlv_len);
+
+/**
+ * Read the hash TLV of the given type (IMAGE_HASH_SIZE bytes) of the image in the flash area,
+ * without hashing the image.
+ */
+bool
+load_image_hash_tlv(const fa_id_t fa_id, const uint16_t tlv_type, uint8_t* const p_hash);
+
 #ifdef __cplusplus
 }
 #endif
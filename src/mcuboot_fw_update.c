@@ -3,6 +3,7 @@
  */
 
 #include "mcuboot_fw_update.h"
+#include <errno.h>
 #include <zephyr/kernel.h>
 #include <zephyr/devicetree.h>
 #include <zephyr/linker/devicetree_regions.h>
@@ -14,21 +15,83 @@
 #include <fw_info.h>
 #include <bootutil/bootutil.h>
 #include <bootutil/fault_injection_hardening.h>
+#include <bootutil/crypto/sha.h>
 #include <bl_validation.h>
 #include "file_img_validate.h"
+#include "file_img_reader.h"
+#include "file_img_inspect.h"
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_BUNDLE)
+#include "file_img_bundle.h"
+#endif
 #include "btldr_fs.h"
 #include "ruuvi_fw_update.h"
 #include "mcuboot_fa_utils.h"
 #include "mcuboot_img_op.h"
+#include "mcuboot_img_measure.h"
+#include "mcuboot_img_stats.h"
+#include "mcuboot_img_verdict.h"
+#include "file_tlv.h"
 #include "file_tlv_priv.h"
 #include "zephyr_api.h"
 
 LOG_MODULE_DECLARE(mcuboot, CONFIG_MCUBOOT_LOG_LEVEL);
 
-#define MCUBOOT_HOOK_TMPBUF_SZ 256
+/* The validation buffer is also the read-ahead window of the file reader,
+ * so it is not smaller than the LittleFS cache, which is filled by one read anyway */
+#define MCUBOOT_HOOK_TMPBUF_SZ MAX(256, CONFIG_FS_LITTLEFS_CACHE_SIZE)
 
 #define SHARED_NODE DT_NODELABEL(shared_sram)
 
+/**
+ * Results of the MCUboot validation of the image in an update file.
+ */
+typedef struct file_img_validation_t
+{
+    bool           is_valid; /* The image has been validated, so the hash and the extent are known */
+    uint8_t        hash[IMAGE_HASH_SIZE];
+    uint32_t       extent;           /* Size of the header, the image and all the TLVs */
+    bool           is_fw_info_found; /* fw_info has been captured while the image was validated */
+    struct fw_info fw_info;
+} file_img_validation_t;
+
+/**
+ * Stages of the check of an update file, ordered from the cheapest one.
+ * Every stage before the signature one reads only a few bytes of the file, so a file which is not installable
+ * is rejected without hashing the image.
+ */
+typedef enum file_gate_stage_e
+{
+    FILE_GATE_STAGE_HEADER,    /* Image header of the file */
+    FILE_GATE_STAGE_BOUNDS,    /* Image size and reset vector against the destination slot */
+    FILE_GATE_STAGE_HW_REV,    /* Ruuvi HW revision TLV */
+    FILE_GATE_STAGE_FW_INFO,   /* fw_info version against the one in the destination slot */
+    FILE_GATE_STAGE_DOWNGRADE, /* Image version against the one in the destination slot */
+    FILE_GATE_STAGE_SIGNATURE, /* Hash and signature of the image */
+    FILE_GATE_STAGE_NUM,
+} file_gate_stage_e;
+
+static const char* const g_file_gate_stage_names[FILE_GATE_STAGE_NUM] = {
+    [FILE_GATE_STAGE_HEADER]    = "header",
+    [FILE_GATE_STAGE_BOUNDS]    = "bounds",
+    [FILE_GATE_STAGE_HW_REV]    = "hw_rev",
+    [FILE_GATE_STAGE_FW_INFO]   = "fw_info",
+    [FILE_GATE_STAGE_DOWNGRADE] = "downgrade",
+    [FILE_GATE_STAGE_SIGNATURE] = "signature",
+};
+
+static uint32_t g_file_gate_reject_cnt[FILE_GATE_STAGE_NUM];
+
+typedef enum file_gate_res_e
+{
+    FILE_GATE_RES_PASSED,   /* The file may be installable, its signature has to be checked */
+    FILE_GATE_RES_REJECTED, /* The file can't be installed and has to be removed */
+    FILE_GATE_RES_IO_ERROR, /* The file could not be read, it is kept to retry the update */
+} file_gate_res_e;
+
+/* The validation buffer and the TLV index are shared by the cheap checks and the validation of a file */
+static uint8_t          g_file_tmp_buf[MCUBOOT_HOOK_TMPBUF_SZ];
+static file_tlv_index_t g_file_tlv_index;
+
 _Static_assert(PM_S0_SIZE == PM_S1_SIZE, "PM_S0_SIZE must be equal to PM_S1_SIZE");
 _Static_assert(
     PM_S0_SIZE == DT_REG_SIZE(DT_NODELABEL(shared_sram)),
@@ -40,6 +103,20 @@ _Static_assert(
 static __aligned(4) __attribute__((used)) uint8_t g_shared_img_buf[MAX(PM_S0_SIZE, PM_S1_SIZE)] Z_GENERIC_SECTION(
     LINKER_DT_NODE_REGION_NAME(SHARED_NODE));
 
+#if defined(CONFIG_RUUVI_MCUBOOT_INSTALL_FROM_SHARED_SRAM)
+/**
+ * Image which has been read from the update file into g_shared_img_buf and validated by B0.
+ */
+typedef struct shared_img_t
+{
+    file_img_loc_t loc;
+    fa_id_t        dst_fa_id;
+    uint32_t       size; /* 0 if g_shared_img_buf does not contain a validated image */
+} shared_img_t;
+
+static shared_img_t g_shared_img;
+#endif
+
 static __NO_RETURN void
 reboot_cold(void)
 {
@@ -75,97 +152,134 @@ img_invalidate(const fa_id_t fa_id)
     return true;
 }
 
+/**
+ * Read the image from the update file into g_shared_img_buf.
+ */
 static bool
-validate_b0_signature(const char* const p_file_name, const uint32_t dst_fa_addr, const uint32_t dst_fa_size)
+load_shared_img_buf(
+    const file_img_loc_t* const p_loc,
+    const fa_id_t               dst_fa_id,
+    const uint32_t              dst_fa_size,
+    uint32_t* const             p_file_size)
 {
+#if defined(CONFIG_RUUVI_MCUBOOT_INSTALL_FROM_SHARED_SRAM)
+    g_shared_img.size = 0;
+#endif
     if (dst_fa_size != sizeof(g_shared_img_buf))
     {
         LOG_ERR("%s: Invalid flash area size %u, expected %zu", __func__, dst_fa_size, sizeof(g_shared_img_buf));
         return false;
     }
 
-    struct fs_file_t file = btldr_fs_open_file(p_file_name);
-    if (NULL == file.filep)
+    file_img_reader_t reader = { 0 };
+    if (!file_img_reader_open(&reader, p_loc, dst_fa_id))
     {
         return false;
     }
 
-    const off_t file_size = btldr_fs_get_file_size(&file);
+    const uint32_t file_size = file_img_reader_get_size(&reader);
     if (file_size > sizeof(g_shared_img_buf))
     {
         LOG_ERR(
             "%s: File size %" PRIu32 " is too big for buffer, max size=%zu",
             __func__,
-            (uint32_t)file_size,
+            file_size,
             sizeof(g_shared_img_buf));
-        fs_close(&file);
+        file_img_reader_close(&reader);
         return false;
     }
-    ssize_t rc = fs_read(&file, g_shared_img_buf, file_size);
-    if (rc < 0)
+    const zephyr_api_ret_t rc = file_img_reader_read(&reader, 0, g_shared_img_buf, file_size);
+    file_img_reader_close(&reader);
+    if (0 != rc)
     {
-        LOG_ERR("%s: Failed to read file, rc=%zd", __func__, rc);
-        fs_close(&file);
+        LOG_ERR("%s: Failed to read file, rc=%d", __func__, rc);
         return false;
     }
-    if (rc != file_size)
+    *p_file_size = file_size;
+    return true;
+}
+
+static bool
+validate_b0_signature(
+    const file_img_loc_t* const p_loc,
+    const fa_id_t               dst_fa_id,
+    const uint32_t              dst_fa_addr,
+    const uint32_t              dst_fa_size,
+    uint32_t* const             p_file_size)
+{
+    uint32_t file_size = 0;
+    if (!load_shared_img_buf(p_loc, dst_fa_id, dst_fa_size, &file_size))
     {
-        LOG_ERR(
-            "%s: Failed to read file, read %u bytes, expected %u bytes",
-            __func__,
-            (unsigned)rc,
-            (unsigned)file_size);
-        fs_close(&file);
         return false;
     }
 
     const struct fw_info* const p_fw_info = fw_info_find((uint32_t)g_shared_img_buf);
     if (NULL == p_fw_info)
     {
-        LOG_ERR("%s: Failed to find fw_info in file %s", __func__, p_file_name);
-        fs_close(&file);
+        LOG_ERR("%s: Failed to find fw_info in file %s", __func__, p_loc->p_file_name);
         return false;
     }
     const uint32_t addr_offset = p_fw_info->address - dst_fa_addr;
     if (addr_offset >= sizeof(g_shared_img_buf))
     {
         LOG_ERR("%s: Invalid address offset 0x%08x", __func__, addr_offset);
-        fs_close(&file);
         return false;
     }
     if (!bl_validate_firmware(p_fw_info->address, (uint32_t)&g_shared_img_buf[addr_offset]))
     {
-        LOG_ERR("%s: Failed to validate firmware in file %s", __func__, p_file_name);
-        fs_close(&file);
+        LOG_ERR("%s: Failed to validate firmware in file %s", __func__, p_loc->p_file_name);
         return false;
     }
-    fs_close(&file);
+#if defined(CONFIG_RUUVI_MCUBOOT_INSTALL_FROM_SHARED_SRAM)
+    g_shared_img.loc       = *p_loc;
+    g_shared_img.dst_fa_id = dst_fa_id;
+    g_shared_img.size      = file_size;
+#endif
+    if (NULL != p_file_size)
+    {
+        *p_file_size = file_size;
+    }
     return true;
 }
 
+#if defined(CONFIG_RUUVI_MCUBOOT_INSTALL_FROM_SHARED_SRAM)
 static bool
-load_image_header_from_file(
-    struct fs_file_t* const    p_file,
-    const char* const          p_file_name,
-    struct image_header* const p_img_hdr,
-    uint32_t* const            p_img_size)
+is_shared_img_loaded(const file_img_loc_t* const p_loc, const fa_id_t dst_fa_id)
 {
-    const ssize_t len = fs_read(p_file, p_img_hdr, sizeof(*p_img_hdr));
-    if (len < 0)
-    {
-        LOG_ERR("Failed reading image header from file %s, rc=%zd", p_file_name, len);
-        return false;
-    }
-    if (len != sizeof(*p_img_hdr))
+    return (0 != g_shared_img.size) && (dst_fa_id == g_shared_img.dst_fa_id)
+           && (p_loc->offset == g_shared_img.loc.offset) && (p_loc->size == g_shared_img.loc.size)
+           && (0 == strcmp(p_loc->p_file_name, g_shared_img.loc.p_file_name));
+}
+#endif
+
+/**
+ * Open the reader of the image to be checked: the copy validated by B0 in g_shared_img_buf if there is one,
+ * so that the MCUboot validation and the checks which follow don't read the update file again,
+ * otherwise the update file.
+ */
+static bool
+open_reader_for_check(file_img_reader_t* const p_reader, const file_img_loc_t* const p_loc, const fa_id_t dst_fa_id)
+{
+#if defined(CONFIG_RUUVI_MCUBOOT_INSTALL_FROM_SHARED_SRAM)
+    if (is_shared_img_loaded(p_loc, dst_fa_id))
     {
-        LOG_ERR(
-            "Failed reading image header from file %s, len=%zd, expected len=%zu",
-            p_file_name,
-            len,
-            sizeof(*p_img_hdr));
-        return false;
+        file_img_reader_open_ram(p_reader, g_shared_img_buf, g_shared_img.size);
+        return true;
     }
+#endif
+    return file_img_reader_open(p_reader, p_loc, dst_fa_id);
+}
 
+/**
+ * Check the image header which has been read from the file and get the size of the image without the TLVs.
+ */
+static bool
+check_image_header_from_file(
+    file_img_reader_t* const         p_reader,
+    const char* const                p_file_name,
+    const struct image_header* const p_img_hdr,
+    uint32_t* const                  p_img_size)
+{
     if (p_img_hdr->ih_magic != IMAGE_MAGIC)
     {
         LOG_ERR("Bad image magic in file %s: 0x%08" PRIx32, p_file_name, p_img_hdr->ih_magic);
@@ -188,67 +302,173 @@ load_image_header_from_file(
         return false;
     }
 
-    const off_t file_size = btldr_fs_get_file_size(p_file);
+    const uint32_t file_size = file_img_reader_get_size(p_reader);
     if (*p_img_size > file_size)
     {
         LOG_ERR(
             "Image size in file %s is bigger than the file, file_size=%" PRIu32 ", image size=%" PRIu32,
             p_file_name,
-            (uint32_t)file_size,
+            file_size,
             *p_img_size);
         return false;
     }
     return true;
 }
 
-static struct fs_file_t
-open_file_and_load_image_header(
+static bool
+load_image_header_from_file(
+    file_img_reader_t* const   p_reader,
     const char* const          p_file_name,
     struct image_header* const p_img_hdr,
     uint32_t* const            p_img_size)
 {
-    struct fs_file_t file = btldr_fs_open_file(p_file_name);
-    if (NULL == file.filep)
+    const zephyr_api_ret_t rc = file_img_reader_read(p_reader, 0, p_img_hdr, sizeof(*p_img_hdr));
+    if (0 != rc)
+    {
+        LOG_ERR("Failed reading image header from file %s, rc=%d", p_file_name, rc);
+        return false;
+    }
+    return check_image_header_from_file(p_reader, p_file_name, p_img_hdr, p_img_size);
+}
+
+/**
+ * Attach the read-ahead window and the TLV index to the reader of the file.
+ * The TLV area is walked once, the checks and the lookups which follow use the index.
+ */
+static void
+file_reader_prepare(
+    file_img_reader_t* const         p_reader,
+    const char* const                p_file_name,
+    const struct image_header* const p_img_hdr)
+{
+    file_img_reader_set_read_ahead(p_reader, g_file_tmp_buf, sizeof(g_file_tmp_buf));
+    if (0 == file_tlv_index_build(&g_file_tlv_index, p_img_hdr, p_reader))
+    {
+        file_img_reader_set_tlv_index(p_reader, &g_file_tlv_index);
+    }
+    else
+    {
+        LOG_WRN("Failed to index TLVs in file %s, the TLV area is walked for every lookup", p_file_name);
+    }
+}
+
+static bool
+open_file_and_load_image_header(
+    file_img_reader_t* const    p_reader,
+    const file_img_loc_t* const p_loc,
+    const fa_id_t               dst_fa_id,
+    struct image_header* const  p_img_hdr,
+    uint32_t* const             p_img_size)
+{
+    if (!open_reader_for_check(p_reader, p_loc, dst_fa_id))
+    {
+        return false;
+    }
+    if (!load_image_header_from_file(p_reader, p_loc->p_file_name, p_img_hdr, p_img_size))
+    {
+        file_img_reader_close(p_reader);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Check that the reset vector of the image points into the destination slot.
+ * The reset vector is read from the file if the inspector is NULL or has not captured it.
+ */
+static bool
+check_reset_addr(
+    file_img_reader_t* const         p_reader,
+    const file_img_inspect_t* const  p_inspect,
+    const struct image_header* const p_img_hdr,
+    const char* const                p_file_name,
+    const uint32_t                   dst_fa_addr,
+    const uint32_t                   dst_fa_size)
+{
+    uint32_t reset_addr = 0;
+    if ((NULL == p_inspect) || (!file_img_inspect_get_reset_addr(p_inspect, &reset_addr)))
     {
-        return file;
+        const zephyr_api_ret_t rc = file_img_reader_read(
+            p_reader,
+            p_img_hdr->ih_hdr_size + sizeof(uint32_t),
+            &reset_addr,
+            sizeof(reset_addr));
+        if (0 != rc)
+        {
+            LOG_ERR("Failed to read reset address from file %s, rc=%d", p_file_name, rc);
+            return false;
+        }
     }
-    if (!load_image_header_from_file(&file, p_file_name, p_img_hdr, p_img_size))
+    if (!((reset_addr >= dst_fa_addr) && (reset_addr < (dst_fa_addr + dst_fa_size))))
     {
-        btldr_fs_close_file(&file);
-        file.filep = NULL;
+        LOG_ERR(
+            "Reset address 0x%08" PRIx32 " is out of flash area 0x%08" PRIx32 " .. 0x%08" PRIx32,
+            reset_addr,
+            dst_fa_addr,
+            dst_fa_addr + dst_fa_size);
+        return false;
     }
-    return file;
+    return true;
 }
 
+static bool
+find_hw_rev(
+    file_img_reader_t* const        p_reader,
+    const file_img_inspect_t* const p_inspect,
+    fw_image_hw_rev_t* const        p_hw_rev)
+{
+    bool is_found = false;
+    if ((NULL != p_inspect) && file_img_inspect_find_hw_rev(p_inspect, p_hw_rev, &is_found))
+    {
+        return is_found;
+    }
+    return fw_img_hw_rev_find_in_file(p_reader, p_hw_rev);
+}
+
+/**
+ * Validate the image in the update file with MCUboot keys.
+ * The reset vector, the HW revision TLVs and fw_info are captured while the image is hashed,
+ * so the file is read sequentially once, and only the unprotected TLVs are read again.
+ */
 static bool
 validate_file(
-    const char* const          p_file_name,
-    const uint32_t             dst_fa_addr,
-    const uint32_t             dst_fa_size,
-    struct image_header* const p_img_hdr,
-    fw_image_hw_rev_t* const   p_hw_rev)
+    const file_img_loc_t* const  p_loc,
+    const fa_id_t                dst_fa_id,
+    const uint32_t               dst_fa_addr,
+    const uint32_t               dst_fa_size,
+    struct image_header* const   p_img_hdr,
+    fw_image_hw_rev_t* const     p_hw_rev,
+    file_img_validation_t* const p_validation)
 {
-    static uint8_t tmp_buf[MCUBOOT_HOOK_TMPBUF_SZ];
+    static file_img_inspect_t inspect;
 
-    if (!btldr_fs_is_file_exist(p_file_name))
+    if (!btldr_fs_is_file_exist(p_loc->p_file_name))
     {
         return false;
     }
+    if (NULL != p_validation)
+    {
+        p_validation->is_valid         = false;
+        p_validation->is_fw_info_found = false;
+    }
 
-    LOG_INF("Validate image in file %s", p_file_name);
+    LOG_INF("Validate image in file %s", p_loc->p_file_name);
 
+    file_img_reader_t   reader   = { 0 };
     struct image_header img_hdr  = { 0 };
     uint32_t            img_size = 0;
-    struct fs_file_t    file     = open_file_and_load_image_header(p_file_name, &img_hdr, &img_size);
-    if (NULL == file.filep)
+    if (!open_file_and_load_image_header(&reader, p_loc, dst_fa_id, &img_hdr, &img_size))
     {
-        LOG_ERR("Failed to load image header from file %s", p_file_name);
+        LOG_ERR("Failed to load image header from file %s", p_loc->p_file_name);
         return false;
     }
+    file_reader_prepare(&reader, p_loc->p_file_name, &img_hdr);
+    file_img_inspect_init(&inspect, &img_hdr);
+    file_img_reader_set_inspect(&reader, &inspect);
     if (img_size >= dst_fa_size)
     {
         LOG_ERR("Image size %" PRIu32 " is too big for flash area, max size=%" PRIu32, img_size, dst_fa_size);
-        fs_close(&file);
+        file_img_reader_close(&reader);
         return false;
     }
     if (NULL != p_img_hdr)
@@ -256,52 +476,67 @@ validate_file(
         *p_img_hdr = img_hdr;
     }
 
-    zephyr_api_ret_t rc = fs_seek(&file, img_hdr.ih_hdr_size + sizeof(uint32_t), FS_SEEK_SET);
-    if (0 != rc)
+    uint8_t img_hash[IMAGE_HASH_SIZE];
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_CHUNKED)
+    if (file_img_reader_is_chunk_verified(&reader) && (!file_img_reader_is_in_place(&reader)))
     {
-        LOG_ERR("Failed to seek to the beginning of the image data in file %s, rc=%d", p_file_name, rc);
-        fs_close(&file);
-        return false;
+        /* Every chunk read from the file, including the header and the TLVs, is checked against the signed
+         * chunk hash table, so the image is verified while it is copied instead of being hashed beforehand. */
+        if (0 != file_img_get_hash_tlv(&img_hdr, &reader, dst_fa_size, img_hash))
+        {
+            LOG_ERR("Failed to get image hash from file: %s", p_loc->p_file_name);
+            file_img_reader_close(&reader);
+            return false;
+        }
     }
-    uint32_t reset_addr = 0;
-    rc                  = fs_read(&file, &reset_addr, sizeof(reset_addr));
-    if (rc < 0)
+    else
+#endif
     {
-        LOG_ERR("Failed to read reset address from file %s, rc=%d", p_file_name, rc);
-        fs_close(&file);
-        return false;
+        FIH_DECLARE(validity_res, FIH_FAILURE);
+        FIH_CALL(
+            file_img_validate,
+            validity_res,
+            &img_hdr,
+            &reader,
+            dst_fa_size,
+            g_file_tmp_buf,
+            sizeof(g_file_tmp_buf),
+            NULL,
+            0,
+            img_hash);
+        if (FIH_NOT_EQ(validity_res, FIH_SUCCESS))
+        {
+            LOG_ERR("Validation failed for file: %s", p_loc->p_file_name);
+            file_img_reader_close(&reader);
+            return false;
+        }
     }
-    if (rc != sizeof(reset_addr))
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_PATCH)
+    /* The copy journal of a delta update is looked up by the image hash from the patch header */
+    if (!file_img_reader_check_img_hash(&reader, img_hash))
     {
-        LOG_ERR(
-            "Failed to read reset address from file %s, read %u bytes, expected %zu bytes",
-            p_file_name,
-            (unsigned)rc,
-            sizeof(reset_addr));
-        fs_close(&file);
+        file_img_reader_close(&reader);
         return false;
     }
-    if (!((reset_addr >= dst_fa_addr) && (reset_addr < (dst_fa_addr + dst_fa_size))))
+#endif
+    file_img_reader_set_inspect(&reader, NULL);
+
+    if (!check_reset_addr(&reader, &inspect, &img_hdr, p_loc->p_file_name, dst_fa_addr, dst_fa_size))
     {
-        LOG_ERR(
-            "Reset address 0x%08" PRIx32 " is out of flash area 0x%08" PRIx32 " .. 0x%08" PRIx32,
-            reset_addr,
-            dst_fa_addr,
-            dst_fa_addr + dst_fa_size);
-        fs_close(&file);
+        file_img_reader_close(&reader);
         return false;
     }
 
     fw_image_hw_rev_t hw_rev = { 0 };
-    if (!fw_img_hw_rev_find_in_file(&file, &hw_rev))
+    if (!find_hw_rev(&reader, &inspect, &hw_rev))
     {
-        LOG_WRN("Image in file %s: No Ruuvi HW revision TLVs found", p_file_name);
+        LOG_WRN("Image in file %s: No Ruuvi HW revision TLVs found", p_loc->p_file_name);
     }
     else
     {
         LOG_DBG(
             "Image in file %s: Found Ruuvi HW revision TLVs: ID=%" PRIu32 ", name='%s'",
-            p_file_name,
+            p_loc->p_file_name,
             hw_rev.hw_rev_num,
             hw_rev.hw_rev_name);
     }
@@ -310,80 +545,181 @@ validate_file(
         *p_hw_rev = hw_rev;
     }
 
-    FIH_DECLARE(validity_res, FIH_FAILURE);
-    FIH_CALL(file_img_validate, validity_res, &img_hdr, &file, dst_fa_size, tmp_buf, sizeof(tmp_buf), NULL, 0);
-    if (FIH_NOT_EQ(validity_res, FIH_SUCCESS))
+    file_tlv_iter_t        it = { 0 };
+    const zephyr_api_ret_t rc = file_tlv_iter_begin(&it, &img_hdr, &reader, IMAGE_TLV_ANY, false);
+    if (0 != rc)
+    {
+        LOG_ERR("Failed to find TLV area in file %s, rc=%d", p_loc->p_file_name, rc);
+        file_img_reader_close(&reader);
+        return false;
+    }
+    const uint32_t file_size = file_img_reader_get_size(&reader);
+    file_img_reader_close(&reader);
+
+    /* Only the validated extent is copied, so any trailing bytes would be silently dropped */
+    if (file_size > (it.tlv_end + CONFIG_RUUVI_MCUBOOT_FILE_TAIL_MAX_SIZE))
+    {
+        LOG_ERR(
+            "File %s has %" PRIu32 " bytes after the end of the image, max allowed: %u",
+            p_loc->p_file_name,
+            file_size - it.tlv_end,
+            (unsigned)CONFIG_RUUVI_MCUBOOT_FILE_TAIL_MAX_SIZE);
+        return false;
+    }
+    if (NULL != p_validation)
+    {
+        p_validation->is_valid = true;
+        p_validation->extent   = it.tlv_end;
+        memcpy(p_validation->hash, img_hash, sizeof(p_validation->hash));
+        /* Not found if fw_info has not been captured, the file is searched for it in this case */
+        (void)file_img_inspect_find_fw_info(&inspect, &p_validation->fw_info, &p_validation->is_fw_info_found);
+    }
+
+    return true;
+}
+
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_VERDICT)
+/**
+ * Check the MCUboot self-update file, already read into g_shared_img_buf and validated by B0,
+ * by the verdict saved by the other MCUboot before reboot: the MCUboot signature is not checked again
+ * if the hash of the file is equal to the hash of the image validated before reboot.
+ * The verdict is kept in RAM which the application can write, so it never replaces the B0 signature check.
+ */
+static bool
+check_file_by_verdict(
+    const file_img_loc_t* const  p_loc,
+    const fa_id_t                dst_fa_id,
+    const uint32_t               file_size,
+    struct image_header* const   p_file_img_hdr,
+    fw_image_hw_rev_t* const     p_hw_rev,
+    file_img_validation_t* const p_validation)
+{
+    mcuboot_img_verdict_t verdict = { 0 };
+    if (!mcuboot_img_verdict_take(dst_fa_id, &verdict))
+    {
+        return false;
+    }
+    if ((file_size != verdict.file_size) || (verdict.extent > file_size))
+    {
+        return false;
+    }
+
+    file_img_reader_t   reader    = { 0 };
+    struct image_header img_hdr   = { 0 };
+    uint32_t            img_size  = 0;
+    uint32_t            hash_size = 0;
+    file_img_reader_open_ram(&reader, g_shared_img_buf, file_size);
+    if ((!load_image_header_from_file(&reader, p_loc->p_file_name, &img_hdr, &img_size))
+        || (!boot_u32_safe_add(&hash_size, img_size, img_hdr.ih_protect_tlv_size)) || (hash_size > file_size))
+    {
+        file_img_reader_close(&reader);
+        return false;
+    }
+
+    uint8_t              img_hash[IMAGE_HASH_SIZE];
+    bootutil_sha_context sha_ctx = { 0 };
+    bootutil_sha_init(&sha_ctx);
+    bootutil_sha_update(&sha_ctx, g_shared_img_buf, hash_size);
+    bootutil_sha_finish(&sha_ctx, img_hash);
+    bootutil_sha_drop(&sha_ctx);
+
+    FIH_DECLARE(fih_rc, FIH_FAILURE);
+    FIH_CALL(boot_fih_memequal, fih_rc, img_hash, verdict.img_hash, IMAGE_HASH_SIZE);
+    if (FIH_NOT_EQ(fih_rc, FIH_SUCCESS))
     {
-        LOG_ERR("Validation failed for file: %s", p_file_name);
-        fs_close(&file);
+        LOG_WRN("File %s has changed since it was validated, validate it again", p_loc->p_file_name);
+        file_img_reader_close(&reader);
         return false;
     }
 
-    fs_close(&file);
+    fw_image_hw_rev_t hw_rev = { 0 };
+    (void)find_hw_rev(&reader, NULL, &hw_rev);
+    file_img_reader_close(&reader);
+    *p_file_img_hdr = img_hdr;
+    *p_hw_rev       = hw_rev;
 
+    p_validation->is_valid         = true;
+    p_validation->extent           = verdict.extent;
+    p_validation->is_fw_info_found = false;
+    memcpy(p_validation->hash, img_hash, sizeof(p_validation->hash));
     return true;
 }
+#endif // CONFIG_RUUVI_MCUBOOT_IMG_VERDICT
 
 static bool
 check_file(
-    const char* const          p_file_name,
-    const uint32_t             dst_fa_addr,
-    const uint32_t             dst_fa_size,
-    const bool                 flag_validate_b0_signature,
-    struct image_header* const p_file_img_hdr,
-    fw_image_hw_rev_t* const   p_hw_rev)
+    const file_img_loc_t* const  p_loc,
+    const fa_id_t                dst_fa_id,
+    const uint32_t               dst_fa_addr,
+    const uint32_t               dst_fa_size,
+    const bool                   flag_validate_b0_signature,
+    struct image_header* const   p_file_img_hdr,
+    fw_image_hw_rev_t* const     p_hw_rev,
+    file_img_validation_t* const p_validation)
 {
-    if (!btldr_fs_is_file_exist(p_file_name))
+    if (!btldr_fs_is_file_exist(p_loc->p_file_name))
     {
         return false;
     }
 
+    p_validation->is_valid = false;
     if (flag_validate_b0_signature)
     {
-        LOG_INF("Validate B0 signature for file: %s", p_file_name);
-        if (!validate_b0_signature(p_file_name, dst_fa_addr, dst_fa_size))
+        LOG_INF("Validate B0 signature for file: %s", p_loc->p_file_name);
+        uint32_t file_size = 0;
+        if (!validate_b0_signature(p_loc, dst_fa_id, dst_fa_addr, dst_fa_size, &file_size))
         {
-            LOG_ERR("Failed to validate B0 signature for file %s", p_file_name);
-            btldr_fs_unlink_file(p_file_name);
+            LOG_ERR("Failed to validate B0 signature for file %s", p_loc->p_file_name);
+            btldr_fs_unlink_file(p_loc->p_file_name);
             return false;
         }
-        LOG_INF("B0 signature in file %s validated successfully", p_file_name);
-        if (!validate_file(p_file_name, dst_fa_addr, dst_fa_size, p_file_img_hdr, p_hw_rev))
+        LOG_INF("B0 signature in file %s validated successfully", p_loc->p_file_name);
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_VERDICT)
+        if (check_file_by_verdict(p_loc, dst_fa_id, file_size, p_file_img_hdr, p_hw_rev, p_validation))
         {
-            LOG_WRN("MCUboot signature for file %s is not valid, but B0 signature is valid", p_file_name);
+            LOG_INF("File %s has not changed since it was validated before reboot", p_loc->p_file_name);
+            return true;
+        }
+#endif
+        if (!validate_file(
+                    p_loc,
+                    dst_fa_id,
+                    dst_fa_addr,
+                    dst_fa_size,
+                    p_file_img_hdr,
+                    p_hw_rev,
+                    p_validation))
+        {
+            LOG_WRN("MCUboot signature for file %s is not valid, but B0 signature is valid", p_loc->p_file_name);
         }
     }
     else
     {
-        if (!validate_file(p_file_name, dst_fa_addr, dst_fa_size, p_file_img_hdr, p_hw_rev))
+        if (!validate_file(
+                    p_loc,
+                    dst_fa_id,
+                    dst_fa_addr,
+                    dst_fa_size,
+                    p_file_img_hdr,
+                    p_hw_rev,
+                    p_validation))
         {
-            LOG_ERR("File %s contains invalid image", p_file_name);
-            btldr_fs_unlink_file(p_file_name);
+            LOG_ERR("File %s contains invalid image", p_loc->p_file_name);
+            btldr_fs_unlink_file(p_loc->p_file_name);
             return false;
         }
-        LOG_INF("File %s validated successfully", p_file_name);
+        LOG_INF("File %s validated successfully", p_loc->p_file_name);
     }
     return true;
 }
 
 static bool
-fw_info_check_in_file(struct fs_file_t* const p_file, off_t offset, struct fw_info* const p_fw_info)
+fw_info_check_in_file(file_img_reader_t* const p_reader, const uint32_t offset, struct fw_info* const p_fw_info)
 {
-    zephyr_api_ret_t rc = fs_seek(p_file, offset, FS_SEEK_SET);
+    const zephyr_api_ret_t rc = file_img_reader_read(p_reader, offset, p_fw_info, sizeof(*p_fw_info));
     if (0 != rc)
     {
-        LOG_ERR("Failed to seek to offset %ld in file, rc=%d", offset, rc);
-        return false;
-    }
-    const ssize_t len = fs_read(p_file, p_fw_info, sizeof(*p_fw_info));
-    if (len < 0)
-    {
-        LOG_ERR("Failed reading fw_info, rc=%zd", len);
-        return false;
-    }
-    if (len != sizeof(*p_fw_info))
-    {
-        LOG_ERR("Failed reading fw_info, len=%zd, expected len=%zu", len, sizeof(*p_fw_info));
+        LOG_ERR("Failed reading fw_info at offset %" PRIu32 ", rc=%d", offset, rc);
         return false;
     }
 
@@ -397,27 +733,49 @@ fw_info_check_in_file(struct fs_file_t* const p_file, off_t offset, struct fw_in
 }
 
 static bool
-fw_info_find_in_file(const char* const p_file_name, struct fw_info* const p_fw_info)
+fw_info_find_in_reader(file_img_reader_t* const p_reader, struct fw_info* const p_fw_info)
 {
-    struct fs_file_t file = btldr_fs_open_file(p_file_name);
-    if (NULL == file.filep)
-    {
-        return false;
-    }
-
-    bool flag_fw_info_found = false;
     for (uint32_t i = 0; i < FW_INFO_OFFSET_COUNT; ++i)
     {
-        if (fw_info_check_in_file(&file, fw_info_allowed_offsets[i], p_fw_info))
+        if (fw_info_check_in_file(p_reader, fw_info_allowed_offsets[i], p_fw_info))
         {
-            flag_fw_info_found = true;
-            break;
+            return true;
         }
     }
-    fs_close(&file);
+    return false;
+}
+
+static bool
+fw_info_find_in_file(const file_img_loc_t* const p_loc, const fa_id_t dst_fa_id, struct fw_info* const p_fw_info)
+{
+    file_img_reader_t reader = { 0 };
+    if (!open_reader_for_check(&reader, p_loc, dst_fa_id))
+    {
+        return false;
+    }
+    const bool flag_fw_info_found = fw_info_find_in_reader(&reader, p_fw_info);
+    file_img_reader_close(&reader);
     return flag_fw_info_found;
 }
 
+/**
+ * Get fw_info of the image in the update file: the one captured by the validation, or search the file for it.
+ */
+static bool
+get_file_fw_info(
+    const file_img_loc_t* const        p_loc,
+    const fa_id_t                      dst_fa_id,
+    const file_img_validation_t* const p_validation,
+    struct fw_info* const              p_fw_info)
+{
+    if (p_validation->is_fw_info_found)
+    {
+        *p_fw_info = p_validation->fw_info;
+        return true;
+    }
+    return fw_info_find_in_file(p_loc, dst_fa_id, p_fw_info);
+}
+
 #if defined(MCUBOOT_DOWNGRADE_PREVENTION)
 /**
  * Compare image version numbers
@@ -500,7 +858,7 @@ check_downgrade_prevention(const fa_id_t dst_fa_id, const struct image_header* c
         p_file_img_hdr->ih_ver.iv_minor,
         p_file_img_hdr->ih_ver.iv_revision,
         p_file_img_hdr->ih_ver.iv_build_num);
-    int32_t rc = boot_version_cmp(&p_file_img_hdr->ih_ver, &p_file_img_hdr->ih_ver);
+    int32_t rc = boot_version_cmp(&p_file_img_hdr->ih_ver, &dst_img_hdr.ih_ver);
     if ((rc >= 0) && ((PM_ID(s0) == dst_fa_id) || (PM_ID(s1) == dst_fa_id)))
     {
         /* Also check the new version of MCUboot against that of the current s0/s1 MCUboot
@@ -528,12 +886,116 @@ check_downgrade_prevention(const fa_id_t dst_fa_id, const struct image_header* c
 }
 #endif // MCUBOOT_DOWNGRADE_PREVENTION
 
+static file_gate_res_e
+gate_file_reject(const char* const p_file_name, const file_gate_stage_e stage)
+{
+    g_file_gate_reject_cnt[stage] += 1;
+    LOG_WRN(
+        "File %s rejected at stage '%s', rejects at this stage: %" PRIu32,
+        p_file_name,
+        g_file_gate_stage_names[stage],
+        g_file_gate_reject_cnt[stage]);
+    return FILE_GATE_RES_REJECTED;
+}
+
+/**
+ * Run the checks which do not need the image to be hashed: header, bounds, HW revision, fw_info version
+ * and downgrade prevention, so that a file which can't be installed is rejected before its signature is checked.
+ * Nothing read here is trusted: the file is only rejected, and every check is repeated on the validated image.
+ * A file which can't be opened or whose header can't be read is not rejected, the error may be transient.
+ * @param flag_mcuboot_sig_required false if the file is accepted by B0 signature even without a valid MCUboot image,
+ *                                  the header and the bounds are not gated in this case.
+ */
+static file_gate_res_e
+gate_file(
+    const file_img_loc_t* const    p_loc,
+    const fa_id_t                  dst_fa_id,
+    const uint32_t                 dst_fa_addr,
+    const uint32_t                 dst_fa_size,
+    const fw_image_hw_rev_t* const p_hw_rev,
+    const bool                     flag_mcuboot_sig_required)
+{
+    file_img_reader_t reader = { 0 };
+    if (!open_reader_for_check(&reader, p_loc, dst_fa_id))
+    {
+        LOG_ERR("Failed to open file %s", p_loc->p_file_name);
+        return FILE_GATE_RES_IO_ERROR;
+    }
+
+    struct image_header    img_hdr  = { 0 };
+    uint32_t               img_size = 0;
+    const zephyr_api_ret_t rc       = file_img_reader_read(&reader, 0, &img_hdr, sizeof(img_hdr));
+    if ((0 != rc) && (-EBADMSG != rc))
+    {
+        /* A corrupted chunk or an authentication failure is a bad file, any other error may go away on retry */
+        LOG_ERR("Failed reading image header from file %s, rc=%d", p_loc->p_file_name, rc);
+        file_img_reader_close(&reader);
+        return FILE_GATE_RES_IO_ERROR;
+    }
+    const bool is_hdr_valid = (0 == rc)
+                              && check_image_header_from_file(&reader, p_loc->p_file_name, &img_hdr, &img_size);
+    if ((!is_hdr_valid) && flag_mcuboot_sig_required)
+    {
+        file_img_reader_close(&reader);
+        return gate_file_reject(p_loc->p_file_name, FILE_GATE_STAGE_HEADER);
+    }
+    if (is_hdr_valid)
+    {
+        file_reader_prepare(&reader, p_loc->p_file_name, &img_hdr);
+    }
+
+    if (is_hdr_valid && flag_mcuboot_sig_required)
+    {
+        if ((img_size >= dst_fa_size)
+            || (!check_reset_addr(&reader, NULL, &img_hdr, p_loc->p_file_name, dst_fa_addr, dst_fa_size)))
+        {
+            file_img_reader_close(&reader);
+            return gate_file_reject(p_loc->p_file_name, FILE_GATE_STAGE_BOUNDS);
+        }
+    }
+
+    if (is_hdr_valid && ('\0' != p_hw_rev->hw_rev_name[0]))
+    {
+        fw_image_hw_rev_t hw_rev = { 0 };
+        (void)find_hw_rev(&reader, NULL, &hw_rev);
+        if (0 != strcmp(p_hw_rev->hw_rev_name, hw_rev.hw_rev_name))
+        {
+            file_img_reader_close(&reader);
+            return gate_file_reject(p_loc->p_file_name, FILE_GATE_STAGE_HW_REV);
+        }
+    }
+
+    /* The versions are checked against the slot only, never against the copy journal in LittleFS */
+    const struct fw_info* const p_dst_fw_info = fw_info_find(dst_fa_addr);
+    struct fw_info              fw_info       = { 0 };
+    if ((NULL == p_dst_fw_info) || (!fw_info_find_in_reader(&reader, &fw_info))
+        || (p_dst_fw_info->version > fw_info.version))
+    {
+        file_img_reader_close(&reader);
+        return gate_file_reject(p_loc->p_file_name, FILE_GATE_STAGE_FW_INFO);
+    }
+#if defined(MCUBOOT_DOWNGRADE_PREVENTION)
+    if (is_hdr_valid && (!check_downgrade_prevention(dst_fa_id, &img_hdr)))
+    {
+        file_img_reader_close(&reader);
+        return gate_file_reject(p_loc->p_file_name, FILE_GATE_STAGE_DOWNGRADE);
+    }
+#endif
+    file_img_reader_close(&reader);
+    return FILE_GATE_RES_PASSED;
+}
+
+/**
+ * Check the image in the update file before it is installed: signatures, HW revision and downgrade prevention.
+ * The file is removed if the check fails.
+ */
 static bool
-check_file_and_update(
-    const char* const              p_file_name,
+check_file_before_update(
+    const file_img_loc_t* const    p_loc,
     const fa_id_t                  dst_fa_id,
     const fw_image_hw_rev_t* const p_hw_rev,
-    const bool                     flag_validate_b0_signature)
+    const bool                     flag_validate_b0_signature,
+    file_img_validation_t* const   p_validation)
 {
     uint32_t dst_fa_addr = 0;
     uint32_t dst_fa_size = 0;
@@ -542,31 +1004,63 @@ check_file_and_update(
         LOG_ERR("Failed to get flash area address and size for id=%d", dst_fa_id);
         return false;
     }
+    if (!btldr_fs_is_file_exist(p_loc->p_file_name))
+    {
+        return false;
+    }
+    const file_gate_res_e gate_res = gate_file(
+        p_loc,
+        dst_fa_id,
+        dst_fa_addr,
+        dst_fa_size,
+        p_hw_rev,
+        !flag_validate_b0_signature);
+    if (FILE_GATE_RES_IO_ERROR == gate_res)
+    {
+        LOG_ERR("Keep file %s to retry the update after reboot", p_loc->p_file_name);
+        return false;
+    }
+    if (FILE_GATE_RES_PASSED != gate_res)
+    {
+        btldr_fs_unlink_file(p_loc->p_file_name);
+        return false;
+    }
 
     struct image_header file_img_hdr = { 0 };
     fw_image_hw_rev_t   hw_rev       = { 0 };
-    if (!check_file(p_file_name, dst_fa_addr, dst_fa_size, flag_validate_b0_signature, &file_img_hdr, &hw_rev))
+    if (!check_file(
+            p_loc,
+            dst_fa_id,
+            dst_fa_addr,
+            dst_fa_size,
+            flag_validate_b0_signature,
+            &file_img_hdr,
+            &hw_rev,
+            p_validation))
     {
+        (void)gate_file_reject(p_loc->p_file_name, FILE_GATE_STAGE_SIGNATURE);
         return false;
     }
 
     struct fw_info file_fw_info = { 0 };
-    if (!fw_info_find_in_file(p_file_name, &file_fw_info))
+    if (!get_file_fw_info(p_loc, dst_fa_id, p_validation, &file_fw_info))
     {
-        LOG_ERR("Failed to find fw_info in file %s", p_file_name);
-        btldr_fs_unlink_file(p_file_name);
+        LOG_ERR("Failed to find fw_info in file %s", p_loc->p_file_name);
+        btldr_fs_unlink_file(p_loc->p_file_name);
         return false;
     }
+    /* The versions are always checked against the slot. An interrupted copy is resumed only if the slot already
+     * holds the beginning of this image (see mcuboot_img_op_copy()), so the slot has the version of the image then. */
     const struct fw_info* const p_dst_fw_info = fw_info_find(dst_fa_addr);
     if (NULL == p_dst_fw_info)
     {
         LOG_ERR("Failed to find fw_info for flash area %d (%s)", dst_fa_id, get_image_slot_name(dst_fa_id));
-        btldr_fs_unlink_file(p_file_name);
+        btldr_fs_unlink_file(p_loc->p_file_name);
         return false;
     }
     LOG_INF(
         "Image in file %s: Image version: v%u.%u.%u+%u, FwInfoVer: %u, HwRev: ID=%" PRIu32 ", name='%s'",
-        p_file_name,
+        p_loc->p_file_name,
         file_img_hdr.ih_ver.iv_major,
         file_img_hdr.ih_ver.iv_minor,
         file_img_hdr.ih_ver.iv_revision,
@@ -578,7 +1072,7 @@ check_file_and_update(
     if (('\0' != p_hw_rev->hw_rev_name[0]) && (0 != strcmp(p_hw_rev->hw_rev_name, hw_rev.hw_rev_name)))
     {
         LOG_ERR("HW revision name mismatch: expected '%s', got '%s'", p_hw_rev->hw_rev_name, hw_rev.hw_rev_name);
-        btldr_fs_unlink_file(p_file_name);
+        btldr_fs_unlink_file(p_loc->p_file_name);
         return false;
     }
 
@@ -590,46 +1084,142 @@ check_file_and_update(
             "Downgrade prevention: New image version(%u) is older than the current image version(%u)",
             file_fw_info.version,
             p_dst_fw_info->version);
-        btldr_fs_unlink_file(p_file_name);
+        btldr_fs_unlink_file(p_loc->p_file_name);
         return false;
     }
 
 #if defined(MCUBOOT_DOWNGRADE_PREVENTION)
     if (!check_downgrade_prevention(dst_fa_id, &file_img_hdr))
     {
-        btldr_fs_unlink_file(p_file_name);
+        btldr_fs_unlink_file(p_loc->p_file_name);
         return false;
     }
 #endif
+    return true;
+}
 
-    struct fs_file_t file = btldr_fs_open_file(p_file_name);
-    if (NULL == file.filep)
+/**
+ * Open the reader of the checked image: the copy validated in g_shared_img_buf if there is one,
+ * otherwise the update file.
+ */
+static bool
+open_reader_for_update(file_img_reader_t* const p_reader, const file_img_loc_t* const p_loc, const fa_id_t dst_fa_id)
+{
+#if defined(CONFIG_RUUVI_MCUBOOT_INSTALL_FROM_SHARED_SRAM)
+    if (is_shared_img_loaded(p_loc, dst_fa_id))
     {
-        LOG_ERR("Failed to open file %s", p_file_name);
-        btldr_fs_unlink_file(p_file_name);
-        return false;
+        LOG_INF("Install the image from file %s from the copy validated in RAM", p_loc->p_file_name);
+        file_img_reader_open_ram(p_reader, g_shared_img_buf, g_shared_img.size);
+        g_shared_img.size = 0; /* The copy is used only once */
+        return true;
+    }
+#endif
+    return file_img_reader_open(p_reader, p_loc, dst_fa_id);
+}
+
+/**
+ * Copy the checked image from the update file to the destination slot.
+ * @return true if the file can be removed, false if it has to be kept to retry the update after reboot.
+ */
+static bool
+update_from_file(
+    const file_img_loc_t* const        p_loc,
+    const fa_id_t                      dst_fa_id,
+    const file_img_validation_t* const p_validation)
+{
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_SKIP_INSTALLED)
+    if (p_validation->is_valid && mcuboot_img_op_is_installed(dst_fa_id, p_validation->hash))
+    {
+        LOG_INF(
+            "Flash partition %d (%s) already contains the image from file %s, skip the copy",
+            dst_fa_id,
+            get_image_slot_name(dst_fa_id),
+            p_loc->p_file_name);
+        return true;
+    }
+#endif
+    file_img_reader_t reader = { 0 };
+    if (!open_reader_for_update(&reader, p_loc, dst_fa_id))
+    {
+        LOG_ERR("Failed to open file %s", p_loc->p_file_name);
+        return true;
     }
     LOG_INF(
         "Copy firmware from file %s to flash partition %d (%s)",
-        p_file_name,
+        p_loc->p_file_name,
         dst_fa_id,
         get_image_slot_name(dst_fa_id));
-    if (mcuboot_img_op_copy(dst_fa_id, &file))
+    mcuboot_img_stats_begin_image(dst_fa_id);
+    mcuboot_img_measure_invalidate(dst_fa_id);
+    /* Without MCUboot validation (B0-signed image only) the extent is not known, so the whole file is copied */
+    const bool flag_copied = p_validation->is_valid
+                                 ? mcuboot_img_op_copy(dst_fa_id, &reader, p_validation->hash, p_validation->extent)
+                                 : mcuboot_img_op_copy(dst_fa_id, &reader, NULL, 0);
+    if (flag_copied)
+    {
+        LOG_INF("%s copied successfully", p_loc->p_file_name);
+    }
+    const bool flag_in_place       = file_img_reader_is_in_place(&reader);
+    const bool flag_chunk_verified = file_img_reader_is_chunk_verified(&reader);
+    file_img_reader_close(&reader);
+    if ((!flag_copied) && flag_in_place)
+    {
+        /* The old image is partially overwritten, and the patch is needed to resume the delta update */
+        mcuboot_img_stats_end_image(false);
+        LOG_ERR("Keep file %s to resume the delta update of flash partition %d", p_loc->p_file_name, dst_fa_id);
+        return false;
+    }
+    if ((!flag_copied) && flag_chunk_verified)
     {
-        LOG_INF("%s copied successfully", p_file_name);
+        /* The chunks are verified while they are copied, so the slot may already be erased when a corrupt chunk
+         * is found, and the file is the only source to resume the copy from */
+        mcuboot_img_stats_end_image(false);
+        LOG_ERR("Keep file %s to resume the copy to flash partition %d", p_loc->p_file_name, dst_fa_id);
+        return false;
+    }
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_VERIFY_SLOT_HASH)
+    if (flag_copied && p_validation->is_valid && (!mcuboot_img_op_verify_hash(dst_fa_id, p_validation->hash)))
+    {
+        mcuboot_img_stats_end_image(false);
+        LOG_ERR("Keep file %s to retry the update of flash partition %d after reboot", p_loc->p_file_name, dst_fa_id);
+        return false;
+    }
+#endif
+    if (flag_copied && p_validation->is_valid)
+    {
+        mcuboot_img_measure_record(dst_fa_id, p_validation->hash);
+    }
+    mcuboot_img_stats_end_image(flag_copied);
+    return true;
+}
+
+static bool
+check_file_and_update(
+    const file_img_loc_t* const    p_loc,
+    const fa_id_t                  dst_fa_id,
+    const fw_image_hw_rev_t* const p_hw_rev,
+    const bool                     flag_validate_b0_signature)
+{
+    file_img_validation_t validation = { 0 };
+    if (!check_file_before_update(p_loc, dst_fa_id, p_hw_rev, flag_validate_b0_signature, &validation))
+    {
+        return false;
+    }
+    if (update_from_file(p_loc, dst_fa_id, &validation))
+    {
+        btldr_fs_unlink_file(p_loc->p_file_name);
     }
-    btldr_fs_close_file(&file);
-    btldr_fs_unlink_file(p_file_name);
     return true;
 }
 
 static bool
 check_update_for_mcuboot(
-    const char* const              p_file_name,
+    const file_img_loc_t* const    p_loc,
     const fa_id_t                  dst_fa_id,
-    const fw_image_hw_rev_t* const p_hw_rev)
+    const fw_image_hw_rev_t* const p_hw_rev,
+    file_img_validation_t* const   p_validation)
 {
-    if (!btldr_fs_is_file_exist(p_file_name))
+    if (!btldr_fs_is_file_exist(p_loc->p_file_name))
     {
         return false;
     }
@@ -643,35 +1233,36 @@ check_update_for_mcuboot(
 
     LOG_INF(
         "Validate B0 signature for file: %s, dst_addr=0x%" PRIx32 ", size=0x%" PRIx32,
-        p_file_name,
+        p_loc->p_file_name,
         dst_fa_addr,
         dst_fa_size);
-    if (!validate_b0_signature(p_file_name, dst_fa_addr, dst_fa_size))
+    uint32_t file_size = 0;
+    if (!validate_b0_signature(p_loc, dst_fa_id, dst_fa_addr, dst_fa_size, &file_size))
     {
-        LOG_ERR("Failed to validate B0 signature for file %s", p_file_name);
-        btldr_fs_unlink_file(p_file_name);
+        LOG_ERR("Failed to validate B0 signature for file %s", p_loc->p_file_name);
+        btldr_fs_unlink_file(p_loc->p_file_name);
         return false;
     }
-    LOG_INF("B0 signature for file %s validated successfully", p_file_name);
+    LOG_INF("B0 signature for file %s validated successfully", p_loc->p_file_name);
 
     struct image_header file_img_hdr = { 0 };
     fw_image_hw_rev_t   hw_rev       = { 0 };
-    if (!validate_file(p_file_name, dst_fa_addr, dst_fa_size, &file_img_hdr, &hw_rev))
+    if (!validate_file(p_loc, dst_fa_id, dst_fa_addr, dst_fa_size, &file_img_hdr, &hw_rev, p_validation))
     {
-        LOG_WRN("MCUboot signature for file %s is not valid, but B0 signature is valid", p_file_name);
+        LOG_WRN("MCUboot signature for file %s is not valid, but B0 signature is valid", p_loc->p_file_name);
     }
 
     struct fw_info file_fw_info = { 0 };
-    if (!fw_info_find_in_file(p_file_name, &file_fw_info))
+    if (!get_file_fw_info(p_loc, dst_fa_id, p_validation, &file_fw_info))
     {
-        LOG_ERR("Failed to find fw_info in file %s", p_file_name);
-        btldr_fs_unlink_file(p_file_name);
+        LOG_ERR("Failed to find fw_info in file %s", p_loc->p_file_name);
+        btldr_fs_unlink_file(p_loc->p_file_name);
         return false;
     }
 
     LOG_INF(
         "Image in file %s: Image version: v%u.%u.%u+%u, FwInfoVer: %u, HwRev: ID=%" PRIu32 ", name='%s'",
-        p_file_name,
+        p_loc->p_file_name,
         file_img_hdr.ih_ver.iv_major,
         file_img_hdr.ih_ver.iv_minor,
         file_img_hdr.ih_ver.iv_revision,
@@ -683,29 +1274,264 @@ check_update_for_mcuboot(
     if (('\0' != p_hw_rev->hw_rev_name[0]) && (0 != strcmp(p_hw_rev->hw_rev_name, hw_rev.hw_rev_name)))
     {
         LOG_ERR("HW revision name mismatch: expected '%s', got '%s'", p_hw_rev->hw_rev_name, hw_rev.hw_rev_name);
+        btldr_fs_unlink_file(p_loc->p_file_name);
+        return false;
+    }
+    if (p_validation->is_valid)
+    {
+        /* The other MCUboot checks the file after reboot by its hash only */
+        mcuboot_img_verdict_t verdict = {
+            .fa_id     = (uint32_t)dst_fa_id,
+            .file_size = file_size,
+            .extent    = p_validation->extent,
+        };
+        memcpy(verdict.img_hash, p_validation->hash, sizeof(verdict.img_hash));
+        mcuboot_img_verdict_save(&verdict);
+    }
+    return true;
+}
+
+static file_img_loc_t
+get_file_loc(const char* const p_file_name)
+{
+    const file_img_loc_t loc = {
+        .p_file_name = p_file_name,
+        .offset      = 0,
+        .size        = 0,
+    };
+    return loc;
+}
+
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_BUNDLE)
+typedef enum bundle_img_action_e
+{
+    BUNDLE_IMG_ACTION_SKIP,    /* The image is already installed */
+    BUNDLE_IMG_ACTION_INSTALL, /* The image is installed by this MCUboot */
+    BUNDLE_IMG_ACTION_REBOOT,  /* The image is installed by the other MCUboot after reboot */
+} bundle_img_action_e;
+
+/**
+ * Image of the bundle which has been checked and is going to be installed.
+ */
+typedef struct bundle_img_t
+{
+    file_img_bundle_image_e image_id;
+    fa_id_t                 dst_fa_id;
+    file_img_loc_t          loc;
+    file_img_validation_t   validation;
+} bundle_img_t;
+
+/**
+ * Check if the running MCUboot already is the MCUboot image from the bundle,
+ * i.e. the bundle has been installed by the other MCUboot before the reboot.
+ */
+static bool
+is_mcuboot_image_installed(const file_img_loc_t* const p_loc, const fa_id_t dst_fa_id)
+{
+    uint32_t dst_fa_addr = 0;
+    uint32_t dst_fa_size = 0;
+    if (!get_flash_area_address_and_size(dst_fa_id, &dst_fa_addr, &dst_fa_size))
+    {
+        return false;
+    }
+    const struct fw_info* const p_dst_fw_info = fw_info_find(dst_fa_addr);
+    struct fw_info              file_fw_info  = { 0 };
+    if ((NULL == p_dst_fw_info) || (!fw_info_find_in_file(p_loc, dst_fa_id, &file_fw_info)))
+    {
+        return false;
+    }
+    return p_dst_fw_info->version == file_fw_info.version;
+}
+
+/**
+ * Check the image of the bundle and bind it to the index table of the signed manifest.
+ * @return true on success, false if the check failed and the bundle has been removed.
+ */
+static bool
+check_bundle_img(
+    const file_img_bundle_t* const       p_bundle,
+    const file_img_bundle_entry_t* const p_entry,
+    const uint8_t                        mcuboot_active_slot,
+    const fw_image_hw_rev_t* const       p_hw_rev,
+    bundle_img_t* const                  p_img,
+    bundle_img_action_e* const           p_action)
+{
+    static const fa_id_t dst_fa_ids[FILE_IMG_BUNDLE_IMAGE_CNT] = {
+        [FILE_IMG_BUNDLE_IMAGE_MCUBOOT0] = (fa_id_t)PM_ID(s0),
+        [FILE_IMG_BUNDLE_IMAGE_MCUBOOT1] = (fa_id_t)PM_ID(s1),
+        [FILE_IMG_BUNDLE_IMAGE_LOADER]   = (fa_id_t)PM_ID(mcuboot_secondary),
+        [FILE_IMG_BUNDLE_IMAGE_APP]      = (fa_id_t)PM_ID(mcuboot_primary),
+    };
+    const file_img_bundle_image_e image_id          = (file_img_bundle_image_e)p_entry->image_id;
+    const bool                    is_mcuboot        = (FILE_IMG_BUNDLE_IMAGE_MCUBOOT0 == image_id)
+                                                   || (FILE_IMG_BUNDLE_IMAGE_MCUBOOT1 == image_id);
+    const bool                    is_active_mcuboot = is_mcuboot && (mcuboot_active_slot == (uint8_t)image_id);
+
+    p_img->image_id  = image_id;
+    p_img->dst_fa_id = dst_fa_ids[image_id];
+    p_img->loc       = file_img_bundle_get_loc(p_bundle, p_entry);
+    LOG_INF(
+        "Bundle %s: check image %d for flash partition %d (%s)",
+        p_bundle->p_file_name,
+        (int)image_id,
+        p_img->dst_fa_id,
+        get_image_slot_name(p_img->dst_fa_id));
+
+    if (is_active_mcuboot)
+    {
+        if (is_mcuboot_image_installed(&p_img->loc, p_img->dst_fa_id))
+        {
+            LOG_INF("Bundle %s: MCUboot image %d is already running", p_bundle->p_file_name, (int)image_id);
+            *p_action = BUNDLE_IMG_ACTION_SKIP;
+            return true;
+        }
+        if (!check_update_for_mcuboot(&p_img->loc, p_img->dst_fa_id, p_hw_rev, &p_img->validation))
+        {
+            return false;
+        }
+        *p_action = BUNDLE_IMG_ACTION_REBOOT;
+    }
+    else
+    {
+        if (!check_file_before_update(&p_img->loc, p_img->dst_fa_id, p_hw_rev, is_mcuboot, &p_img->validation))
+        {
+            return false;
+        }
+        *p_action = BUNDLE_IMG_ACTION_INSTALL;
+    }
+
+    FIH_DECLARE(fih_rc, FIH_FAILURE);
+    if (p_img->validation.is_valid)
+    {
+        FIH_CALL(boot_fih_memequal, fih_rc, p_img->validation.hash, p_entry->img_hash, IMAGE_HASH_SIZE);
+    }
+    if (FIH_NOT_EQ(fih_rc, FIH_SUCCESS))
+    {
+        LOG_ERR("Bundle %s: image %d does not match the manifest", p_bundle->p_file_name, (int)image_id);
+        btldr_fs_unlink_file(p_bundle->p_file_name);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Install the images from the bundle file.
+ * All the images are checked against the signed manifest before any of them is written,
+ * so a release is either installed completely or not at all.
+ * @return true if the bundle has been found and installed or the reboot is required.
+ */
+static bool
+check_bundle_and_update(const uint8_t mcuboot_active_slot, const fw_image_hw_rev_t* const p_hw_rev)
+{
+    const char* const p_file_name = FILE_IMG_BUNDLE_FILE_NAME;
+    if (!btldr_fs_is_file_exist(p_file_name))
+    {
+        return false;
+    }
+    file_img_bundle_t bundle = { 0 };
+    if (!file_img_bundle_load(&bundle, p_file_name))
+    {
         btldr_fs_unlink_file(p_file_name);
         return false;
     }
+
+    /* The MCUboot image for the inactive slot is installed first, the one for the active slot requires a reboot */
+    const file_img_bundle_image_e order[FILE_IMG_BUNDLE_IMAGE_CNT] = {
+        (0 == mcuboot_active_slot) ? FILE_IMG_BUNDLE_IMAGE_MCUBOOT1 : FILE_IMG_BUNDLE_IMAGE_MCUBOOT0,
+        (0 == mcuboot_active_slot) ? FILE_IMG_BUNDLE_IMAGE_MCUBOOT0 : FILE_IMG_BUNDLE_IMAGE_MCUBOOT1,
+        FILE_IMG_BUNDLE_IMAGE_LOADER,
+        FILE_IMG_BUNDLE_IMAGE_APP,
+    };
+    bundle_img_t imgs[FILE_IMG_BUNDLE_IMAGE_CNT];
+    uint32_t     img_cnt     = 0;
+    bool         flag_reboot = false;
+    for (uint32_t i = 0; i < FILE_IMG_BUNDLE_IMAGE_CNT; ++i)
+    {
+        const file_img_bundle_entry_t* const p_entry = file_img_bundle_find(&bundle, order[i]);
+        if (NULL == p_entry)
+        {
+            continue;
+        }
+        bundle_img_action_e action = BUNDLE_IMG_ACTION_SKIP;
+        memset(&imgs[img_cnt], 0, sizeof(imgs[img_cnt]));
+        if (!check_bundle_img(&bundle, p_entry, mcuboot_active_slot, p_hw_rev, &imgs[img_cnt], &action))
+        {
+            return false;
+        }
+        if (BUNDLE_IMG_ACTION_INSTALL == action)
+        {
+            img_cnt += 1;
+        }
+        else if (BUNDLE_IMG_ACTION_REBOOT == action)
+        {
+            flag_reboot = true;
+        }
+        else
+        {
+            /* The image is already installed */
+        }
+    }
+
+    bool flag_keep_file = false;
+    for (uint32_t i = 0; i < img_cnt; ++i)
+    {
+        const bundle_img_t* const p_img = &imgs[i];
+        if (flag_reboot && (p_img->image_id >= FILE_IMG_BUNDLE_IMAGE_LOADER))
+        {
+            /* The firmware images are installed by the other MCUboot after reboot */
+            break;
+        }
+        if (!update_from_file(&p_img->loc, p_img->dst_fa_id, &p_img->validation))
+        {
+            flag_keep_file = true;
+        }
+    }
+    if (flag_reboot)
+    {
+        LOG_INF("Bundle %s: need to reboot to update the active MCUboot from the other one", p_file_name);
+        if (0 == mcuboot_active_slot)
+        {
+            (void)img_invalidate((fa_id_t)PM_ID(s0));
+        }
+    }
+    else if (!flag_keep_file)
+    {
+        btldr_fs_unlink_file(p_file_name);
+    }
+    else
+    {
+        LOG_ERR("Keep bundle %s to retry the update after reboot", p_file_name);
+    }
     return true;
 }
+#endif // CONFIG_RUUVI_MCUBOOT_FILE_IMG_BUNDLE
 
 static bool
 check_updates_on_fs(const uint8_t mcuboot_active_slot, const fw_image_hw_rev_t* const p_hw_rev)
 {
-    bool flag_updates_found = false;
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_BUNDLE)
+    /* A bundle replaces the separate update files, so they are not looked up if it is present */
+    if (check_bundle_and_update(mcuboot_active_slot, p_hw_rev))
+    {
+        return true;
+    }
+#endif
+    const file_img_loc_t loc_mcuboot0 = get_file_loc(RUUVI_FW_MCUBOOT0_FILE_NAME);
+    const file_img_loc_t loc_mcuboot1 = get_file_loc(RUUVI_FW_MCUBOOT1_FILE_NAME);
+    const file_img_loc_t loc_loader   = get_file_loc(RUUVI_FW_LOADER_FILE_NAME);
+    const file_img_loc_t loc_app      = get_file_loc(RUUVI_FW_APP_FILE_NAME);
+
+    bool                  flag_updates_found = false;
+    file_img_validation_t validation         = { 0 };
 
     if (0 == mcuboot_active_slot)
     {
         const bool flag_validate_b0_signature = true;
-        if (check_file_and_update(
-                RUUVI_FW_MCUBOOT1_FILE_NAME,
-                (fa_id_t)PM_ID(s1),
-                p_hw_rev,
-                flag_validate_b0_signature))
+        if (check_file_and_update(&loc_mcuboot1, (fa_id_t)PM_ID(s1), p_hw_rev, flag_validate_b0_signature))
         {
             flag_updates_found = true;
         }
-        if (check_update_for_mcuboot(RUUVI_FW_MCUBOOT0_FILE_NAME, (fa_id_t)PM_ID(s0), p_hw_rev))
+        if (check_update_for_mcuboot(&loc_mcuboot0, (fa_id_t)PM_ID(s0), p_hw_rev, &validation))
         {
             LOG_INF("Found file %s - need to reboot to update it from secondary MCUboot", RUUVI_FW_MCUBOOT0_FILE_NAME);
             (void)img_invalidate((fa_id_t)PM_ID(s0));
@@ -715,35 +1541,23 @@ check_updates_on_fs(const uint8_t mcuboot_active_slot, const fw_image_hw_rev_t*
     else
     {
         const bool flag_validate_b0_signature = true;
-        if (check_file_and_update(
-                RUUVI_FW_MCUBOOT0_FILE_NAME,
-                (fa_id_t)PM_ID(s0),
-                p_hw_rev,
-                flag_validate_b0_signature))
+        if (check_file_and_update(&loc_mcuboot0, (fa_id_t)PM_ID(s0), p_hw_rev, flag_validate_b0_signature))
         {
             flag_updates_found = true;
         }
 
-        if (check_update_for_mcuboot(RUUVI_FW_MCUBOOT1_FILE_NAME, (fa_id_t)PM_ID(s1), p_hw_rev))
+        if (check_update_for_mcuboot(&loc_mcuboot1, (fa_id_t)PM_ID(s1), p_hw_rev, &validation))
         {
             LOG_INF("Found file %s - need to reboot to update it from primary MCUboot", RUUVI_FW_MCUBOOT1_FILE_NAME);
             return true;
         }
     }
     const bool flag_validate_b0_signature = false;
-    if (check_file_and_update(
-            RUUVI_FW_LOADER_FILE_NAME,
-            (fa_id_t)PM_ID(mcuboot_secondary),
-            p_hw_rev,
-            flag_validate_b0_signature))
+    if (check_file_and_update(&loc_loader, (fa_id_t)PM_ID(mcuboot_secondary), p_hw_rev, flag_validate_b0_signature))
     {
         flag_updates_found = true;
     }
-    if (check_file_and_update(
-            RUUVI_FW_APP_FILE_NAME,
-            (fa_id_t)PM_ID(mcuboot_primary),
-            p_hw_rev,
-            flag_validate_b0_signature))
+    if (check_file_and_update(&loc_app, (fa_id_t)PM_ID(mcuboot_primary), p_hw_rev, flag_validate_b0_signature))
     {
         flag_updates_found = true;
     }
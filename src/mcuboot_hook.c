@@ -18,6 +18,8 @@
 #include <fw_info.h>
 #include "mcuboot_fw_update.h"
 #include "mcuboot_fa_utils.h"
+#include "mcuboot_img_measure.h"
+#include "mcuboot_img_stats.h"
 #include "mcuboot_segger_rtt.h"
 #include "mcuboot_version.h"
 #include "app_version.h"
@@ -90,12 +92,17 @@ boot_add_shared_data(const slot_id_t active_slot, const fa_id_t active_fa_id, co
     }
 
 #ifdef MCUBOOT_MEASURED_BOOT
-    rc = boot_save_boot_status(0 /* TODO: need to use actual value for 'sw_module' instead of 0 */, &img_hdr, p_fa);
+    rc = boot_save_boot_status(CONFIG_MCUBOOT_MCUBOOT_IMAGE_NUMBER, &img_hdr, p_fa);
     if (rc != 0)
     {
         LOG_ERR("Failed to add image data to shared area");
     }
 #endif /* MCUBOOT_MEASURED_BOOT */
+    /* Digests and signers of the images verified during their installation, so they are not hashed again */
+    if (!mcuboot_img_measure_export())
+    {
+        LOG_ERR("Failed to add image measurements to shared memory area.");
+    }
 
     const struct image_max_size max_app_sizes[BOOT_IMAGE_NUMBER] = {
         [0] = {
@@ -120,6 +127,10 @@ boot_add_shared_data(const slot_id_t active_slot, const fa_id_t active_fa_id, co
         LOG_ERR("Failed to add data to shared memory area.");
         return false;
     }
+    if (!mcuboot_img_stats_export())
+    {
+        LOG_ERR("Failed to add install stats to shared memory area.");
+    }
 #endif /* MCUBOOT_DATA_SHARING */
 
 #else /* MCUBOOT_MEASURED_BOOT || MCUBOOT_DATA_SHARING */
@@ -0,0 +1,101 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#include "mcuboot_img_journal.h"
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/logging/log.h>
+#include <bootutil/image.h>
+#include "btldr_fs.h"
+
+LOG_MODULE_DECLARE(B0, LOG_LEVEL_INF);
+
+#define MCUBOOT_IMG_JOURNAL_FILE_NAME "mcuboot_copy.jnl"
+#define MCUBOOT_IMG_JOURNAL_MAGIC     0x4A4E4C31U /* "JNL1" */
+
+/**
+ * Progress of an image copy, stored in LittleFS.
+ * The source file is identified by its size and by the hash of the validated image,
+ * so a journal left by an interrupted copy of another file is never used.
+ */
+typedef struct mcuboot_img_journal_t
+{
+    uint32_t magic;
+    uint32_t fa_id;
+    uint32_t file_size;
+    uint8_t  file_hash[IMAGE_HASH_SIZE];
+    uint32_t resume_off; /* All sectors below this offset have been written and verified */
+    uint32_t crc;        /* CRC32 of all the previous fields */
+} mcuboot_img_journal_t;
+
+static uint32_t
+mcuboot_img_journal_calc_crc(const mcuboot_img_journal_t* const p_journal)
+{
+    return crc32_ieee((const uint8_t*)p_journal, offsetof(mcuboot_img_journal_t, crc));
+}
+
+bool
+mcuboot_img_journal_load(
+    const fa_id_t        fa_id_dst,
+    const uint8_t* const p_file_hash,
+    uint32_t* const      p_file_size,
+    uint32_t* const      p_resume_off)
+{
+    mcuboot_img_journal_t journal = { 0 };
+    if (!btldr_fs_is_file_exist(MCUBOOT_IMG_JOURNAL_FILE_NAME))
+    {
+        return false;
+    }
+    if (!btldr_fs_read_file(MCUBOOT_IMG_JOURNAL_FILE_NAME, &journal, sizeof(journal)))
+    {
+        return false;
+    }
+    if ((MCUBOOT_IMG_JOURNAL_MAGIC != journal.magic) || (mcuboot_img_journal_calc_crc(&journal) != journal.crc))
+    {
+        LOG_WRN("Copy journal is corrupted");
+        return false;
+    }
+    if ((fa_id_dst != (fa_id_t)journal.fa_id) || (0 != memcmp(journal.file_hash, p_file_hash, IMAGE_HASH_SIZE)))
+    {
+        LOG_INF("Copy journal belongs to another image");
+        return false;
+    }
+    *p_file_size  = journal.file_size;
+    *p_resume_off = journal.resume_off;
+    return true;
+}
+
+bool
+mcuboot_img_journal_save(
+    const fa_id_t        fa_id_dst,
+    const uint8_t* const p_file_hash,
+    const uint32_t       file_size,
+    const uint32_t       resume_off)
+{
+    mcuboot_img_journal_t journal = {
+        .magic      = MCUBOOT_IMG_JOURNAL_MAGIC,
+        .fa_id      = (uint32_t)fa_id_dst,
+        .file_size  = file_size,
+        .resume_off = resume_off,
+    };
+    memcpy(journal.file_hash, p_file_hash, IMAGE_HASH_SIZE);
+    journal.crc = mcuboot_img_journal_calc_crc(&journal);
+    if (!btldr_fs_write_file(MCUBOOT_IMG_JOURNAL_FILE_NAME, &journal, sizeof(journal)))
+    {
+        LOG_WRN("Failed to save copy journal at offset 0x%08" PRIx32, resume_off);
+        return false;
+    }
+    return true;
+}
+
+void
+mcuboot_img_journal_remove(void)
+{
+    if (btldr_fs_is_file_exist(MCUBOOT_IMG_JOURNAL_FILE_NAME))
+    {
+        (void)btldr_fs_unlink_file(MCUBOOT_IMG_JOURNAL_FILE_NAME);
+    }
+}
@@ -0,0 +1,48 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#ifndef MCUBOOT_IMG_JOURNAL_H
+#define MCUBOOT_IMG_JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ruuvi_fa_id.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Load the copy journal and check that it belongs to the given destination and source image.
+ * @param fa_id_dst Flash area ID of the destination slot.
+ * @param p_file_hash Hash of the image in the update file (IMAGE_HASH_SIZE bytes).
+ * @param p_file_size Pointer to store the size of the update file recorded in the journal.
+ * @param p_resume_off Pointer to store the offset of the first sector which has not been written and verified yet.
+ * @return true if a matching journal exists.
+ */
+bool
+mcuboot_img_journal_load(
+    const fa_id_t        fa_id_dst,
+    const uint8_t* const p_file_hash,
+    uint32_t* const      p_file_size,
+    uint32_t* const      p_resume_off);
+
+/**
+ * Record that all sectors of the destination below resume_off have been written and verified.
+ */
+bool
+mcuboot_img_journal_save(
+    const fa_id_t        fa_id_dst,
+    const uint8_t* const p_file_hash,
+    const uint32_t       file_size,
+    const uint32_t       resume_off);
+
+void
+mcuboot_img_journal_remove(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MCUBOOT_IMG_JOURNAL_H
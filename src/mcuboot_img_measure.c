@@ -0,0 +1,223 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#include "mcuboot_img_measure.h"
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/logging/log.h>
+#include <bootutil/boot_status.h>
+#include <bootutil/crypto/sha.h>
+#include "mcuboot_fa_utils.h"
+#include "zephyr_api.h"
+
+LOG_MODULE_DECLARE(B0, LOG_LEVEL_INF);
+
+#define MCUBOOT_IMG_MEASURE_MAGIC 0x4D534D54U /* "MSMT" */
+
+#define MCUBOOT_IMG_MEASURE_READ_BUF_SIZE 64
+
+/**
+ * Measurements of the images verified during their installation.
+ * The record is kept in RAM which is not initialized on startup, so it survives warm resets,
+ * but it can be overwritten by B0, hence the magic and the CRC.
+ * The application can write this RAM too, so only the image hashes are kept here, and everything else
+ * which is exported is read from the slot.
+ * Unlike the installation statistics, the measurements are exported on every boot
+ * as long as the slot still contains the recorded image.
+ */
+typedef struct mcuboot_img_measure_retained_t
+{
+    uint32_t              magic;
+    uint32_t              cnt;
+    mcuboot_img_measure_t slots[MCUBOOT_IMG_MEASURE_MAX_SLOTS];
+    uint32_t              crc; /* CRC32 of all the previous fields */
+} mcuboot_img_measure_retained_t;
+
+static __noinit mcuboot_img_measure_retained_t g_img_measure_retained;
+
+static uint32_t
+mcuboot_img_measure_calc_crc(const mcuboot_img_measure_retained_t* const p_retained)
+{
+    return crc32_ieee((const uint8_t*)p_retained, offsetof(mcuboot_img_measure_retained_t, crc));
+}
+
+static bool
+mcuboot_img_measure_is_retained_valid(void)
+{
+    return (MCUBOOT_IMG_MEASURE_MAGIC == g_img_measure_retained.magic)
+           && (g_img_measure_retained.cnt <= MCUBOOT_IMG_MEASURE_MAX_SLOTS)
+           && (mcuboot_img_measure_calc_crc(&g_img_measure_retained) == g_img_measure_retained.crc);
+}
+
+static void
+mcuboot_img_measure_remove(const uint32_t idx)
+{
+    g_img_measure_retained.cnt -= 1;
+    g_img_measure_retained.slots[idx] = g_img_measure_retained.slots[g_img_measure_retained.cnt];
+    memset(&g_img_measure_retained.slots[g_img_measure_retained.cnt], 0, sizeof(mcuboot_img_measure_t));
+}
+
+/**
+ * Get the hash of the signer's key: the key hash TLV, or the hash of the public key TLV (MCUBOOT_HW_KEY).
+ */
+static bool
+mcuboot_img_measure_get_key_hash(
+    const struct flash_area* const   p_fa,
+    const struct image_header* const p_hdr,
+    uint8_t* const                   p_key_hash)
+{
+    uint32_t tlv_off = 0;
+    uint16_t tlv_len = 0;
+    if (find_image_tlv_in_flash_area(p_fa, p_hdr, IMAGE_TLV_KEYHASH, &tlv_off, &tlv_len))
+    {
+        return (IMAGE_HASH_SIZE == tlv_len) && (0 == flash_area_read(p_fa, tlv_off, p_key_hash, IMAGE_HASH_SIZE));
+    }
+    if (!find_image_tlv_in_flash_area(p_fa, p_hdr, IMAGE_TLV_PUBKEY, &tlv_off, &tlv_len))
+    {
+        return false;
+    }
+    /* The internal flash is memory-mapped, so the public key is hashed in place. Other flash devices are read. */
+    bool                 is_read = true;
+    bootutil_sha_context sha_ctx = { 0 };
+    bootutil_sha_init(&sha_ctx);
+    if (is_flash_area_memory_mapped(p_fa))
+    {
+        const uintptr_t addr = (uintptr_t)(CONFIG_FLASH_BASE_ADDRESS + p_fa->fa_off + tlv_off);
+        bootutil_sha_update(&sha_ctx, (const void*)addr, tlv_len); // NOSONAR: internal flash is memory-mapped
+    }
+    else
+    {
+        uint8_t buf[MCUBOOT_IMG_MEASURE_READ_BUF_SIZE];
+        for (uint32_t off = 0; is_read && (off < tlv_len); off += sizeof(buf))
+        {
+            const size_t rd_len = ((tlv_len - off) > sizeof(buf)) ? sizeof(buf) : (tlv_len - off);
+            is_read             = (0 == flash_area_read(p_fa, (off_t)(tlv_off + off), buf, rd_len));
+            if (is_read)
+            {
+                bootutil_sha_update(&sha_ctx, buf, rd_len);
+            }
+        }
+    }
+    bootutil_sha_finish(&sha_ctx, p_key_hash);
+    bootutil_sha_drop(&sha_ctx);
+    return is_read;
+}
+
+void
+mcuboot_img_measure_invalidate(const fa_id_t fa_id)
+{
+    if (!mcuboot_img_measure_is_retained_valid())
+    {
+        memset(&g_img_measure_retained, 0, sizeof(g_img_measure_retained));
+        g_img_measure_retained.magic = MCUBOOT_IMG_MEASURE_MAGIC;
+    }
+    for (uint32_t i = 0; i < g_img_measure_retained.cnt; ++i)
+    {
+        if ((uint32_t)fa_id == g_img_measure_retained.slots[i].fa_id)
+        {
+            mcuboot_img_measure_remove(i);
+            break;
+        }
+    }
+    g_img_measure_retained.crc = mcuboot_img_measure_calc_crc(&g_img_measure_retained);
+}
+
+void
+mcuboot_img_measure_record(const fa_id_t fa_id, const uint8_t* const p_img_hash)
+{
+    mcuboot_img_measure_invalidate(fa_id);
+    if (g_img_measure_retained.cnt >= MCUBOOT_IMG_MEASURE_MAX_SLOTS)
+    {
+        LOG_ERR("No room for the measurement of %s", get_image_slot_name(fa_id));
+        return;
+    }
+
+    mcuboot_img_measure_t* const p_slot = &g_img_measure_retained.slots[g_img_measure_retained.cnt];
+    memset(p_slot, 0, sizeof(*p_slot));
+    p_slot->fa_id = (uint32_t)fa_id;
+    memcpy(p_slot->img_hash, p_img_hash, IMAGE_HASH_SIZE);
+
+    g_img_measure_retained.cnt += 1;
+    g_img_measure_retained.crc = mcuboot_img_measure_calc_crc(&g_img_measure_retained);
+}
+
+/**
+ * Check that the slot still contains the recorded image.
+ * Only the hash TLV is compared with the recorded hash, the image itself is not hashed again.
+ */
+static bool
+mcuboot_img_measure_is_slot_unchanged(const mcuboot_img_measure_t* const p_slot)
+{
+    uint8_t hash[IMAGE_HASH_SIZE];
+    return load_image_hash_tlv((fa_id_t)p_slot->fa_id, EXPECTED_HASH_TLV, hash)
+           && (0 == memcmp(hash, p_slot->img_hash, IMAGE_HASH_SIZE));
+}
+
+/**
+ * Fill in the hash of the signer's key from the image in the slot, all zeros if it is not known.
+ */
+static void
+mcuboot_img_measure_load_key_hash(mcuboot_img_measure_t* const p_measure)
+{
+    const fa_id_t            fa_id   = (fa_id_t)p_measure->fa_id;
+    const struct flash_area* p_fa    = NULL;
+    struct image_header      img_hdr = { 0 };
+    if ((0 == flash_area_open(fa_id, &p_fa)) && (0 == boot_image_load_header(p_fa, &img_hdr)))
+    {
+        if (!mcuboot_img_measure_get_key_hash(p_fa, &img_hdr, p_measure->key_hash))
+        {
+            LOG_WRN("Key TLV not found in %s, the signer is not exported", get_image_slot_name(fa_id));
+            memset(p_measure->key_hash, 0, sizeof(p_measure->key_hash));
+        }
+    }
+    else
+    {
+        LOG_WRN("Failed to read image header of %s, the signer is not exported", get_image_slot_name(fa_id));
+    }
+    if (NULL != p_fa)
+    {
+        flash_area_close(p_fa);
+    }
+}
+
+bool
+mcuboot_img_measure_export(void)
+{
+    if (!mcuboot_img_measure_is_retained_valid())
+    {
+        return true;
+    }
+    bool     res = true;
+    uint32_t i   = 0;
+    while (i < g_img_measure_retained.cnt)
+    {
+        const mcuboot_img_measure_t* const p_slot = &g_img_measure_retained.slots[i];
+        if (!mcuboot_img_measure_is_slot_unchanged(p_slot))
+        {
+            LOG_INF("Image in %s has changed, drop its measurement", get_image_slot_name((fa_id_t)p_slot->fa_id));
+            mcuboot_img_measure_remove(i);
+            continue;
+        }
+        mcuboot_img_measure_t measure = *p_slot;
+        mcuboot_img_measure_load_key_hash(&measure);
+        const zephyr_api_ret_t rc = boot_add_data_to_shared_area(
+            MCUBOOT_IMG_MEASURE_TLV_MAJOR,
+            (uint16_t)measure.fa_id,
+            sizeof(measure),
+            (const uint8_t*)&measure);
+        if (0 != rc)
+        {
+            LOG_ERR("Failed to add image measurement to shared area, rc=%d", rc);
+            res = false;
+            break;
+        }
+        i += 1;
+    }
+    g_img_measure_retained.crc = mcuboot_img_measure_calc_crc(&g_img_measure_retained);
+    return res;
+}
@@ -0,0 +1,83 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#ifndef MCUBOOT_IMG_MEASURE_H
+#define MCUBOOT_IMG_MEASURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <bootutil/image.h>
+#include "ruuvi_fa_id.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Major TLV type of the image measurements in the MCUboot shared data area,
+ * the minor TLV type is the flash area ID of the slot. */
+#define MCUBOOT_IMG_MEASURE_TLV_MAJOR 0xD
+
+/* Max number of measured slots: s0, s1, fw_loader and app */
+#define MCUBOOT_IMG_MEASURE_MAX_SLOTS 4
+
+/**
+ * Measurement of the image installed in a slot, exported as is in the MCUboot shared data area.
+ */
+typedef struct mcuboot_img_measure_t
+{
+    uint32_t fa_id;
+    uint8_t  img_hash[IMAGE_HASH_SIZE]; /* Hash of the image which was verified by the bootloader */
+    uint8_t  key_hash[IMAGE_HASH_SIZE]; /* Hash of the public key of the signer, all zeros if not known */
+} mcuboot_img_measure_t;
+
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_MEASURE)
+
+/**
+ * Forget the measurement of the slot before it is overwritten.
+ */
+void
+mcuboot_img_measure_invalidate(const fa_id_t fa_id);
+
+/**
+ * Save the hash of the image verified during its installation in the retained RAM.
+ */
+void
+mcuboot_img_measure_record(const fa_id_t fa_id, const uint8_t* const p_img_hash);
+
+/**
+ * Add the measurements of the slots which still contain the recorded images to the MCUboot shared data area.
+ * The hash of the signer's key is taken from the key TLV of the image in the slot.
+ */
+bool
+mcuboot_img_measure_export(void);
+
+#else
+
+static inline void
+mcuboot_img_measure_invalidate(const fa_id_t fa_id)
+{
+    (void)fa_id;
+}
+
+static inline void
+mcuboot_img_measure_record(const fa_id_t fa_id, const uint8_t* const p_img_hash)
+{
+    (void)fa_id;
+    (void)p_img_hash;
+}
+
+static inline bool
+mcuboot_img_measure_export(void)
+{
+    return true;
+}
+
+#endif // CONFIG_RUUVI_MCUBOOT_IMG_MEASURE
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MCUBOOT_IMG_MEASURE_H
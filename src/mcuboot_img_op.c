@@ -1,60 +1,898 @@
 #include "mcuboot_img_op.h"
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
 #include <zephyr/storage/flash_map.h>
-#include <zephyr/fs/fs.h>
+#include <zephyr/drivers/flash.h>
 #include <zephyr/logging/log.h>
 #include <cmsis_gcc.h>
+#include <bootutil/image.h>
+#include <bootutil/crypto/sha.h>
+#include <bootutil/fault_injection_hardening.h>
+#include "mcuboot_fa_utils.h"
+#include "mcuboot_img_journal.h"
+#include "mcuboot_img_stats.h"
 #include "zephyr_api.h"
 
 LOG_MODULE_DECLARE(B0, LOG_LEVEL_INF);
 
-#define TMP_BUF_SIZE 256
+#define IMG_OP_CHUNK_SIZE CONFIG_RUUVI_MCUBOOT_IMG_OP_CHUNK_SIZE
 
-typedef bool (*cb_img_process_t)(
+_Static_assert(0 == (IMG_OP_CHUNK_SIZE % sizeof(uint32_t)), "IMG_OP_CHUNK_SIZE must be a multiple of 4");
+
+/* Blank gaps shorter than this (in 4-byte words) are programmed together with the surrounding data */
+#define IMG_OP_BLANK_GAP_MIN_WORDS 8
+
+typedef enum img_op_mode_e
+{
+    IMG_OP_MODE_CMP,       /* Compare the partition with the file */
+    IMG_OP_MODE_COPY,      /* Erase and program every sector covered by the image */
+    IMG_OP_MODE_COPY_DIFF, /* Erase and program only the sectors whose content differs from the file */
+} img_op_mode_e;
+
+/**
+ * State of the copy engine. The destination is processed sector by sector (similar to Zephyr's stream_flash):
+ * each chunk read from the file belongs to exactly one sector, and a sector is erased only when the first chunk
+ * that has to be programmed into it arrives.
+ */
+typedef struct img_op_ctx_t
+{
+    const struct flash_area* p_fa;
+    const struct device*     p_flash_dev;
+    img_op_mode_e            mode;
+    off_t                    sector_off;         /* Offset of the current sector in the partition */
+    size_t                   sector_size;        /* Size of the current sector, 0 if not known yet */
+    bool                     flag_sector_erased; /* The current sector has been erased during this copy */
+    uint32_t                 cnt_sectors_written;
+    uint32_t                 cnt_sectors_skipped;
+    uint32_t                 bytes_elided;       /* Bytes not programmed, because they are 0xFF */
+    uint32_t                 cnt_sector_retries; /* Number of retries for the current sector */
+    uint32_t                 cnt_retries;        /* Total number of sector retries */
+} img_op_ctx_t;
+
+static __aligned(4) uint8_t g_img_op_flash_buf[IMG_OP_CHUNK_SIZE];
+
+static bool
+cb_img_write(
     const struct flash_area* p_fa_dst,
     const off_t              offset,
     const uint8_t*           p_src_img_data_buf,
-    const size_t             buf_len);
+    const size_t             buf_len)
+{
+    const uint32_t         t_start = mcuboot_img_stats_phase_begin();
+    const zephyr_api_ret_t rc      = flash_area_write(p_fa_dst, offset, p_src_img_data_buf, buf_len);
+    mcuboot_img_stats_phase_end(MCUBOOT_IMG_STATS_PHASE_PROGRAM, t_start, buf_len);
+    if (0 != rc)
+    {
+        LOG_ERR("Failed to write at address 0x%08x, rc=%d", (unsigned)(p_fa_dst->fa_off + offset), rc);
+        return false;
+    }
+    return true;
+}
 
 static bool
-img_process(
-    const fa_id_t           fa_id_dst,
-    struct fs_file_t* const p_file_src,
-    const bool              flag_erase_dst,
-    cb_img_process_t        cb_img_process)
+cb_img_cmp(
+    const struct flash_area* p_fa_dst,
+    const off_t              offset,
+    const uint8_t*           p_src_img_data_buf,
+    const size_t             buf_len)
 {
-    static uint8_t tmp_buf1[TMP_BUF_SIZE];
+    const uint32_t         t_start = mcuboot_img_stats_phase_begin();
+    const zephyr_api_ret_t rc      = flash_area_read(p_fa_dst, offset, g_img_op_flash_buf, buf_len);
+    if (0 != rc)
+    {
+        LOG_ERR("Failed to read flash at address 0x%08x, rc=%d", (unsigned)(p_fa_dst->fa_off + offset), rc);
+        return false;
+    }
 
-    const struct flash_area* p_fa_dst = NULL;
+    const bool is_equal = (0 == memcmp(p_src_img_data_buf, g_img_op_flash_buf, buf_len));
+    mcuboot_img_stats_phase_end(MCUBOOT_IMG_STATS_PHASE_COMPARE, t_start, buf_len);
+    if (!is_equal)
+    {
+        LOG_DBG("memcmp failed at address 0x%08x", (unsigned)(p_fa_dst->fa_off + offset));
+        LOG_HEXDUMP_DBG(p_src_img_data_buf, buf_len, "src:");
+        LOG_HEXDUMP_DBG(g_img_op_flash_buf, buf_len, "dst:");
+        return false;
+    }
+    return true;
+}
 
-    int32_t rc = flash_area_open(fa_id_dst, &p_fa_dst);
+/**
+ * Check whether the buffer contains only 0xFF (the erased value of the internal flash).
+ * The bulk of the buffer is checked word by word, four words per iteration.
+ */
+static bool
+img_op_is_blank(const uint8_t* const p_buf, const size_t buf_len)
+{
+    const uint8_t*       p_cur = p_buf;
+    const uint8_t* const p_end = p_buf + buf_len;
+
+    while ((p_cur < p_end) && (0 != ((uintptr_t)p_cur % sizeof(uint32_t))))
+    {
+        if (UINT8_MAX != *p_cur)
+        {
+            return false;
+        }
+        p_cur += 1;
+    }
+
+    const uint32_t* p_word    = (const uint32_t*)(const void*)p_cur;
+    const size_t    num_words = (size_t)(p_end - p_cur) / sizeof(uint32_t);
+    size_t          idx       = 0;
+    for (; (idx + 4) <= num_words; idx += 4)
+    {
+        if (UINT32_MAX != (p_word[idx] & p_word[idx + 1] & p_word[idx + 2] & p_word[idx + 3]))
+        {
+            return false;
+        }
+    }
+    for (; idx < num_words; ++idx)
+    {
+        if (UINT32_MAX != p_word[idx])
+        {
+            return false;
+        }
+    }
+    p_cur += num_words * sizeof(uint32_t);
+
+    while (p_cur < p_end)
+    {
+        if (UINT8_MAX != *p_cur)
+        {
+            return false;
+        }
+        p_cur += 1;
+    }
+    return true;
+}
+
+/**
+ * Program a chunk into the freshly erased sector, skipping runs of 0xFF words which are already in place.
+ * Short blank gaps are programmed anyway to avoid splitting the chunk into many small writes.
+ * The chunk buffer is word-aligned and its length is padded to the 4-byte write block,
+ * so all programmed runs keep the alignment of the original write.
+ */
+static bool
+img_op_write_non_blank(
+    img_op_ctx_t* const  p_ctx,
+    const off_t          offset,
+    const uint8_t* const p_buf,
+    const size_t         buf_len)
+{
+    const uint32_t* const p_words   = (const uint32_t*)(const void*)p_buf;
+    const size_t          num_words = buf_len / sizeof(uint32_t);
+
+    size_t idx           = 0;
+    size_t bytes_written = 0;
+    while (idx < num_words)
+    {
+        while ((idx < num_words) && (UINT32_MAX == p_words[idx]))
+        {
+            idx += 1;
+        }
+        if (idx >= num_words)
+        {
+            break;
+        }
+        const size_t run_start = idx;
+        size_t       run_end   = idx;
+        while ((idx < num_words) && ((idx - run_end) < IMG_OP_BLANK_GAP_MIN_WORDS))
+        {
+            if (UINT32_MAX != p_words[idx])
+            {
+                run_end = idx + 1;
+            }
+            idx += 1;
+        }
+        const size_t run_len = (run_end - run_start) * sizeof(uint32_t);
+        const size_t run_off = run_start * sizeof(uint32_t);
+        if (!cb_img_write(p_ctx->p_fa, offset + (off_t)run_off, &p_buf[run_off], run_len))
+        {
+            return false;
+        }
+        bytes_written += run_len;
+        idx = run_end;
+    }
+    p_ctx->bytes_elided += (uint32_t)(buf_len - bytes_written);
+    return true;
+}
+
+static bool
+img_op_is_flash_blank(const struct flash_area* const p_fa, const off_t offset, const size_t len, bool* const p_is_blank)
+{
+    const uint32_t t_start = mcuboot_img_stats_phase_begin();
+    *p_is_blank            = true;
+    for (size_t off = 0; off < len; off += sizeof(g_img_op_flash_buf))
+    {
+        const size_t rd_len = ((len - off) > sizeof(g_img_op_flash_buf)) ? sizeof(g_img_op_flash_buf) : (len - off);
+
+        const zephyr_api_ret_t rc = flash_area_read(p_fa, offset + (off_t)off, g_img_op_flash_buf, rd_len);
+        if (0 != rc)
+        {
+            LOG_ERR(
+                "Failed to read flash at address 0x%08" PRIxPTR ", rc=%d",
+                (uintptr_t)(p_fa->fa_off + offset + (off_t)off),
+                rc);
+            return false;
+        }
+        if (!img_op_is_blank(g_img_op_flash_buf, rd_len))
+        {
+            *p_is_blank = false;
+            break;
+        }
+    }
+    mcuboot_img_stats_phase_end(MCUBOOT_IMG_STATS_PHASE_COMPARE, t_start, len);
+    return true;
+}
+
+static bool
+img_op_get_sector(
+    const img_op_ctx_t* const p_ctx,
+    const off_t               offset,
+    off_t* const              p_sector_off,
+    size_t* const             p_sector_size)
+{
+    struct flash_pages_info page_info = { 0 };
+
+    const zephyr_api_ret_t rc = flash_get_page_info_by_offs(
+        p_ctx->p_flash_dev,
+        p_ctx->p_fa->fa_off + offset,
+        &page_info);
     if (0 != rc)
     {
-        LOG_ERR("Failed to open flash area %d, rc=%d", fa_id_dst, rc);
+        LOG_ERR(
+            "Failed to get flash page info at address 0x%08" PRIxPTR ", rc=%d",
+            (uintptr_t)(p_ctx->p_fa->fa_off + offset),
+            rc);
+        return false;
+    }
+    *p_sector_off  = page_info.start_offset - p_ctx->p_fa->fa_off;
+    *p_sector_size = page_info.size;
+    return true;
+}
+
+static bool
+img_op_erase_sector(const img_op_ctx_t* const p_ctx, const off_t sector_off, const size_t sector_size)
+{
+    const uint32_t         t_start = mcuboot_img_stats_phase_begin();
+    const zephyr_api_ret_t rc      = flash_area_erase(p_ctx->p_fa, sector_off, sector_size);
+    mcuboot_img_stats_phase_end(MCUBOOT_IMG_STATS_PHASE_ERASE, t_start, sector_size);
+    if (0 != rc)
+    {
+        LOG_ERR(
+            "Failed to erase sector at address 0x%08" PRIxPTR " (size 0x%08" PRIx32 "), rc=%d",
+            (uintptr_t)(p_ctx->p_fa->fa_off + sector_off),
+            (uint32_t)sector_size,
+            rc);
+        return false;
+    }
+    return true;
+}
+
+static off_t
+img_op_sector_end(const img_op_ctx_t* const p_ctx)
+{
+    return p_ctx->sector_off + (off_t)p_ctx->sector_size;
+}
+
+/**
+ * Make the sector containing the given offset the current one.
+ */
+static bool
+img_op_enter_sector(img_op_ctx_t* const p_ctx, const off_t offset)
+{
+    if ((0 != p_ctx->sector_size) && (offset >= p_ctx->sector_off) && (offset < img_op_sector_end(p_ctx)))
+    {
+        return true;
+    }
+    if (!img_op_get_sector(p_ctx, offset, &p_ctx->sector_off, &p_ctx->sector_size))
+    {
+        return false;
+    }
+    p_ctx->flag_sector_erased = false;
+    p_ctx->cnt_sector_retries = 0;
+    return true;
+}
+
+/**
+ * In differential mode, check whether the chunk matches the destination.
+ * For the last chunk of the image the rest of the sector must also be blank,
+ * so that a skipped sector is byte-exact with a freshly programmed one.
+ */
+static bool
+img_op_is_chunk_unchanged(
+    const img_op_ctx_t* const p_ctx,
+    const off_t               offset,
+    const uint8_t* const      p_buf,
+    const size_t              buf_len,
+    const bool                flag_last_chunk)
+{
+    if (!cb_img_cmp(p_ctx->p_fa, offset, p_buf, buf_len))
+    {
         return false;
     }
+    const off_t chunk_end = offset + (off_t)buf_len;
+    if (flag_last_chunk && (chunk_end < img_op_sector_end(p_ctx)))
+    {
+        bool is_blank = false;
+        if (!img_op_is_flash_blank(p_ctx->p_fa, chunk_end, (size_t)(img_op_sector_end(p_ctx) - chunk_end), &is_blank))
+        {
+            return false;
+        }
+        return is_blank;
+    }
+    return true;
+}
+
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_VERIFY)
+/**
+ * Compare the programmed chunk with the source buffer.
+ * The internal flash is memory-mapped, so the data is read back directly, without copying it into RAM
+ * and without reading the file once more. Other flash devices are read with flash_area_read().
+ */
+static bool
+img_op_verify_chunk(
+    const img_op_ctx_t* const p_ctx,
+    const off_t               offset,
+    const uint8_t* const      p_buf,
+    const size_t              buf_len)
+{
+    const uint32_t t_start = mcuboot_img_stats_phase_begin();
+    bool           is_ok   = false;
+    if (is_flash_area_memory_mapped(p_ctx->p_fa))
+    {
+        const uintptr_t      addr    = (uintptr_t)(CONFIG_FLASH_BASE_ADDRESS + p_ctx->p_fa->fa_off + offset);
+        const uint8_t* const p_flash = (const uint8_t*)addr; // NOSONAR: internal flash is memory-mapped
+        is_ok                        = (0 == memcmp(p_flash, p_buf, buf_len));
+    }
+    else
+    {
+        is_ok = (0 == flash_area_read(p_ctx->p_fa, offset, g_img_op_flash_buf, buf_len))
+                && (0 == memcmp(g_img_op_flash_buf, p_buf, buf_len));
+    }
+    mcuboot_img_stats_phase_end(MCUBOOT_IMG_STATS_PHASE_VERIFY, t_start, buf_len);
+    if (!is_ok)
+    {
+        LOG_WRN("Verification failed at address 0x%08x", (unsigned)(p_ctx->p_fa->fa_off + offset));
+        return false;
+    }
+    return true;
+}
+#endif // CONFIG_RUUVI_MCUBOOT_IMG_OP_VERIFY
+
+/**
+ * Process one chunk of the image which belongs to the current sector.
+ *
+ * @param p_ctx Pointer to the copy engine state.
+ * @param offset Offset of the chunk in the partition.
+ * @param p_buf Pointer to the chunk data (padded to the write block size).
+ * @param buf_len Length of the chunk data.
+ * @param flag_last_chunk true if this chunk is the last one of the image.
+ * @param p_flag_rewind Set to true if the sector has to be programmed again from its beginning,
+ *                      because its first chunks were skipped as unchanged before a difference was found,
+ *                      or because the sector has been erased again after a failed verification.
+ * @return true on success, false on error.
+ */
+static bool
+img_op_process_chunk(
+    img_op_ctx_t* const  p_ctx,
+    const off_t          offset,
+    const uint8_t* const p_buf,
+    const size_t         buf_len,
+    const bool           flag_last_chunk,
+    bool* const          p_flag_rewind)
+{
+    *p_flag_rewind = false;
+
+    const bool flag_sector_end = flag_last_chunk || ((offset + (off_t)buf_len) >= img_op_sector_end(p_ctx));
+
+    if (IMG_OP_MODE_CMP == p_ctx->mode)
+    {
+        if (!cb_img_cmp(p_ctx->p_fa, offset, p_buf, buf_len))
+        {
+            LOG_ERR("Flash content differs from file at address 0x%08x", (unsigned)(p_ctx->p_fa->fa_off + offset));
+            return false;
+        }
+        return true;
+    }
 
-    rc = fs_seek(p_file_src, 0, FS_SEEK_END);
+    if (!p_ctx->flag_sector_erased)
+    {
+        if ((IMG_OP_MODE_COPY_DIFF == p_ctx->mode)
+            && img_op_is_chunk_unchanged(p_ctx, offset, p_buf, buf_len, flag_last_chunk))
+        {
+            if (flag_sector_end)
+            {
+                p_ctx->cnt_sectors_skipped += 1;
+            }
+            return true;
+        }
+        if (!img_op_erase_sector(p_ctx, p_ctx->sector_off, p_ctx->sector_size))
+        {
+            return false;
+        }
+        p_ctx->flag_sector_erased = true;
+        if (offset != p_ctx->sector_off)
+        {
+            /* The beginning of the sector was skipped as unchanged, but it has been erased now. */
+            *p_flag_rewind = true;
+            return true;
+        }
+    }
+
+    if (!img_op_write_non_blank(p_ctx, offset, p_buf, buf_len))
+    {
+        return false;
+    }
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_VERIFY)
+    while (!img_op_verify_chunk(p_ctx, offset, p_buf, buf_len))
+    {
+        if (p_ctx->cnt_sector_retries >= CONFIG_RUUVI_MCUBOOT_IMG_OP_VERIFY_RETRIES)
+        {
+            LOG_ERR(
+                "Failed to program sector at address 0x%08x after %u retries",
+                (unsigned)(p_ctx->p_fa->fa_off + p_ctx->sector_off),
+                (unsigned)p_ctx->cnt_sector_retries);
+            return false;
+        }
+        p_ctx->cnt_sector_retries += 1;
+        p_ctx->cnt_retries += 1;
+        if (!img_op_erase_sector(p_ctx, p_ctx->sector_off, p_ctx->sector_size))
+        {
+            return false;
+        }
+        if (offset != p_ctx->sector_off)
+        {
+            /* The beginning of the sector came with the previous chunks, so re-read it from the file. */
+            *p_flag_rewind = true;
+            return true;
+        }
+        if (!img_op_write_non_blank(p_ctx, offset, p_buf, buf_len))
+        {
+            return false;
+        }
+    }
+#endif // CONFIG_RUUVI_MCUBOOT_IMG_OP_VERIFY
+    if (flag_sector_end)
+    {
+        p_ctx->cnt_sectors_written += 1;
+    }
+    return true;
+}
+
+/**
+ * Erase the remains of the previous image beyond the end of the new one.
+ * Sectors which are already blank are skipped, so that install time and flash wear
+ * depend on the size of the images and not on the size of the partition.
+ */
+static bool
+img_op_erase_tail(img_op_ctx_t* const p_ctx, const off_t tail_off)
+{
+    const off_t fa_size    = (off_t)p_ctx->p_fa->fa_size;
+    uint32_t    cnt_erased = 0;
+    off_t       offset     = tail_off;
+    while (offset < fa_size)
+    {
+        off_t  sector_off  = 0;
+        size_t sector_size = 0;
+        if (!img_op_get_sector(p_ctx, offset, &sector_off, &sector_size))
+        {
+            return false;
+        }
+        bool is_blank = false;
+        if (!img_op_is_flash_blank(p_ctx->p_fa, sector_off, sector_size, &is_blank))
+        {
+            return false;
+        }
+        if (!is_blank)
+        {
+            if (!img_op_erase_sector(p_ctx, sector_off, sector_size))
+            {
+                return false;
+            }
+            cnt_erased += 1;
+        }
+        offset = sector_off + (off_t)sector_size;
+    }
+    LOG_INF("Erased %" PRIu32 " non-blank sectors beyond the end of the image", cnt_erased);
+    return true;
+}
+
+/**
+ * Read the file, accounting the time in p_read_stats if it is not NULL (reads in the reader thread),
+ * otherwise in the statistics of the image.
+ */
+static bool
+img_op_read_file(
+    file_img_reader_t* const         p_reader,
+    const off_t                      offset,
+    uint8_t* const                   p_buf,
+    const size_t                     len,
+    mcuboot_img_stats_phase_t* const p_read_stats)
+{
+    const uint32_t         t_start = mcuboot_img_stats_phase_begin();
+    const zephyr_api_ret_t rc      = file_img_reader_read(p_reader, (uint32_t)offset, p_buf, len);
+    if (NULL != p_read_stats)
+    {
+        mcuboot_img_stats_phase_end_local(p_read_stats, t_start, len);
+    }
+    else
+    {
+        mcuboot_img_stats_phase_end(MCUBOOT_IMG_STATS_PHASE_READ, t_start, len);
+    }
     if (0 != rc)
     {
-        LOG_ERR("Failed to seek in file, rc=%d", rc);
+        LOG_ERR("Failed to read file at offset 0x%08" PRIxPTR ", rc=%d", (uintptr_t)offset, rc);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Read the chunk which starts at the given offset of the file and pad it with 0xFF to a multiple of 4 bytes.
+ * A chunk never spans two sectors.
+ */
+static bool
+img_op_read_chunk(
+    const img_op_ctx_t* const        p_ctx,
+    file_img_reader_t* const         p_reader,
+    const off_t                      file_size,
+    const off_t                      offset,
+    uint8_t* const                   p_buf,
+    size_t* const                    p_len,
+    mcuboot_img_stats_phase_t* const p_read_stats)
+{
+    off_t  sector_off  = 0;
+    size_t sector_size = 0;
+    if (!img_op_get_sector(p_ctx, offset, &sector_off, &sector_size))
+    {
+        return false;
+    }
+    size_t len = (size_t)(file_size - offset);
+    if (len > IMG_OP_CHUNK_SIZE)
+    {
+        len = IMG_OP_CHUNK_SIZE;
+    }
+    if (len > (size_t)(sector_off + (off_t)sector_size - offset))
+    {
+        len = (size_t)(sector_off + (off_t)sector_size - offset);
+    }
+
+    if (!img_op_read_file(p_reader, offset, p_buf, len, p_read_stats))
+    {
         return false;
     }
-    const off_t src_file_size = fs_tell(p_file_src);
+    // len == 0, len % 4 = 0, padding = 0
+    // len == 1, len % 4 = 1, padding = 3
+    // len == 2, len % 4 = 2, padding = 2
+    // len == 3, len % 4 = 3, padding = 1
+    // len == 4, len % 4 = 0, padding = 0
+    const size_t padding = (0 != (len % 4)) ? (4 - (len % 4)) : 0;
+    if (0 != padding)
+    {
+        memset(&p_buf[len], UINT8_MAX, padding);
+    }
+    *p_len = len;
+    return true;
+}
+
+/**
+ * Source of the image chunks for img_process().
+ * Without the pipeline the chunks are read from the file on demand.
+ * With the pipeline a reader thread reads ahead into a single-producer/single-consumer ring of chunk buffers,
+ * so that reading the external flash (QSPI, DMA-driven) overlaps with programming the internal flash.
+ */
+typedef struct img_op_src_t
+{
+    const img_op_ctx_t* p_ctx;
+    file_img_reader_t*  p_reader;
+    off_t               file_size;
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_PIPELINE)
+    bool         is_pipelined; /* false to read the chunks on demand, as without the pipeline */
+    off_t        read_off;     /* Offset of the next chunk to be read by the reader thread */
+    atomic_t     flag_stop; /* Set by the consumer to stop the reader thread */
+    atomic_t     idx_wr;    /* Incremented only by the reader thread */
+    atomic_t     idx_rd;    /* Incremented only by the consumer */
+    struct k_sem sem_filled;
+    struct k_sem sem_free;
+    bool         is_running;
+    /* Reads of the reader thread, merged into the statistics of the image when the thread is joined */
+    mcuboot_img_stats_phase_t read_stats;
+#endif
+} img_op_src_t;
 
-    rc = fs_seek(p_file_src, 0, FS_SEEK_SET);
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_PIPELINE)
+
+#define IMG_OP_PIPE_DEPTH CONFIG_RUUVI_MCUBOOT_IMG_OP_PIPELINE_DEPTH
+
+/* The reader thread must run ahead of the consumer, so that a new read is started as soon as a buffer is freed */
+#define IMG_OP_PIPE_THREAD_PRIORITY (CONFIG_MAIN_THREAD_PRIORITY - 1)
+
+typedef struct img_op_pipe_slot_t
+{
+    off_t   offset;
+    size_t  len;
+    bool    is_ok;
+    uint8_t buf[IMG_OP_CHUNK_SIZE] __aligned(4);
+} img_op_pipe_slot_t;
+
+static img_op_pipe_slot_t g_img_op_pipe_slots[IMG_OP_PIPE_DEPTH];
+static K_THREAD_STACK_DEFINE(g_img_op_pipe_stack, CONFIG_RUUVI_MCUBOOT_IMG_OP_PIPELINE_STACK_SIZE);
+static struct k_thread g_img_op_pipe_thread;
+
+static void
+img_op_pipe_reader(void* p1, void* p2, void* p3)
+{
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+    img_op_src_t* const p_src = p1;
+
+    while (p_src->read_off < p_src->file_size)
+    {
+        (void)k_sem_take(&p_src->sem_free, K_FOREVER);
+        if (0 != atomic_get(&p_src->flag_stop))
+        {
+            break;
+        }
+        img_op_pipe_slot_t* const p_slot = &g_img_op_pipe_slots[(uint32_t)atomic_get(&p_src->idx_wr)
+                                                                % IMG_OP_PIPE_DEPTH];
+        p_slot->offset = p_src->read_off;
+        p_slot->len    = 0;
+        p_slot->is_ok  = img_op_read_chunk(
+            p_src->p_ctx,
+            p_src->p_reader,
+            p_src->file_size,
+            p_slot->offset,
+            p_slot->buf,
+            &p_slot->len,
+            &p_src->read_stats);
+        (void)atomic_inc(&p_src->idx_wr);
+        k_sem_give(&p_src->sem_filled);
+        if (!p_slot->is_ok)
+        {
+            break;
+        }
+        p_src->read_off += (off_t)p_slot->len;
+    }
+}
+
+static void
+img_op_pipe_stop(img_op_src_t* const p_src)
+{
+    if (!p_src->is_running)
+    {
+        return;
+    }
+    (void)atomic_set(&p_src->flag_stop, 1);
+    k_sem_give(&p_src->sem_free);
+    (void)k_thread_join(&g_img_op_pipe_thread, K_FOREVER);
+    p_src->is_running = false;
+    mcuboot_img_stats_phase_merge(MCUBOOT_IMG_STATS_PHASE_READ, &p_src->read_stats);
+}
+
+static void
+img_op_pipe_start(img_op_src_t* const p_src, const off_t offset)
+{
+    p_src->read_off = offset;
+    memset(&p_src->read_stats, 0, sizeof(p_src->read_stats));
+    (void)atomic_set(&p_src->flag_stop, 0);
+    (void)atomic_set(&p_src->idx_wr, 0);
+    (void)atomic_set(&p_src->idx_rd, 0);
+    (void)k_sem_init(&p_src->sem_filled, 0, IMG_OP_PIPE_DEPTH);
+    (void)k_sem_init(&p_src->sem_free, IMG_OP_PIPE_DEPTH, IMG_OP_PIPE_DEPTH);
+    (void)k_thread_create(
+        &g_img_op_pipe_thread,
+        g_img_op_pipe_stack,
+        K_THREAD_STACK_SIZEOF(g_img_op_pipe_stack),
+        &img_op_pipe_reader,
+        p_src,
+        NULL,
+        NULL,
+        IMG_OP_PIPE_THREAD_PRIORITY,
+        0,
+        K_NO_WAIT);
+    (void)k_thread_name_set(&g_img_op_pipe_thread, "img_op_reader");
+    p_src->is_running = true;
+}
+
+/* The chunks which are read on demand use the first buffer of the ring */
+#define IMG_OP_SRC_BUF (g_img_op_pipe_slots[0].buf)
+#else
+static __aligned(4) uint8_t g_img_op_file_buf[IMG_OP_CHUNK_SIZE];
+
+#define IMG_OP_SRC_BUF (g_img_op_file_buf)
+#endif // CONFIG_RUUVI_MCUBOOT_IMG_OP_PIPELINE
+
+/**
+ * Continue reading the file from the given offset.
+ */
+static bool
+img_op_src_seek(img_op_src_t* const p_src, const off_t offset)
+{
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_PIPELINE)
+    if (p_src->is_pipelined)
+    {
+        img_op_pipe_stop(p_src);
+        img_op_pipe_start(p_src, offset);
+    }
+#else
+    /* The chunks are read at explicit offsets, so there is nothing to do without the reader thread */
+    ARG_UNUSED(p_src);
+    ARG_UNUSED(offset);
+#endif
+    return true;
+}
+
+static void
+img_op_src_close(img_op_src_t* const p_src)
+{
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_PIPELINE)
+    img_op_pipe_stop(p_src);
+#else
+    ARG_UNUSED(p_src);
+#endif
+}
+
+/**
+ * Get the chunk which starts at the given offset.
+ * The buffer is padded with 0xFF to a multiple of 4 bytes and remains valid until img_op_src_release_chunk().
+ */
+static bool
+img_op_src_get_chunk(img_op_src_t* const p_src, const off_t offset, const uint8_t** const pp_buf, size_t* const p_len)
+{
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_PIPELINE)
+    if (p_src->is_pipelined)
+    {
+        (void)k_sem_take(&p_src->sem_filled, K_FOREVER);
+        const img_op_pipe_slot_t* const p_slot = &g_img_op_pipe_slots[(uint32_t)atomic_get(&p_src->idx_rd)
+                                                                      % IMG_OP_PIPE_DEPTH];
+        if (!p_slot->is_ok)
+        {
+            return false;
+        }
+        if (p_slot->offset != offset)
+        {
+            LOG_ERR(
+                "Reader thread returned chunk at offset 0x%08" PRIxPTR ", expected 0x%08" PRIxPTR,
+                (uintptr_t)p_slot->offset,
+                (uintptr_t)offset);
+            return false;
+        }
+        *pp_buf = p_slot->buf;
+        *p_len  = p_slot->len;
+        return true;
+    }
+#endif
+    if (!img_op_read_chunk(p_src->p_ctx, p_src->p_reader, p_src->file_size, offset, IMG_OP_SRC_BUF, p_len, NULL))
+    {
+        return false;
+    }
+    *pp_buf = IMG_OP_SRC_BUF;
+    return true;
+}
+
+static void
+img_op_src_release_chunk(img_op_src_t* const p_src)
+{
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_PIPELINE)
+    if (p_src->is_pipelined)
+    {
+        (void)atomic_inc(&p_src->idx_rd);
+        k_sem_give(&p_src->sem_free);
+    }
+#else
+    ARG_UNUSED(p_src);
+#endif
+}
+
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_JOURNAL)
+/**
+ * Check that the slot holds the image from the file below the given offset.
+ * The journal is a file in LittleFS, so the sectors it reports as written are compared with the file
+ * before they are skipped. This also makes sure that the slot has the version of the image being copied.
+ */
+static bool
+img_op_journal_is_written(
+    const img_op_ctx_t* const p_ctx,
+    file_img_reader_t* const  p_reader,
+    const uint32_t            resume_off)
+{
+    for (uint32_t off = 0; off < resume_off; off += IMG_OP_CHUNK_SIZE)
+    {
+        const size_t len = ((resume_off - off) > IMG_OP_CHUNK_SIZE) ? IMG_OP_CHUNK_SIZE : (resume_off - off);
+        if ((0 != file_img_reader_read(p_reader, off, IMG_OP_SRC_BUF, len))
+            || (!cb_img_cmp(p_ctx->p_fa, (off_t)off, IMG_OP_SRC_BUF, len)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Find the offset at which an interrupted copy of the same image can be resumed.
+ * @return the offset of the first sector which has not been written and verified, 0 if there is nothing to resume.
+ */
+static off_t
+img_op_journal_get_resume_off(
+    img_op_ctx_t* const      p_ctx,
+    file_img_reader_t* const p_reader,
+    const uint8_t* const     p_file_hash,
+    const off_t              src_file_size)
+{
+    uint32_t file_size  = 0;
+    uint32_t resume_off = 0;
+    if (!mcuboot_img_journal_load(p_ctx->p_fa->fa_id, p_file_hash, &file_size, &resume_off))
+    {
+        return 0;
+    }
+    if ((file_size != (uint32_t)src_file_size) || (resume_off > file_size))
+    {
+        LOG_WRN("Copy journal does not match the file, start from the beginning");
+        return 0;
+    }
+    off_t  sector_off  = 0;
+    size_t sector_size = 0;
+    if ((resume_off < p_ctx->p_fa->fa_size)
+        && ((!img_op_get_sector(p_ctx, (off_t)resume_off, &sector_off, &sector_size))
+            || (sector_off != (off_t)resume_off)))
+    {
+        LOG_WRN("Copy journal offset 0x%08" PRIx32 " is not at a sector boundary", resume_off);
+        return 0;
+    }
+    if (!img_op_journal_is_written(p_ctx, p_reader, resume_off))
+    {
+        LOG_WRN(
+            "Flash area %d does not hold the file below offset 0x%08" PRIx32 ", start from the beginning",
+            p_ctx->p_fa->fa_id,
+            resume_off);
+        return 0;
+    }
+    LOG_INF("Resume interrupted copy at offset 0x%08" PRIx32, resume_off);
+    return (off_t)resume_off;
+}
+#endif // CONFIG_RUUVI_MCUBOOT_IMG_OP_JOURNAL
+
+/**
+ * @param p_file_hash Hash of the validated image in the file, used to identify the file in the copy journal.
+ *                    NULL if the copy should not be journaled.
+ * @param img_size Number of bytes to process from the beginning of the file, 0 to process the whole file.
+ */
+static bool
+img_process(
+    const fa_id_t            fa_id_dst,
+    file_img_reader_t* const p_reader,
+    const img_op_mode_e      mode,
+    const uint8_t* const     p_file_hash,
+    const uint32_t           img_size)
+{
+    const struct flash_area* p_fa_dst = NULL;
+
+    int32_t rc = flash_area_open(fa_id_dst, &p_fa_dst);
     if (0 != rc)
     {
-        LOG_ERR("Failed to seek in file, rc=%d", rc);
+        LOG_ERR("Failed to open flash area %d, rc=%d", fa_id_dst, rc);
+        return false;
+    }
+
+    const off_t file_size = (off_t)file_img_reader_get_size(p_reader);
+    if ((off_t)img_size > file_size)
+    {
+        LOG_ERR("Image size %" PRIu32 " is larger than the file size %" PRIu32, img_size, (uint32_t)file_size);
+        flash_area_close(p_fa_dst);
         return false;
     }
+    const off_t src_file_size = (0 != img_size) ? (off_t)img_size : file_size;
 
     LOG_INF(
-        "Copy %" PRIu32 " bytes from file to flash partition %d at offset 0x%08" PRIxPTR,
+        "Copy %" PRIu32 " bytes from file to flash partition %d at offset 0x%08" PRIxPTR ", chunk size %u",
         (uint32_t)src_file_size,
         p_fa_dst->fa_id,
-        p_fa_dst->fa_off);
+        p_fa_dst->fa_off,
+        (unsigned)IMG_OP_CHUNK_SIZE);
 
     if (src_file_size > p_fa_dst->fa_size)
     {
@@ -62,123 +900,340 @@ img_process(
             "File size: %" PRIu32 " is larger than partition size %" PRIu32,
             (uint32_t)src_file_size,
             (uint32_t)p_fa_dst->fa_size);
+        flash_area_close(p_fa_dst);
         return false;
     }
 
-    if (flag_erase_dst)
+    img_op_ctx_t ctx = {
+        .p_fa                = p_fa_dst,
+        .p_flash_dev         = flash_area_get_device(p_fa_dst),
+        .mode                = mode,
+        .sector_off          = 0,
+        .sector_size         = 0,
+        .flag_sector_erased  = false,
+        .cnt_sectors_written = 0,
+        .cnt_sectors_skipped = 0,
+        .bytes_elided        = 0,
+        .cnt_sector_retries  = 0,
+        .cnt_retries         = 0,
+    };
+
+    img_op_src_t src = {
+        .p_ctx     = &ctx,
+        .p_reader  = p_reader,
+        .file_size = src_file_size,
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_PIPELINE)
+        .is_pipelined = true,
+#endif
+    };
+
+    off_t start_off = 0;
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_JOURNAL)
+    const bool flag_journal        = (IMG_OP_MODE_CMP != mode) && (NULL != p_file_hash);
+    const bool flag_in_place       = (IMG_OP_MODE_CMP != mode) && file_img_reader_is_in_place(p_reader);
+    uint32_t   cnt_sectors_journal = 0;
+    if (flag_in_place)
     {
-        rc = flash_area_erase(p_fa_dst, 0, p_fa_dst->fa_size);
-        if (rc != 0)
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_PATCH)
+        /* The old image is overwritten, so the delta update can only be resumed from the journal */
+        if (!flag_journal)
         {
-            LOG_ERR(
-                "Failed to erase flash area %d (address 0x%08" PRIxPTR ", size 0x%08" PRIx32 "), rc=%d",
-                fa_id_dst,
-                (uintptr_t)p_fa_dst->fa_off,
-                (uint32_t)p_fa_dst->fa_size,
-                rc);
+            LOG_ERR("Delta update can't be applied without the copy journal");
+            flash_area_close(p_fa_dst);
             return false;
         }
+        /* Below the resume offset the reader returns the slot itself, which is covered by the validated hash */
+        start_off = (off_t)file_img_reader_get_in_place_resume_off(p_reader);
+        file_img_reader_begin_in_place_write(p_reader);
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_PIPELINE)
+        /* A sector must not be read ahead of the journal, its old contents would replace a saved snapshot */
+        src.is_pipelined = false;
+#endif
+#endif // CONFIG_RUUVI_MCUBOOT_FILE_IMG_PATCH
+    }
+    else if (flag_journal)
+    {
+        start_off = img_op_journal_get_resume_off(&ctx, p_reader, p_file_hash, src_file_size);
     }
+    else
+    {
+        /* Nothing to resume */
+    }
+#endif
 
-    bool   is_success = true;
-    size_t rem_len    = src_file_size;
-    off_t  offset     = 0;
-    while (rem_len > 0)
+    if (!img_op_src_seek(&src, start_off))
     {
-        const size_t len = (rem_len > TMP_BUF_SIZE) ? TMP_BUF_SIZE : rem_len;
+        flash_area_close(p_fa_dst);
+        return false;
+    }
 
-        rc = fs_read(p_file_src, tmp_buf1, len);
-        if (rc < 0)
+    bool  is_success = true;
+    off_t offset     = start_off;
+    while (offset < src_file_size)
+    {
+        if (!img_op_enter_sector(&ctx, offset))
         {
-            LOG_ERR("Failed to read file at offset 0x%08" PRIxPTR ", rc=%d", (uintptr_t)offset, rc);
             is_success = false;
             break;
         }
-        if (rc != len)
+        const uint8_t* p_buf = NULL;
+        size_t         len   = 0;
+        if (!img_op_src_get_chunk(&src, offset, &p_buf, &len))
         {
-            LOG_ERR(
-                "Failed to read file at offset 0x%08" PRIxPTR ", read %u bytes, expected %" PRIu32 " bytes",
-                (uintptr_t)offset,
-                (unsigned)rc,
-                (uint32_t)len);
             is_success = false;
             break;
         }
-        // len == 0, len % 4 = 0, padding = 0
-        // len == 1, len % 4 = 1, padding = 3
-        // len == 2, len % 4 = 2, padding = 2
-        // len == 3, len % 4 = 3, padding = 1
-        // len == 4, len % 4 = 0, padding = 0
-        const size_t padding = (0 != (len % 4)) ? (4 - (len % 4)) : 0;
-        if (0 != padding)
+        const size_t len_padded      = (len + (sizeof(uint32_t) - 1U)) & ~(sizeof(uint32_t) - 1U);
+        const bool   flag_last_chunk = ((offset + (off_t)len) >= src_file_size);
+        bool         flag_rewind     = false;
+        is_success = img_op_process_chunk(&ctx, offset, p_buf, len_padded, flag_last_chunk, &flag_rewind);
+        img_op_src_release_chunk(&src);
+        if (!is_success)
         {
-            memset(&tmp_buf1[len], UINT8_MAX, padding);
+            break;
+        }
+        if (flag_rewind)
+        {
+            offset = ctx.sector_off;
+            if (!img_op_src_seek(&src, offset))
+            {
+                is_success = false;
+                break;
+            }
+            continue;
         }
 
-        if (!cb_img_process(p_fa_dst, offset, tmp_buf1, len + padding))
+        offset += (off_t)len;
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_JOURNAL)
+        if (flag_journal && (offset == img_op_sector_end(&ctx)))
         {
-            is_success = false;
-            break;
+            cnt_sectors_journal += 1;
+            /* A delta update is journaled after every sector, only the last sectors of the old image are saved */
+            if (flag_in_place)
+            {
+                /* The next sector must not be erased before its old contents are saved,
+                 * otherwise the delta update could not be resumed */
+                if (!mcuboot_img_journal_save(fa_id_dst, p_file_hash, (uint32_t)src_file_size, (uint32_t)offset))
+                {
+                    is_success = false;
+                    break;
+                }
+            }
+            else if (0 == (cnt_sectors_journal % CONFIG_RUUVI_MCUBOOT_IMG_OP_JOURNAL_INTERVAL))
+            {
+                (void)mcuboot_img_journal_save(fa_id_dst, p_file_hash, (uint32_t)src_file_size, (uint32_t)offset);
+            }
+            else
+            {
+                /* The journal is saved every CONFIG_RUUVI_MCUBOOT_IMG_OP_JOURNAL_INTERVAL sectors */
+            }
         }
+#endif
+    }
+    img_op_src_close(&src);
 
-        offset += len;
-        rem_len -= len;
+    if (is_success && (IMG_OP_MODE_CMP != mode))
+    {
+        LOG_INF(
+            "Sectors programmed: %" PRIu32 ", sectors skipped as unchanged: %" PRIu32
+            ", blank bytes not programmed: %" PRIu32 ", sector retries: %" PRIu32,
+            ctx.cnt_sectors_written,
+            ctx.cnt_sectors_skipped,
+            ctx.bytes_elided,
+            ctx.cnt_retries);
+        is_success = img_op_erase_tail(&ctx, (0 != ctx.sector_size) ? img_op_sector_end(&ctx) : start_off);
+    }
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_JOURNAL)
+    if (flag_in_place && (!is_success))
+    {
+        /* The old image is partially overwritten, the journal and the saved sectors are needed to retry */
+        LOG_WRN("Delta update failed, it will be resumed on the next attempt");
     }
+    else if (flag_journal && (!is_success) && file_img_reader_is_chunk_verified(p_reader))
+    {
+        /* The file is kept after a failed copy of a chunk-verified image, which is not verified before the erase */
+        LOG_WRN("Copy failed, it will be resumed on the next attempt");
+    }
+    else if (flag_journal)
+    {
+        /* The file is removed after a failed copy as well, so there is nothing left to resume */
+        mcuboot_img_journal_remove();
+#if defined(CONFIG_RUUVI_MCUBOOT_FILE_IMG_PATCH)
+        if (flag_in_place)
+        {
+            file_img_reader_end_in_place_write(p_reader);
+        }
+#endif
+    }
+    else
+    {
+        /* Nothing was journaled */
+    }
+#endif
 
     flash_area_close(p_fa_dst);
     return is_success;
 }
 
-static bool
-cb_img_write(
-    const struct flash_area* p_fa_dst,
-    const off_t              offset,
-    const uint8_t*           p_src_img_data_buf,
-    const size_t             buf_len)
+bool
+mcuboot_img_op_copy(
+    const fa_id_t            fa_id_dst,
+    file_img_reader_t* const p_reader,
+    const uint8_t* const     p_file_hash,
+    const uint32_t           img_size)
 {
-    zephyr_api_ret_t rc = flash_area_write(p_fa_dst, offset, p_src_img_data_buf, buf_len);
-    if (0 != rc)
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_DIFF_COPY)
+    return img_process(fa_id_dst, p_reader, IMG_OP_MODE_COPY_DIFF, p_file_hash, img_size);
+#else
+    return img_process(fa_id_dst, p_reader, IMG_OP_MODE_COPY, p_file_hash, img_size);
+#endif
+}
+
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_JOURNAL)
+bool
+mcuboot_img_op_is_copy_interrupted(const fa_id_t fa_id_dst, const uint8_t* const p_file_hash)
+{
+    uint32_t file_size  = 0;
+    uint32_t resume_off = 0;
+    return mcuboot_img_journal_load(fa_id_dst, p_file_hash, &file_size, &resume_off);
+}
+#endif
+
+bool
+mcuboot_img_op_cmp(const fa_id_t fa_id_dst, file_img_reader_t* const p_reader)
+{
+    return img_process(fa_id_dst, p_reader, IMG_OP_MODE_CMP, NULL, 0);
+}
+
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_SKIP_INSTALLED)
+bool
+mcuboot_img_op_is_installed(const fa_id_t fa_id_dst, const uint8_t* const p_file_hash)
+{
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_JOURNAL)
+    if (mcuboot_img_op_is_copy_interrupted(fa_id_dst, p_file_hash))
     {
-        LOG_ERR("Failed to write at address 0x%08x, rc=%d", (unsigned)(p_fa_dst->fa_off + offset), rc);
+        /* The hash TLV may be already programmed while some sectors before it are not */
         return false;
     }
+#endif
+    uint8_t slot_hash[IMAGE_HASH_SIZE];
+    if (!load_image_hash_tlv(fa_id_dst, EXPECTED_HASH_TLV, slot_hash))
+    {
+        return false;
+    }
+    FIH_DECLARE(fih_rc, FIH_FAILURE);
+    FIH_CALL(boot_fih_memequal, fih_rc, slot_hash, p_file_hash, IMAGE_HASH_SIZE);
+    if (FIH_NOT_EQ(fih_rc, FIH_SUCCESS))
+    {
+        return false;
+    }
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_VERIFY_SLOT_HASH)
+    /* A failed verification of the installed image keeps the file, but leaves the matching hash TLV in the slot */
+    return mcuboot_img_op_verify_hash(fa_id_dst, p_file_hash);
+#else
     return true;
+#endif
 }
+#endif // CONFIG_RUUVI_MCUBOOT_IMG_OP_SKIP_INSTALLED
 
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_VERIFY_SLOT_HASH)
+/**
+ * Hash the first size bytes of a flash area which is not memory-mapped, reading them chunk by chunk.
+ */
 static bool
-cb_img_cmp(
-    const struct flash_area* p_fa_dst,
-    const off_t              offset,
-    const uint8_t*           p_src_img_data_buf,
-    const size_t             buf_len)
+img_op_sha_update_from_flash_area(
+    bootutil_sha_context* const    p_sha_ctx,
+    const struct flash_area* const p_fa,
+    const uint32_t                 size)
 {
-    static uint8_t tmp_buf2[TMP_BUF_SIZE];
+    for (uint32_t off = 0; off < size; off += sizeof(g_img_op_flash_buf))
+    {
+        const size_t rd_len = ((size - off) > sizeof(g_img_op_flash_buf)) ? sizeof(g_img_op_flash_buf) : (size - off);
 
-    zephyr_api_ret_t rc = flash_area_read(p_fa_dst, offset, tmp_buf2, buf_len);
+        const zephyr_api_ret_t rc = flash_area_read(p_fa, (off_t)off, g_img_op_flash_buf, rd_len);
+        if (0 != rc)
+        {
+            LOG_ERR("Failed to read flash at address 0x%08x, rc=%d", (unsigned)(p_fa->fa_off + off), rc);
+            return false;
+        }
+        bootutil_sha_update(p_sha_ctx, g_img_op_flash_buf, rd_len);
+    }
+    return true;
+}
+
+bool
+mcuboot_img_op_verify_hash(const fa_id_t fa_id_dst, const uint8_t* const p_expected_hash)
+{
+    const struct flash_area* p_fa_dst = NULL;
+
+    const int32_t rc = flash_area_open(fa_id_dst, &p_fa_dst);
     if (0 != rc)
     {
-        LOG_ERR("Failed to read flash at address 0x%08x, rc=%d", (unsigned)(p_fa_dst->fa_off + offset), rc);
+        LOG_ERR("Failed to open flash area %d, rc=%d", fa_id_dst, rc);
         return false;
     }
 
-    if (memcmp(p_src_img_data_buf, tmp_buf2, buf_len) != 0)
+    /* The internal flash is memory-mapped, so the slot is hashed in place. Other flash devices are read in chunks. */
+    const bool          is_mapped = is_flash_area_memory_mapped(p_fa_dst);
+    const uintptr_t     addr      = (uintptr_t)(CONFIG_FLASH_BASE_ADDRESS + p_fa_dst->fa_off);
+    struct image_header img_hdr   = { 0 };
+    if (is_mapped)
     {
-        LOG_INF("memcmp failed at address 0x%08x", (unsigned)(p_fa_dst->fa_off + offset));
-        LOG_HEXDUMP_DBG(p_src_img_data_buf, buf_len, "src:");
-        LOG_HEXDUMP_DBG(tmp_buf2, buf_len, "dst:");
+        memcpy(&img_hdr, (const void*)addr, sizeof(img_hdr)); // NOSONAR: internal flash is memory-mapped
+    }
+    else if (0 != flash_area_read(p_fa_dst, 0, &img_hdr, sizeof(img_hdr)))
+    {
+        LOG_ERR("Failed to read the image header in flash area %d", fa_id_dst);
+        flash_area_close(p_fa_dst);
+        return false;
+    }
+    if (IMAGE_MAGIC != img_hdr.ih_magic)
+    {
+        LOG_ERR("Bad image magic in flash area %d: 0x%08" PRIx32, fa_id_dst, img_hdr.ih_magic);
+        flash_area_close(p_fa_dst);
         return false;
     }
-    return true;
-}
 
-bool
-mcuboot_img_op_copy(const fa_id_t fa_id_dst, struct fs_file_t* const p_file_src)
-{
-    return img_process(fa_id_dst, p_file_src, true, &cb_img_write);
-}
+    /* Hash is computed over image header, image itself and protected TLVs - the same as in file_img_hash(). */
+    const uint32_t size = (uint32_t)img_hdr.ih_hdr_size + img_hdr.ih_img_size + img_hdr.ih_protect_tlv_size;
+    if (size > p_fa_dst->fa_size)
+    {
+        LOG_ERR("Image size %" PRIu32 " is too big for flash area %d", size, fa_id_dst);
+        flash_area_close(p_fa_dst);
+        return false;
+    }
 
-bool
-mcuboot_img_op_cmp(const fa_id_t fa_id_dst, struct fs_file_t* const p_file_src)
-{
-    return img_process(fa_id_dst, p_file_src, false, &cb_img_cmp);
+    uint8_t              hash[IMAGE_HASH_SIZE];
+    bootutil_sha_context sha_ctx;
+    bool                 is_read = true;
+    const uint32_t       t_start = mcuboot_img_stats_phase_begin();
+    bootutil_sha_init(&sha_ctx);
+    if (is_mapped)
+    {
+        bootutil_sha_update(&sha_ctx, (const void*)addr, size); // NOSONAR: internal flash is memory-mapped
+    }
+    else
+    {
+        is_read = img_op_sha_update_from_flash_area(&sha_ctx, p_fa_dst, size);
+    }
+    bootutil_sha_finish(&sha_ctx, hash);
+    bootutil_sha_drop(&sha_ctx);
+    mcuboot_img_stats_phase_end(MCUBOOT_IMG_STATS_PHASE_VERIFY, t_start, size);
+
+    flash_area_close(p_fa_dst);
+    if (!is_read)
+    {
+        return false;
+    }
+
+    FIH_DECLARE(fih_rc, FIH_FAILURE);
+    FIH_CALL(boot_fih_memequal, fih_rc, hash, p_expected_hash, IMAGE_HASH_SIZE);
+    if (FIH_NOT_EQ(fih_rc, FIH_SUCCESS))
+    {
+        LOG_ERR("Image hash in flash area %d does not match the hash of the update file", fa_id_dst);
+        return false;
+    }
+    LOG_INF("Image hash in flash area %d matches the hash of the update file", fa_id_dst);
+    return true;
 }
+#endif // CONFIG_RUUVI_MCUBOOT_IMG_OP_VERIFY_SLOT_HASH
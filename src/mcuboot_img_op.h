@@ -6,18 +6,69 @@
 #define MCUBOOT_IMG_OP_H
 
 #include <stdbool.h>
-#include <zephyr/fs/fs_interface.h>
+#include <stdint.h>
 #include "ruuvi_fa_id.h"
+#include "file_img_reader.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * Copy the image from the file to the destination flash area.
+ * @param fa_id_dst Flash area ID of the destination slot.
+ * @param p_reader Reader of the opened update file.
+ * @param p_file_hash Hash of the validated image in the file (IMAGE_HASH_SIZE bytes), used to resume
+ *                    an interrupted copy of the same file if the slot holds the file below the journaled offset.
+ *                    NULL if the copy can't be resumed.
+ * @param img_size Number of bytes to copy from the beginning of the file (the validated extent of the image),
+ *                 0 to copy the whole file.
+ * @return true on success.
+ */
+bool
+mcuboot_img_op_copy(
+    const fa_id_t            fa_id_dst,
+    file_img_reader_t* const p_reader,
+    const uint8_t* const     p_file_hash,
+    const uint32_t           img_size);
+
+bool
+mcuboot_img_op_cmp(const fa_id_t fa_id_dst, file_img_reader_t* const p_reader);
+
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_JOURNAL)
+/**
+ * Check if the copy journal contains the progress of an interrupted copy of the given image
+ * to the given flash area.
+ */
+bool
+mcuboot_img_op_is_copy_interrupted(const fa_id_t fa_id_dst, const uint8_t* const p_file_hash);
+#endif
+
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_SKIP_INSTALLED)
+/**
+ * Check if the destination flash area already contains the image from the update file.
+ * The hash TLV of the installed image is compared with the hash of the file first, which is cheap.
+ * On a match the installed image is hashed in place (if CONFIG_RUUVI_MCUBOOT_IMG_OP_VERIFY_SLOT_HASH is enabled).
+ * @param fa_id_dst Flash area ID of the destination slot.
+ * @param p_file_hash Hash of the validated image in the file (IMAGE_HASH_SIZE bytes).
+ * @return true if the copy can be skipped.
+ */
 bool
-mcuboot_img_op_copy(const fa_id_t fa_id_dst, struct fs_file_t* const p_file_src);
+mcuboot_img_op_is_installed(const fa_id_t fa_id_dst, const uint8_t* const p_file_hash);
+#endif
 
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_OP_VERIFY_SLOT_HASH)
+/**
+ * Hash the image in the destination flash area (header, image and protected TLVs)
+ * and compare the result with the hash calculated while validating the update file.
+ * @param fa_id_dst Flash area ID of the destination slot.
+ * @param p_expected_hash Pointer to the expected hash (IMAGE_HASH_SIZE bytes).
+ * @return true if the image in the flash area has the expected hash.
+ */
 bool
-mcuboot_img_op_cmp(const fa_id_t fa_id_dst, struct fs_file_t* const p_file_src);
+mcuboot_img_op_verify_hash(const fa_id_t fa_id_dst, const uint8_t* const p_expected_hash);
+#endif
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,183 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#include "mcuboot_img_stats.h"
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/logging/log.h>
+#include <bootutil/boot_status.h>
+#include "mcuboot_fa_utils.h"
+#include "zephyr_api.h"
+
+LOG_MODULE_DECLARE(B0, LOG_LEVEL_INF);
+
+#define MCUBOOT_IMG_STATS_MAGIC 0x53544154U /* "STAT" */
+
+/**
+ * Statistics of the images installed before the last reboot.
+ * The record is kept in RAM which is not initialized on startup, so it survives a warm reset,
+ * but it can be overwritten by B0, hence the magic and the CRC.
+ */
+typedef struct mcuboot_img_stats_retained_t
+{
+    uint32_t            magic;
+    uint32_t            cnt;
+    mcuboot_img_stats_t images[MCUBOOT_IMG_STATS_MAX_IMAGES];
+    uint32_t            crc; /* CRC32 of all the previous fields */
+} mcuboot_img_stats_retained_t;
+
+static __noinit mcuboot_img_stats_retained_t g_img_stats_retained;
+
+static mcuboot_img_stats_t g_img_stats_cur;
+static uint32_t            g_img_stats_start_cycles;
+static bool                g_img_stats_is_active;
+
+static const char* const g_img_stats_phase_names[MCUBOOT_IMG_STATS_PHASE_NUM] = {
+    [MCUBOOT_IMG_STATS_PHASE_ERASE]   = "erase",
+    [MCUBOOT_IMG_STATS_PHASE_READ]    = "read",
+    [MCUBOOT_IMG_STATS_PHASE_PROGRAM] = "program",
+    [MCUBOOT_IMG_STATS_PHASE_COMPARE] = "compare",
+    [MCUBOOT_IMG_STATS_PHASE_VERIFY]  = "verify",
+};
+
+static uint32_t
+mcuboot_img_stats_calc_crc(const mcuboot_img_stats_retained_t* const p_retained)
+{
+    return crc32_ieee((const uint8_t*)p_retained, offsetof(mcuboot_img_stats_retained_t, crc));
+}
+
+static bool
+mcuboot_img_stats_is_retained_valid(void)
+{
+    return (MCUBOOT_IMG_STATS_MAGIC == g_img_stats_retained.magic)
+           && (g_img_stats_retained.cnt <= MCUBOOT_IMG_STATS_MAX_IMAGES)
+           && (mcuboot_img_stats_calc_crc(&g_img_stats_retained) == g_img_stats_retained.crc);
+}
+
+void
+mcuboot_img_stats_begin_image(const fa_id_t fa_id)
+{
+    memset(&g_img_stats_cur, 0, sizeof(g_img_stats_cur));
+    g_img_stats_cur.fa_id    = (uint32_t)fa_id;
+    g_img_stats_start_cycles = k_cycle_get_32();
+    g_img_stats_is_active    = true;
+}
+
+void
+mcuboot_img_stats_end_image(const bool is_success)
+{
+    if (!g_img_stats_is_active)
+    {
+        return;
+    }
+    g_img_stats_is_active         = false;
+    g_img_stats_cur.is_success    = is_success ? 1U : 0U;
+    g_img_stats_cur.total_time_us = k_cyc_to_us_floor32(k_cycle_get_32() - g_img_stats_start_cycles);
+
+    const mcuboot_img_stats_phase_t* const p_phases = g_img_stats_cur.phases;
+
+    LOG_INF(
+        "Install stats for %s: %s, total %" PRIu32 " ms; %s: %" PRIu32 " ms/%" PRIu32 " B, %s: %" PRIu32
+        " ms/%" PRIu32 " B, %s: %" PRIu32 " ms/%" PRIu32 " B, %s: %" PRIu32 " ms/%" PRIu32 " B, %s: %" PRIu32
+        " ms/%" PRIu32 " B",
+        get_image_slot_name((fa_id_t)g_img_stats_cur.fa_id),
+        is_success ? "OK" : "FAIL",
+        g_img_stats_cur.total_time_us / 1000U,
+        g_img_stats_phase_names[MCUBOOT_IMG_STATS_PHASE_ERASE],
+        p_phases[MCUBOOT_IMG_STATS_PHASE_ERASE].time_us / 1000U,
+        p_phases[MCUBOOT_IMG_STATS_PHASE_ERASE].bytes,
+        g_img_stats_phase_names[MCUBOOT_IMG_STATS_PHASE_READ],
+        p_phases[MCUBOOT_IMG_STATS_PHASE_READ].time_us / 1000U,
+        p_phases[MCUBOOT_IMG_STATS_PHASE_READ].bytes,
+        g_img_stats_phase_names[MCUBOOT_IMG_STATS_PHASE_PROGRAM],
+        p_phases[MCUBOOT_IMG_STATS_PHASE_PROGRAM].time_us / 1000U,
+        p_phases[MCUBOOT_IMG_STATS_PHASE_PROGRAM].bytes,
+        g_img_stats_phase_names[MCUBOOT_IMG_STATS_PHASE_COMPARE],
+        p_phases[MCUBOOT_IMG_STATS_PHASE_COMPARE].time_us / 1000U,
+        p_phases[MCUBOOT_IMG_STATS_PHASE_COMPARE].bytes,
+        g_img_stats_phase_names[MCUBOOT_IMG_STATS_PHASE_VERIFY],
+        p_phases[MCUBOOT_IMG_STATS_PHASE_VERIFY].time_us / 1000U,
+        p_phases[MCUBOOT_IMG_STATS_PHASE_VERIFY].bytes);
+
+    if (!mcuboot_img_stats_is_retained_valid())
+    {
+        memset(&g_img_stats_retained, 0, sizeof(g_img_stats_retained));
+        g_img_stats_retained.magic = MCUBOOT_IMG_STATS_MAGIC;
+    }
+    if (g_img_stats_retained.cnt < MCUBOOT_IMG_STATS_MAX_IMAGES)
+    {
+        g_img_stats_retained.images[g_img_stats_retained.cnt] = g_img_stats_cur;
+        g_img_stats_retained.cnt += 1;
+    }
+    g_img_stats_retained.crc = mcuboot_img_stats_calc_crc(&g_img_stats_retained);
+}
+
+uint32_t
+mcuboot_img_stats_phase_begin(void)
+{
+    return k_cycle_get_32();
+}
+
+void
+mcuboot_img_stats_phase_end(const mcuboot_img_stats_phase_e phase, const uint32_t start_cycles, const size_t bytes)
+{
+    if (!g_img_stats_is_active)
+    {
+        return;
+    }
+    /* Only the thread which installs the image updates the statistics, other threads use local records */
+    mcuboot_img_stats_phase_end_local(&g_img_stats_cur.phases[phase], start_cycles, bytes);
+}
+
+void
+mcuboot_img_stats_phase_end_local(
+    mcuboot_img_stats_phase_t* const p_local,
+    const uint32_t                   start_cycles,
+    const size_t                     bytes)
+{
+    p_local->time_us += k_cyc_to_us_floor32(k_cycle_get_32() - start_cycles);
+    p_local->bytes += (uint32_t)bytes;
+}
+
+void
+mcuboot_img_stats_phase_merge(const mcuboot_img_stats_phase_e phase, const mcuboot_img_stats_phase_t* const p_local)
+{
+    if (!g_img_stats_is_active)
+    {
+        return;
+    }
+    mcuboot_img_stats_phase_t* const p_phase = &g_img_stats_cur.phases[phase];
+    p_phase->time_us += p_local->time_us;
+    p_phase->bytes += p_local->bytes;
+}
+
+bool
+mcuboot_img_stats_export(void)
+{
+    if (!mcuboot_img_stats_is_retained_valid())
+    {
+        return true;
+    }
+    bool res = true;
+    for (uint32_t i = 0; i < g_img_stats_retained.cnt; ++i)
+    {
+        const zephyr_api_ret_t rc = boot_add_data_to_shared_area(
+            MCUBOOT_IMG_STATS_TLV_MAJOR,
+            (uint16_t)i,
+            sizeof(g_img_stats_retained.images[i]),
+            (const uint8_t*)&g_img_stats_retained.images[i]);
+        if (0 != rc)
+        {
+            LOG_ERR("Failed to add install stats to shared area, rc=%d", rc);
+            res = false;
+            break;
+        }
+    }
+    /* The statistics are reported only once, after the reboot which follows the installation */
+    memset(&g_img_stats_retained, 0, sizeof(g_img_stats_retained));
+    return res;
+}
@@ -0,0 +1,149 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#ifndef MCUBOOT_IMG_STATS_H
+#define MCUBOOT_IMG_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "ruuvi_fa_id.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Major TLV type of the installation statistics in the MCUboot shared data area,
+ * the minor TLV type is the index of the record (one record per installed image). */
+#define MCUBOOT_IMG_STATS_TLV_MAJOR 0xE
+
+/* Max number of images installed during one boot: s0 or s1, fw_loader and app */
+#define MCUBOOT_IMG_STATS_MAX_IMAGES 3
+
+typedef enum mcuboot_img_stats_phase_e
+{
+    MCUBOOT_IMG_STATS_PHASE_ERASE,   /* Erasing sectors of the internal flash */
+    MCUBOOT_IMG_STATS_PHASE_READ,    /* Reading the update file from LittleFS */
+    MCUBOOT_IMG_STATS_PHASE_PROGRAM, /* Programming the internal flash */
+    MCUBOOT_IMG_STATS_PHASE_COMPARE, /* Comparing sectors with the file and checking them for blank */
+    MCUBOOT_IMG_STATS_PHASE_VERIFY,  /* Verifying programmed chunks and the hash of the installed image */
+    MCUBOOT_IMG_STATS_PHASE_NUM,
+} mcuboot_img_stats_phase_e;
+
+typedef struct mcuboot_img_stats_phase_t
+{
+    uint32_t time_us;
+    uint32_t bytes;
+} mcuboot_img_stats_phase_t;
+
+/**
+ * Statistics of one image installation, exported as is in the MCUboot shared data area.
+ */
+typedef struct mcuboot_img_stats_t
+{
+    uint32_t                  fa_id;
+    uint32_t                  is_success;
+    uint32_t                  total_time_us;
+    mcuboot_img_stats_phase_t phases[MCUBOOT_IMG_STATS_PHASE_NUM];
+} mcuboot_img_stats_t;
+
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_STATS)
+
+void
+mcuboot_img_stats_begin_image(const fa_id_t fa_id);
+
+/**
+ * Log the summary of the current image and save it in the retained RAM,
+ * so that it survives the reboot after the installation.
+ */
+void
+mcuboot_img_stats_end_image(const bool is_success);
+
+uint32_t
+mcuboot_img_stats_phase_begin(void);
+
+void
+mcuboot_img_stats_phase_end(const mcuboot_img_stats_phase_e phase, const uint32_t start_cycles, const size_t bytes);
+
+/**
+ * Account a phase run by another thread in its own record, which is merged with mcuboot_img_stats_phase_merge()
+ * after the thread has been joined.
+ */
+void
+mcuboot_img_stats_phase_end_local(
+    mcuboot_img_stats_phase_t* const p_local,
+    const uint32_t                   start_cycles,
+    const size_t                     bytes);
+
+/**
+ * Add the record of a phase run by another thread to the statistics of the current image.
+ */
+void
+mcuboot_img_stats_phase_merge(const mcuboot_img_stats_phase_e phase, const mcuboot_img_stats_phase_t* const p_local);
+
+/**
+ * Add the statistics saved before the reboot to the MCUboot shared data area and clear them.
+ */
+bool
+mcuboot_img_stats_export(void);
+
+#else
+
+static inline void
+mcuboot_img_stats_begin_image(const fa_id_t fa_id)
+{
+    (void)fa_id;
+}
+
+static inline void
+mcuboot_img_stats_end_image(const bool is_success)
+{
+    (void)is_success;
+}
+
+static inline uint32_t
+mcuboot_img_stats_phase_begin(void)
+{
+    return 0;
+}
+
+static inline void
+mcuboot_img_stats_phase_end(const mcuboot_img_stats_phase_e phase, const uint32_t start_cycles, const size_t bytes)
+{
+    (void)phase;
+    (void)start_cycles;
+    (void)bytes;
+}
+
+static inline void
+mcuboot_img_stats_phase_end_local(
+    mcuboot_img_stats_phase_t* const p_local,
+    const uint32_t                   start_cycles,
+    const size_t                     bytes)
+{
+    (void)p_local;
+    (void)start_cycles;
+    (void)bytes;
+}
+
+static inline void
+mcuboot_img_stats_phase_merge(const mcuboot_img_stats_phase_e phase, const mcuboot_img_stats_phase_t* const p_local)
+{
+    (void)phase;
+    (void)p_local;
+}
+
+static inline bool
+mcuboot_img_stats_export(void)
+{
+    return true;
+}
+
+#endif // CONFIG_RUUVI_MCUBOOT_IMG_STATS
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MCUBOOT_IMG_STATS_H
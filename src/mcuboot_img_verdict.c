@@ -0,0 +1,59 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#include "mcuboot_img_verdict.h"
+#include <stddef.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/logging/log.h>
+#include "mcuboot_fa_utils.h"
+
+LOG_MODULE_DECLARE(mcuboot, CONFIG_MCUBOOT_LOG_LEVEL);
+
+#define MCUBOOT_IMG_VERDICT_MAGIC 0x56524443U /* "VRDC" */
+
+/**
+ * The verdict is kept in RAM which is not initialized on startup, so it survives the reboot into the other MCUboot,
+ * but it can be overwritten by B0 or by the other MCUboot, hence the magic and the CRC.
+ */
+typedef struct mcuboot_img_verdict_retained_t
+{
+    uint32_t              magic;
+    mcuboot_img_verdict_t verdict;
+    uint32_t              crc; /* CRC32 of all the previous fields */
+} mcuboot_img_verdict_retained_t;
+
+static __noinit mcuboot_img_verdict_retained_t g_img_verdict_retained;
+
+static uint32_t
+mcuboot_img_verdict_calc_crc(const mcuboot_img_verdict_retained_t* const p_retained)
+{
+    return crc32_ieee((const uint8_t*)p_retained, offsetof(mcuboot_img_verdict_retained_t, crc));
+}
+
+void
+mcuboot_img_verdict_save(const mcuboot_img_verdict_t* const p_verdict)
+{
+    memset(&g_img_verdict_retained, 0, sizeof(g_img_verdict_retained));
+    g_img_verdict_retained.magic   = MCUBOOT_IMG_VERDICT_MAGIC;
+    g_img_verdict_retained.verdict = *p_verdict;
+    g_img_verdict_retained.crc     = mcuboot_img_verdict_calc_crc(&g_img_verdict_retained);
+    LOG_INF("Saved the verdict for the image for %s", get_image_slot_name((fa_id_t)p_verdict->fa_id));
+}
+
+bool
+mcuboot_img_verdict_take(const fa_id_t fa_id, mcuboot_img_verdict_t* const p_verdict)
+{
+    const bool is_valid = (MCUBOOT_IMG_VERDICT_MAGIC == g_img_verdict_retained.magic)
+                          && (mcuboot_img_verdict_calc_crc(&g_img_verdict_retained) == g_img_verdict_retained.crc)
+                          && ((uint32_t)fa_id == g_img_verdict_retained.verdict.fa_id);
+    if (!is_valid)
+    {
+        return false;
+    }
+    *p_verdict = g_img_verdict_retained.verdict;
+    memset(&g_img_verdict_retained, 0, sizeof(g_img_verdict_retained));
+    return true;
+}
@@ -0,0 +1,64 @@
+/**
+ * @copyright Ruuvi Innovations Ltd, license BSD-3-Clause.
+ */
+
+#ifndef MCUBOOT_IMG_VERDICT_H
+#define MCUBOOT_IMG_VERDICT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <bootutil/image.h>
+#include "ruuvi_fa_id.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Verdict of the validation of an MCUboot self-update file, which is installed by the other MCUboot after reboot.
+ */
+typedef struct mcuboot_img_verdict_t
+{
+    uint32_t fa_id;     /* Destination slot: s0 or s1 */
+    uint32_t file_size; /* Size of the image file as it is read by the file reader */
+    uint32_t extent;    /* Size of the header, the image and all the TLVs */
+    uint8_t  img_hash[IMAGE_HASH_SIZE];
+} mcuboot_img_verdict_t;
+
+#if defined(CONFIG_RUUVI_MCUBOOT_IMG_VERDICT)
+
+/**
+ * Save the verdict of the file validated by B0 and MCUboot signatures in the RAM retained over the reboot.
+ */
+void
+mcuboot_img_verdict_save(const mcuboot_img_verdict_t* const p_verdict);
+
+/**
+ * Take the verdict saved for the slot. The verdict is removed, so it is used only once after it was saved.
+ */
+bool
+mcuboot_img_verdict_take(const fa_id_t fa_id, mcuboot_img_verdict_t* const p_verdict);
+
+#else
+
+static inline void
+mcuboot_img_verdict_save(const mcuboot_img_verdict_t* const p_verdict)
+{
+    (void)p_verdict;
+}
+
+static inline bool
+mcuboot_img_verdict_take(const fa_id_t fa_id, mcuboot_img_verdict_t* const p_verdict)
+{
+    (void)fa_id;
+    (void)p_verdict;
+    return false;
+}
+
+#endif // CONFIG_RUUVI_MCUBOOT_IMG_VERDICT
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MCUBOOT_IMG_VERDICT_H